@@ -0,0 +1,134 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "AllocationTracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if MBI_TRACK_ALLOCATIONS
+
+static std::atomic<long long> numViolations { 0 };
+static thread_local int realtimeDepth = 0;
+
+static inline void noteHeapActivity()
+{
+    if (realtimeDepth > 0)
+        numViolations.fetch_add(1, std::memory_order_relaxed);
+}
+
+AllocationTracker::RealtimeScope::RealtimeScope() :
+    violationsOnEntry(numViolations.load(std::memory_order_relaxed))
+{
+    ++realtimeDepth;
+}
+
+AllocationTracker::RealtimeScope::~RealtimeScope()
+{
+    --realtimeDepth;
+}
+
+bool AllocationTracker::RealtimeScope::hasTouchedHeap() const
+{
+    return numViolations.load(std::memory_order_relaxed) != violationsOnEntry;
+}
+
+bool AllocationTracker::isRealtimeThread()
+{
+    return realtimeDepth > 0;
+}
+
+long long AllocationTracker::getNumViolations()
+{
+    return numViolations.load(std::memory_order_relaxed);
+}
+
+/* Replacements for the global allocation functions. They forward to malloc and
+   free, so memory can still be released by the host's operator delete and vice
+   versa. On Linux the plugin is linked with -Bsymbolic-functions (see
+   CMakeLists.txt), so these only replace the allocators used by the plugin's
+   own code and leave the rest of the process alone. */
+
+static void* allocate(std::size_t size)
+{
+    noteHeapActivity();
+
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+static void release(void* p) noexcept
+{
+    if (p != nullptr)
+        noteHeapActivity();
+
+    std::free(p);
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    noteHeapActivity();
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    noteHeapActivity();
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, std::size_t) noexcept { release(p); }
+void operator delete[](void* p, std::size_t) noexcept { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { release(p); }
+
+#else
+
+AllocationTracker::RealtimeScope::RealtimeScope() { }
+
+AllocationTracker::RealtimeScope::~RealtimeScope() { }
+
+bool AllocationTracker::RealtimeScope::hasTouchedHeap() const
+{
+    return false;
+}
+
+bool AllocationTracker::isRealtimeThread()
+{
+    return false;
+}
+
+long long AllocationTracker::getNumViolations()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef ALLOCATION_TRACKER_H_INCLUDED
+#define ALLOCATION_TRACKER_H_INCLUDED
+
+/* Allocation tracking is on by default in debug builds; define
+   MBI_TRACK_ALLOCATIONS to 0 or 1 to override. */
+#ifndef MBI_TRACK_ALLOCATIONS
+#if defined(DEBUG) || defined(_DEBUG)
+#define MBI_TRACK_ALLOCATIONS 1
+#else
+#define MBI_TRACK_ALLOCATIONS 0
+#endif
+#endif
+
+/**
+    Flags heap activity on the processing thread.
+
+    When tracking is enabled, the plugin replaces the global operator new and
+    operator delete for its own code. Any allocation or deallocation made
+    while a RealtimeScope is active on the calling thread is counted, so the
+    caller can assert that the scope stayed allocation-free. The count is
+    shared by all threads, so a scope also sees the heap activity of worker
+    threads that run its tasks in scopes of their own (see WorkerPool). Without tracking
+    the scope does nothing and always reports a clean heap.
+ */
+class AllocationTracker
+{
+public:
+
+    /** Marks the current thread as real-time for the lifetime of the object */
+    class RealtimeScope
+    {
+    public:
+        /** Constructor */
+        RealtimeScope();
+
+        /** Destructor */
+        ~RealtimeScope();
+
+        /** Returns true if anything was allocated or freed since the scope was opened */
+        bool hasTouchedHeap() const;
+
+    private:
+#if MBI_TRACK_ALLOCATIONS
+        long long violationsOnEntry;
+#endif
+    };
+
+    /** Returns true if a RealtimeScope is active on the calling thread (always false without tracking) */
+    static bool isRealtimeThread();
+
+    /** Returns the number of allocations and deallocations seen inside real-time scopes */
+    static long long getNumViolations();
+
+    /** Returns true if tracking was compiled in */
+    static bool isEnabled() { return MBI_TRACK_ALLOCATIONS != 0; }
+};
+
+#endif
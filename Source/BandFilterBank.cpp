@@ -0,0 +1,329 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "BandFilterBankKernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+typedef std::complex<double> Complex;
+
+static const double pi = 3.1415926535897932384626433832795028841971;
+
+/** Band-pass transform of the analog prototype, as in DSPFilters' BandPassTransform */
+class BandPassTransform
+{
+public:
+
+    BandPassTransform(double lowCutRadians, double highCutRadians)
+    {
+        const double wc2 = std::max(lowCutRadians, 1e-8);
+        const double wc = std::min(highCutRadians, pi - 1e-8);
+
+        a = std::cos((wc + wc2) * 0.5) / std::cos((wc - wc2) * 0.5);
+        b = 1 / std::tan((wc - wc2) * 0.5);
+
+        normalFrequency = 2 * std::atan(std::sqrt(std::tan(wc * 0.5) * std::tan(wc2 * 0.5)));
+    }
+
+    /** Maps one analog pole onto the two digital poles it produces */
+    void transform(Complex c, Complex& first, Complex& second) const
+    {
+        const double a2 = a * a;
+        const double b2 = b * b;
+        const double ab_2 = 2 * a * b;
+
+        c = (1. + c) / (1. - c); // bilinear
+
+        Complex v = 4 * (b2 * (a2 - 1) + 1) * c;
+        v += 8 * (b2 * (a2 - 1) - 1);
+        v *= c;
+        v += 4 * (b2 * (a2 - 1) + 1);
+        v = std::sqrt(v);
+
+        const Complex u = -v + ab_2 * c + ab_2;
+        v = v + ab_2 * c + ab_2;
+
+        const Complex d = 2 * (b - 1) * c + 2 * (1 + b);
+
+        first = u / d;
+        second = v / d;
+    }
+
+    double normalFrequency;
+
+private:
+
+    double a;
+    double b;
+};
+
+static BiquadCoefficients makeSection(Complex pole1, Complex pole2, double zero1, double zero2)
+{
+    BiquadCoefficients section;
+
+    section.b0 = 1;
+    section.b1 = -(zero1 + zero2);
+    section.b2 = zero1 * zero2;
+    section.a1 = -(pole1 + pole2).real();
+    section.a2 = (pole1 * pole2).real();
+
+    return section;
+}
+
+static Complex sectionResponse(const BiquadCoefficients& s, double w)
+{
+    const Complex z1 = std::polar(1., -w);
+    const Complex z2 = std::polar(1., -2 * w);
+
+    return (s.b0 + s.b1 * z1 + s.b2 * z2) / (1. + s.a1 * z1 + s.a2 * z2);
+}
+
+std::vector<BiquadCoefficients> designButterworthBandPass(int order,
+                                                          double sampleRate,
+                                                          double lowCut,
+                                                          double highCut)
+{
+    std::vector<BiquadCoefficients> sections;
+
+    BandPassTransform transform(2 * pi * lowCut / sampleRate,
+                                2 * pi * highCut / sampleRate);
+
+    // poles of the analog low-pass prototype lie on the left half of the unit circle;
+    // each conjugate pair becomes two sections, with zeros at z = -1 and z = +1
+    for (int i = 0; i < order / 2; i++)
+    {
+        const Complex pole = std::polar(1., pi / 2 + (2 * i + 1) * pi / (2 * order));
+
+        Complex first, second;
+        transform.transform(pole, first, second);
+
+        sections.push_back(makeSection(first, std::conj(first), -1, -1));
+        sections.push_back(makeSection(second, std::conj(second), 1, 1));
+    }
+
+    // an odd order leaves one real pole, which becomes a single section
+    if (order & 1)
+    {
+        Complex first, second;
+        transform.transform(-1, first, second);
+
+        sections.push_back(makeSection(first, second, -1, 1));
+    }
+
+    // unity gain at the centre of the band, applied to the first section
+    Complex response = 1;
+
+    for (const BiquadCoefficients& section : sections)
+        response *= sectionResponse(section, transform.normalFrequency);
+
+    if (! sections.empty())
+    {
+        const double scale = 1 / std::abs(response);
+
+        sections[0].b0 *= scale;
+        sections[0].b1 *= scale;
+        sections[0].b2 *= scale;
+    }
+
+    return sections;
+}
+
+std::mutex BandPassDesignCache::cacheLock;
+std::map<BandPassDesignCache::Key, std::weak_ptr<const BandPassDesignCache::Sections>> BandPassDesignCache::cache;
+
+std::shared_ptr<const BandPassDesignCache::Sections> BandPassDesignCache::get(int order, double sampleRate,
+                                                                              double lowCut, double highCut)
+{
+    const std::lock_guard<std::mutex> lock(cacheLock);
+
+    std::weak_ptr<const Sections>& entry = cache[std::make_tuple(order, sampleRate, lowCut, highCut)];
+
+    if (std::shared_ptr<const Sections> cached = entry.lock())
+        return cached;
+
+    std::shared_ptr<const Sections> designed = std::make_shared<const Sections>(designButterworthBandPass(order, sampleRate,
+                                                                                                         lowCut, highCut));
+    entry = designed;
+
+    // drop entries whose designs are no longer used by any core
+    for (auto it = cache.begin(); it != cache.end();)
+    {
+        if (it->second.expired())
+            it = cache.erase(it);
+        else
+            ++it;
+    }
+
+    return designed;
+}
+
+int BandPassDesignCache::getNumDesigns()
+{
+    const std::lock_guard<std::mutex> lock(cacheLock);
+
+    return int(cache.size());
+}
+
+void processBandFilterBankScalar(const BandFilterBankData& bank, const float* const* input, float* const* output, int numSamples)
+{
+    processBandFilterBank<ScalarVector>(bank, input, output, numSamples);
+}
+
+#if MBI_SIMD_X86
+
+void processBandFilterBankSse2(const BandFilterBankData& bank, const float* const* input, float* const* output, int numSamples)
+{
+    processBandFilterBank<Sse2Vector>(bank, input, output, numSamples);
+}
+
+#endif
+
+BandFilterBank::BandFilterBank(SimdLevel level) :
+    simdLevel(level),
+    numChannels(0)
+{
+#if MBI_SIMD_X86
+    if (simdLevel == SimdLevel::AVX)
+        kernel = &processBandFilterBankAvx;
+    else if (simdLevel == SimdLevel::SSE2)
+        kernel = &processBandFilterBankSse2;
+    else
+        kernel = &processBandFilterBankScalar;
+#else
+    simdLevel = SimdLevel::SCALAR;
+    kernel = &processBandFilterBankScalar;
+#endif
+
+    laneWidth = getSimdLaneWidth(simdLevel);
+
+    workspace.resize(3 * tileSize * laneWidth);
+
+    rebuildTables(true);
+}
+
+void BandFilterBank::setNumChannels(int numChannels_)
+{
+    numChannels = std::max(numChannels_, 0);
+
+    rebuildTables(true);
+}
+
+void BandFilterBank::setNumBands(int numBands)
+{
+    bandSections.resize(std::max(numBands, 0));
+    gains.resize(bandSections.size(), 1.0);
+
+    rebuildTables(true);
+}
+
+void BandFilterBank::setBandSections(int band, const std::vector<BiquadCoefficients>& sections)
+{
+    const bool sameLayout = bandSections[band].size() == sections.size();
+
+    bandSections[band] = sections;
+
+    rebuildTables(! sameLayout);
+}
+
+void BandFilterBank::setBandGain(int band, double gain)
+{
+    gains[band] = gain;
+}
+
+void BandFilterBank::reset()
+{
+    std::fill(state.begin(), state.end(), 0.0);
+}
+
+bool BandFilterBank::takeStateFrom(BandFilterBank& other)
+{
+    if (other.simdLevel != simdLevel
+        || other.numChannels != numChannels
+        || other.bandNumSections != bandNumSections)
+        return false;
+
+    state.swap(other.state);
+
+    return true;
+}
+
+void BandFilterBank::rebuildTables(bool clearState)
+{
+    const int numBands = getNumBands();
+
+    bandFirstSection.resize(numBands);
+    bandNumSections.resize(numBands);
+    coefficients.clear();
+
+    int numSections = 0;
+
+    for (int band = 0; band < numBands; band++)
+    {
+        bandFirstSection[band] = numSections;
+        bandNumSections[band] = int(bandSections[band].size());
+
+        for (const BiquadCoefficients& section : bandSections[band])
+        {
+            const double values[5] = { section.b0, section.b1, section.b2, section.a1, section.a2 };
+
+            for (double value : values)
+                coefficients.insert(coefficients.end(), 4, value);
+        }
+
+        numSections += bandNumSections[band];
+    }
+
+    if (clearState)
+    {
+        const int numGroups = (numChannels + laneWidth - 1) / laneWidth;
+
+        state.assign(size_t(numGroups) * numSections * 2 * laneWidth, 0.0);
+    }
+}
+
+BandFilterBankData BandFilterBank::getData()
+{
+    BandFilterBankData data;
+
+    data.numChannels = numChannels;
+    data.numBands = getNumBands();
+    data.numSections = int(coefficients.size() / 20);
+    data.bandFirstSection = bandFirstSection.data();
+    data.bandNumSections = bandNumSections.data();
+    data.gains = gains.data();
+    data.coefficients = coefficients.data();
+    data.state = state.data();
+    data.workspace = workspace.data();
+
+    return data;
+}
+
+void BandFilterBank::process(const float* const* input, float* const* output, int numSamples)
+{
+    if (numChannels == 0 || numSamples <= 0)
+        return;
+
+    kernel(getData(), input, output, numSamples);
+}
@@ -0,0 +1,181 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BAND_FILTER_BANK_H_INCLUDED
+#define BAND_FILTER_BANK_H_INCLUDED
+
+#include "SimdSupport.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+/** Coefficients of one biquad section, normalized so that a0 = 1 */
+struct BiquadCoefficients
+{
+    double b0, b1, b2;
+    double a1, a2;
+};
+
+/**
+    Designs a Butterworth band-pass filter as a cascade of biquad sections.
+
+    The design follows Dsp::Butterworth::Design::BandPass from the DSPFilters
+    library used by the GUI (analog prototype, band-pass transform, unity gain
+    at the geometric centre frequency), so an order-N design yields the same
+    N sections as the filters this bank replaces.
+ */
+std::vector<BiquadCoefficients> designButterworthBandPass(int order,
+                                                          double sampleRate,
+                                                          double lowCut,
+                                                          double highCut);
+
+/**
+    Butterworth band-pass designs shared by all streams and plugin instances.
+
+    Designs are keyed by their order, sample rate and band edges, so streams at
+    the same rate share one design of each band, and a band whose edges are not
+    changed is looked up rather than redesigned when the settings are rebuilt.
+    The cache only holds designs that are in use: each entry is dropped once no
+    caller holds it any more. Every function locks, so none of them may be
+    called on the processing thread.
+ */
+class BandPassDesignCache
+{
+public:
+
+    typedef std::vector<BiquadCoefficients> Sections;
+
+    /** Returns the design of one band, designing it if it is not in use yet */
+    static std::shared_ptr<const Sections> get(int order, double sampleRate, double lowCut, double highCut);
+
+    /** Returns the number of cached designs: those in use, and those released since the
+        last one was designed */
+    static int getNumDesigns();
+
+private:
+
+    typedef std::tuple<int, double, double, double> Key;
+
+    static std::mutex cacheLock;
+    static std::map<Key, std::weak_ptr<const Sections>> cache;
+};
+
+/** Read-only view of a bank's tables, passed to the per-instruction-set kernels */
+struct BandFilterBankData
+{
+    int numChannels;
+    int numBands;
+    int numSections;
+
+    const int* bandFirstSection;    // index of each band's first section
+    const int* bandNumSections;     // number of sections in each band
+    const double* gains;            // gain of each band
+    const double* coefficients;     // b0 b1 b2 a1 a2 of each section, each broadcast to 4 lanes
+
+    double* state;                  // z1 and z2 of each section, for each group of lanes
+    double* workspace;              // three tiles of laneWidth * tileSize doubles
+};
+
+/**
+    Filters many channels through a set of band-pass filters and returns the
+    gain-weighted sum of the bands for each channel.
+
+    Channels are packed into the lanes of SSE2 or AVX registers, and every band
+    of a group of channels is evaluated from the same input tile, using
+    transposed direct form II sections in double precision. The instruction set
+    is chosen at run time, falling back to scalar code on older machines.
+ */
+class BandFilterBank
+{
+public:
+
+    /** Constructor */
+    BandFilterBank(SimdLevel level = getSupportedSimdLevel());
+
+    /** Destructor */
+    ~BandFilterBank() { }
+
+    /** Sets the number of channels, clearing the filter state */
+    void setNumChannels(int numChannels);
+
+    /** Sets the number of bands, clearing the filter state */
+    void setNumBands(int numBands);
+
+    /** Sets the sections of one band; the filter state is kept if the number of sections is unchanged */
+    void setBandSections(int band, const std::vector<BiquadCoefficients>& sections);
+
+    /** Sets the gain applied to one band before summing */
+    void setBandGain(int band, double gain);
+
+    /** Clears the filter state */
+    void reset();
+
+    /** Exchanges filter state with another bank if both have the same channels, sections and instruction set.
+        Never allocates, so it can be called on the processing thread. Returns true if the state was taken. */
+    bool takeStateFrom(BandFilterBank& other);
+
+    /** Writes the weighted band sum of each input channel to the matching output channel.
+        Input and output may point to the same memory. */
+    void process(const float* const* input, float* const* output, int numSamples);
+
+    /** Returns the number of channels */
+    int getNumChannels() const { return numChannels; }
+
+    /** Returns the number of bands */
+    int getNumBands() const { return int(bandSections.size()); }
+
+    /** Returns the instruction set in use */
+    SimdLevel getSimdLevel() const { return simdLevel; }
+
+    /** Number of samples processed per tile */
+    static const int tileSize = 64;
+
+private:
+
+    /** Rebuilds the flattened coefficient tables and, if needed, the filter state */
+    void rebuildTables(bool clearState);
+
+    BandFilterBankData getData();
+
+    typedef void (*Kernel)(const BandFilterBankData&, const float* const*, float* const*, int);
+
+    SimdLevel simdLevel;
+    int laneWidth;
+    Kernel kernel;
+
+    int numChannels;
+
+    std::vector<std::vector<BiquadCoefficients>> bandSections;
+    std::vector<double> gains;
+
+    std::vector<int> bandFirstSection;
+    std::vector<int> bandNumSections;
+    std::vector<double> coefficients;
+    std::vector<double> state;
+    std::vector<double> workspace;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BAND_FILTER_BANK_KERNEL_H_INCLUDED
+#define BAND_FILTER_BANK_KERNEL_H_INCLUDED
+
+#include "BandFilterBank.h"
+#include "SimdVector.h"
+
+/** Kernel entry points, one per instruction set */
+void processBandFilterBankScalar(const BandFilterBankData& bank, const float* const* input, float* const* output, int numSamples);
+void processBandFilterBankSse2(const BandFilterBankData& bank, const float* const* input, float* const* output, int numSamples);
+void processBandFilterBankAvx(const BandFilterBankData& bank, const float* const* input, float* const* output, int numSamples);
+
+namespace
+{
+
+/** Runs one transposed direct form II section over a tile; input and output may be the same tile */
+template <class Vector>
+inline void processSection(const double* coefficients, double* state, const double* input, double* output, int numFrames)
+{
+    const int W = Vector::width;
+
+    const Vector b0 = Vector::load(coefficients);
+    const Vector b1 = Vector::load(coefficients + 4);
+    const Vector b2 = Vector::load(coefficients + 8);
+    const Vector a1 = Vector::load(coefficients + 12);
+    const Vector a2 = Vector::load(coefficients + 16);
+
+    Vector z1 = Vector::load(state);
+    Vector z2 = Vector::load(state + W);
+
+    for (int t = 0; t < numFrames; t++)
+    {
+        const Vector x = Vector::load(input + t * W);
+        const Vector y = b0 * x + z1;
+
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+
+        y.store(output + t * W);
+    }
+
+    z1.store(state);
+    z2.store(state + W);
+}
+
+/** Filters every group of channels, one tile at a time */
+template <class Vector>
+void processBandFilterBank(const BandFilterBankData& bank, const float* const* input, float* const* output, int numSamples)
+{
+    const int W = Vector::width;
+    const int T = BandFilterBank::tileSize;
+
+    double* frames = bank.workspace;        // input, one frame of W lanes per sample
+    double* bandTile = frames + T * W;      // output of the band being evaluated
+    double* sumTile = bandTile + T * W;     // weighted sum of the bands
+
+    const int numGroups = (bank.numChannels + W - 1) / W;
+
+    for (int group = 0; group < numGroups; group++)
+    {
+        const int firstChannel = group * W;
+        const int numLanes = bank.numChannels - firstChannel < W ? bank.numChannels - firstChannel : W;
+
+        double* groupState = bank.state + group * bank.numSections * 2 * W;
+
+        for (int start = 0; start < numSamples; start += T)
+        {
+            const int numFrames = numSamples - start < T ? numSamples - start : T;
+
+            // interleave the channels of this group into lanes; unused lanes see silence
+            for (int lane = 0; lane < W; lane++)
+            {
+                if (lane < numLanes)
+                {
+                    const float* source = input[firstChannel + lane] + start;
+
+                    for (int t = 0; t < numFrames; t++)
+                        frames[t * W + lane] = source[t];
+                }
+                else
+                {
+                    for (int t = 0; t < numFrames; t++)
+                        frames[t * W + lane] = 0.0;
+                }
+            }
+
+            for (int t = 0; t < numFrames; t++)
+                Vector::zero().store(sumTile + t * W);
+
+            for (int band = 0; band < bank.numBands; band++)
+            {
+                const int first = bank.bandFirstSection[band];
+                const int last = first + bank.bandNumSections[band];
+
+                // the first section reads the shared input tile, so no band needs its own copy of it
+                const double* bandOutput = frames;
+
+                for (int section = first; section < last; section++)
+                {
+                    processSection<Vector>(bank.coefficients + section * 20,
+                                           groupState + section * 2 * W,
+                                           bandOutput,
+                                           bandTile,
+                                           numFrames);
+
+                    bandOutput = bandTile;
+                }
+
+                const Vector gain = Vector::broadcast(bank.gains[band]);
+
+                for (int t = 0; t < numFrames; t++)
+                {
+                    const Vector sum = Vector::load(sumTile + t * W) + gain * Vector::load(bandOutput + t * W);
+                    sum.store(sumTile + t * W);
+                }
+            }
+
+            for (int lane = 0; lane < numLanes; lane++)
+            {
+                float* destination = output[firstChannel + lane] + start;
+
+                for (int t = 0; t < numFrames; t++)
+                    destination[t] = float(sumTile[t * W + lane]);
+            }
+        }
+    }
+}
+
+}
+
+#endif
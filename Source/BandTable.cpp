@@ -0,0 +1,138 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "BandTable.h"
+
+#include <cmath>
+#include <locale>
+#include <sstream>
+
+/** Reads one number that makes up all of text but surrounding white space, with a '.' as the
+    decimal point whatever the user's locale */
+static bool parseNumber(const std::string& text, double& value)
+{
+    std::istringstream stream(text);
+    stream.imbue(std::locale::classic());
+
+    if (! (stream >> value))
+        return false;
+
+    if (! stream.eof())
+        stream >> std::ws;
+
+    return stream.eof();
+}
+
+static bool parseBandEntry(const std::string& entry, BandSpec& band)
+{
+    double values[4] = { 0.0, 0.0, 0.0, 2.0 };
+    int numValues = 0;
+
+    for (size_t start = 0; start <= entry.size(); )
+    {
+        size_t end = entry.find(':', start);
+
+        if (end == std::string::npos)
+            end = entry.size();
+
+        if (numValues == 4 || ! parseNumber(entry.substr(start, end - start), values[numValues]))
+            return false;
+
+        numValues++;
+        start = end + 1;
+    }
+
+    // the order is checked before it is converted, as out-of-range values have no int
+    if (numValues < 3
+        || ! (values[3] >= 1 && values[3] <= maxBandOrder)
+        || values[3] != std::floor(values[3]))
+        return false;
+
+    band.lowCut = values[0];
+    band.highCut = values[1];
+    band.gain = values[2];
+    band.order = int(values[3]);
+
+    return band.lowCut > 0
+        && band.highCut > band.lowCut
+        && std::isfinite(band.highCut)
+        && std::isfinite(band.gain);
+}
+
+bool parseBandTable(const std::string& text, std::vector<BandSpec>& bands)
+{
+    std::vector<BandSpec> parsed;
+    std::string entry;
+
+    for (size_t i = 0; i <= text.size(); i++)
+    {
+        if (i < text.size() && text[i] != ',' && text[i] != ';')
+        {
+            entry += text[i];
+            continue;
+        }
+
+        // empty entries (e.g. a trailing comma) are skipped
+        if (entry.find_first_not_of(" \t\r\n") != std::string::npos)
+        {
+            BandSpec band;
+
+            if (! parseBandEntry(entry, band))
+                return false;
+
+            parsed.push_back(band);
+        }
+
+        entry.clear();
+    }
+
+    if (parsed.empty() || int(parsed.size()) > maxBands)
+        return false;
+
+    bands = parsed;
+
+    return true;
+}
+
+std::string formatBandTable(const std::vector<BandSpec>& bands)
+{
+    // the classic locale writes a '.', where others would write the ',' that separates entries
+    std::ostringstream text;
+    text.imbue(std::locale::classic());
+
+    for (size_t i = 0; i < bands.size(); i++)
+    {
+        const BandSpec& band = bands[i];
+
+        if (i > 0)
+            text << ", ";
+
+        text << band.lowCut << ':' << band.highCut << ':' << band.gain;
+
+        if (band.order != 2)
+            text << ':' << band.order;
+    }
+
+    return text.str();
+}
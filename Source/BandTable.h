@@ -0,0 +1,61 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef BAND_TABLE_H_INCLUDED
+#define BAND_TABLE_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+/** One row of the band table */
+struct BandSpec
+{
+    double lowCut;      // Hz
+    double highCut;     // Hz
+    double gain;        // weight of the band in the sum
+    int order;          // Butterworth order of the band-pass filter
+};
+
+/**
+    Parses a band table written as comma- or semicolon-separated entries of the
+    form low:high:gain[:order], e.g. "6:9:4, 13:18:7, 1:4:-1". The order defaults
+    to 2. Returns false, leaving bands unchanged, if any entry is malformed, has
+    low >= high or an order outside 1..maxBandOrder, or if there are no entries
+    or more than maxBands.
+ */
+bool parseBandTable(const std::string& text, std::vector<BandSpec>& bands);
+
+/** Writes a band table in the form read by parseBandTable(), leaving out orders of 2 */
+std::string formatBandTable(const std::vector<BandSpec>& bands);
+
+/** Largest number of bands in a table */
+const int maxBands = 16;
+
+/** Highest filter order of a band */
+const int maxBandOrder = 8;
+
+/** The alpha, beta and delta bands the integrator was designed with */
+const char* const defaultBandTable = "6:9:4, 13:18:7, 1:4:-1";
+
+#endif
@@ -0,0 +1,160 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "DecimatorKernel.h"
+
+#include <algorithm>
+
+void processDecimatorScalar(const DecimatorData& decimator, const float* const* input, float* const* output, int numSamples)
+{
+    processDecimator<ScalarVector>(decimator, input, output, numSamples);
+}
+
+#if MBI_SIMD_X86
+
+void processDecimatorSse2(const DecimatorData& decimator, const float* const* input, float* const* output, int numSamples)
+{
+    processDecimator<Sse2Vector>(decimator, input, output, numSamples);
+}
+
+#endif
+
+Decimator::Decimator(SimdLevel level) :
+    simdLevel(level),
+    factor(1),
+    numChannels(0),
+    phase(0)
+{
+#if MBI_SIMD_X86
+    if (simdLevel == SimdLevel::AVX)
+        kernel = &processDecimatorAvx;
+    else if (simdLevel == SimdLevel::SSE2)
+        kernel = &processDecimatorSse2;
+    else
+        kernel = &processDecimatorScalar;
+#else
+    simdLevel = SimdLevel::SCALAR;
+    kernel = &processDecimatorScalar;
+#endif
+
+    laneWidth = getSimdLaneWidth(simdLevel);
+
+    workspace.resize(tileSize * laneWidth);
+
+    setFactor(1);
+}
+
+void Decimator::setFactor(int factor_)
+{
+    factor = std::max(factor_, 1);
+
+    // cubic B-spline: a boxcar of factor samples convolved with itself four times
+    std::vector<double> spline(1, 1.0);
+
+    for (int stage = 0; stage < tapsPerPhase; stage++)
+    {
+        std::vector<double> next(spline.size() + factor - 1, 0.0);
+
+        for (size_t i = 0; i < spline.size(); i++)
+        {
+            for (int j = 0; j < factor; j++)
+                next[i + j] += spline[i] / factor;
+        }
+
+        spline.swap(next);
+    }
+
+    // tapsPerPhase * factor taps; the newest sample of an output takes tap 0
+    spline.resize(size_t(tapsPerPhase) * factor, 0.0);
+
+    // a sample at phase p of an output period contributes tap (j + 1) * factor - 1 - p
+    // to the j-th output from now
+    taps.clear();
+
+    for (int p = 0; p < factor; p++)
+    {
+        for (int j = 0; j < tapsPerPhase; j++)
+            taps.insert(taps.end(), 4, spline[(j + 1) * factor - 1 - p]);
+    }
+
+    setNumChannels(numChannels);
+}
+
+void Decimator::setNumChannels(int numChannels_)
+{
+    numChannels = std::max(numChannels_, 0);
+
+    const int numGroups = (numChannels + laneWidth - 1) / laneWidth;
+
+    accumulators.assign(size_t(numGroups) * tapsPerPhase * laneWidth, 0.0);
+
+    reset();
+}
+
+void Decimator::reset()
+{
+    std::fill(accumulators.begin(), accumulators.end(), 0.0);
+
+    phase = 0;
+}
+
+bool Decimator::takeStateFrom(Decimator& other)
+{
+    if (other.simdLevel != simdLevel
+        || other.factor != factor
+        || other.numChannels != numChannels)
+        return false;
+
+    accumulators.swap(other.accumulators);
+    phase = other.phase;
+
+    return true;
+}
+
+int Decimator::process(const float* const* input, float* const* output, int numSamples)
+{
+    if (numSamples <= 0)
+        return 0;
+
+    if (numChannels > 0)
+    {
+        DecimatorData data;
+
+        data.numChannels = numChannels;
+        data.factor = factor;
+        data.phase = phase;
+        data.taps = taps.data();
+        data.accumulators = accumulators.data();
+        data.workspace = workspace.data();
+
+        kernel(data, input, output, numSamples);
+    }
+
+    // every group of lanes advanced by the same number of samples
+    const int numOutputs = (phase + numSamples) / factor;
+
+    phase = (phase + numSamples) % factor;
+
+    return numOutputs;
+}
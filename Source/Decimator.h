@@ -0,0 +1,119 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef DECIMATOR_H_INCLUDED
+#define DECIMATOR_H_INCLUDED
+
+#include "SimdSupport.h"
+
+#include <vector>
+
+/** Read-only view of a decimator's tables, passed to the per-instruction-set kernels */
+struct DecimatorData
+{
+    int numChannels;
+    int factor;
+    int phase;                  // input samples since the last output sample
+
+    const double* taps;         // tapsPerPhase taps for each phase, each broadcast to 4 lanes
+    double* accumulators;       // partial sums of the next tapsPerPhase outputs, for each group of lanes
+    double* workspace;          // one tile of laneWidth * tileSize doubles
+};
+
+/**
+    Anti-aliased integer-factor downsampling of many channels.
+
+    The low-pass filter is a cubic B-spline, i.e. four cascaded boxcars of one
+    output period each. Its response has a null at every multiple of the output
+    rate, where aliases would fold onto the low-frequency bands, and attenuates
+    everything within an eighth of the output rate of those nulls by more than
+    65 dB, while the droop below a sixteenth of the output rate stays under
+    0.25 dB. The filter runs in transposed polyphase form: each input sample is
+    added into the partial sums of the tapsPerPhase outputs it contributes to,
+    so the cost is four multiply-adds per input sample whatever the factor, and
+    no input history is kept. As in BandFilterBank, channels are packed into the
+    lanes of SSE2 or AVX registers and all of them advance in step, so every call
+    produces the same number of output samples on every channel.
+ */
+class Decimator
+{
+public:
+
+    /** Constructor */
+    Decimator(SimdLevel level = getSupportedSimdLevel());
+
+    /** Destructor */
+    ~Decimator() { }
+
+    /** Sets the downsampling factor and designs the filter, clearing all state */
+    void setFactor(int factor);
+
+    /** Returns the downsampling factor */
+    int getFactor() const { return factor; }
+
+    /** Sets the number of channels, clearing all state */
+    void setNumChannels(int numChannels);
+
+    /** Clears the partial sums */
+    void reset();
+
+    /** Exchanges state with another decimator with the same factor, channels and instruction set.
+        Never allocates. Returns true if the state was taken. */
+    bool takeStateFrom(Decimator& other);
+
+    /** Returns the number of input samples to consume until the next output sample (1 to factor) */
+    int getSamplesUntilOutput() const { return factor - phase; }
+
+    /** Downsamples numSamples of each input channel into the matching output channel,
+        and returns the number of samples written to each output */
+    int process(const float* const* input, float* const* output, int numSamples);
+
+    /** Returns the delay of the filter, in input samples */
+    int getLatency() const { return factor == 1 ? 0 : 2 * (factor - 1); }
+
+    /** Number of output periods spanned by the filter, and so taps per input sample */
+    static const int tapsPerPhase = 4;
+
+    /** Number of samples interleaved at a time */
+    static const int tileSize = 64;
+
+private:
+
+    typedef void (*Kernel)(const DecimatorData&, const float* const*, float* const*, int);
+
+    SimdLevel simdLevel;
+    int laneWidth;
+    Kernel kernel;
+
+    int factor;
+    int numChannels;
+
+    int phase;
+
+    std::vector<double> taps;
+    std::vector<double> accumulators;
+    std::vector<double> workspace;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef DECIMATOR_KERNEL_H_INCLUDED
+#define DECIMATOR_KERNEL_H_INCLUDED
+
+#include "Decimator.h"
+#include "SimdVector.h"
+
+/** Kernel entry points, one per instruction set */
+void processDecimatorScalar(const DecimatorData& decimator, const float* const* input, float* const* output, int numSamples);
+void processDecimatorSse2(const DecimatorData& decimator, const float* const* input, float* const* output, int numSamples);
+void processDecimatorAvx(const DecimatorData& decimator, const float* const* input, float* const* output, int numSamples);
+
+namespace
+{
+
+/** Adds every input sample into the partial sums of each group of channels, releasing one output per factor samples */
+template <class Vector>
+void processDecimator(const DecimatorData& decimator, const float* const* input, float* const* output, int numSamples)
+{
+    const int W = Vector::width;
+    const int P = Decimator::tapsPerPhase;
+    const int T = Decimator::tileSize;
+
+    static_assert(Decimator::tapsPerPhase == 4, "the kernel keeps one register of partial sums per tap of a phase");
+
+    double* frames = decimator.workspace;   // input, one frame of W lanes per sample
+
+    const int numGroups = (decimator.numChannels + W - 1) / W;
+
+    for (int group = 0; group < numGroups; group++)
+    {
+        const int firstChannel = group * W;
+        const int numLanes = decimator.numChannels - firstChannel < W ? decimator.numChannels - firstChannel : W;
+
+        double* groupAccumulators = decimator.accumulators + group * P * W;
+
+        Vector sum0 = Vector::load(groupAccumulators);
+        Vector sum1 = Vector::load(groupAccumulators + W);
+        Vector sum2 = Vector::load(groupAccumulators + 2 * W);
+        Vector sum3 = Vector::load(groupAccumulators + 3 * W);
+
+        int phase = decimator.phase;
+        int numOutputs = 0;
+
+        for (int start = 0; start < numSamples; start += T)
+        {
+            const int numFrames = numSamples - start < T ? numSamples - start : T;
+
+            // interleave the channels of this group into lanes; unused lanes see silence
+            for (int lane = 0; lane < W; lane++)
+            {
+                if (lane < numLanes)
+                {
+                    const float* source = input[firstChannel + lane] + start;
+
+                    for (int t = 0; t < numFrames; t++)
+                        frames[t * W + lane] = source[t];
+                }
+                else
+                {
+                    for (int t = 0; t < numFrames; t++)
+                        frames[t * W + lane] = 0.0;
+                }
+            }
+
+            for (int t = 0; t < numFrames; t++)
+            {
+                const Vector x = Vector::load(frames + t * W);
+                const double* taps = decimator.taps + phase * P * 4;
+
+                sum0 = sum0 + Vector::load(taps) * x;
+                sum1 = sum1 + Vector::load(taps + 4) * x;
+                sum2 = sum2 + Vector::load(taps + 8) * x;
+                sum3 = sum3 + Vector::load(taps + 12) * x;
+
+                if (++phase < decimator.factor)
+                    continue;
+
+                phase = 0;
+
+                // the oldest partial sum is complete; the others move up one output
+                double lanes[4];
+                sum0.store(lanes);
+
+                for (int lane = 0; lane < numLanes; lane++)
+                    output[firstChannel + lane][numOutputs] = float(lanes[lane]);
+
+                numOutputs++;
+
+                sum0 = sum1;
+                sum1 = sum2;
+                sum2 = sum3;
+                sum3 = Vector::zero();
+            }
+        }
+
+        sum0.store(groupAccumulators);
+        sum1.store(groupAccumulators + W);
+        sum2.store(groupAccumulators + 2 * W);
+        sum3.store(groupAccumulators + 3 * W);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+/*
+Compiled with AVX enabled (see CMakeLists.txt); only called after
+getSupportedSimdLevel() has confirmed that the CPU supports it.
+*/
+
+#include "DecimatorKernel.h"
+
+#if MBI_SIMD_X86
+
+void processDecimatorAvx(const DecimatorData& decimator, const float* const* input, float* const* output, int numSamples)
+{
+#if defined(__AVX__)
+    processDecimator<AvxVector>(decimator, input, output, numSamples);
+#else
+    // built without AVX support; the SSE2 kernel produces identical results
+    processDecimatorSse2(decimator, input, output, numSamples);
+#endif
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "Fft.h"
+
+#include <cmath>
+#include <utility>
+
+Fft::Fft(int size_)
+{
+    setSize(size_);
+}
+
+int Fft::getNextPowerOfTwo(int n)
+{
+    int powerOfTwo = 1;
+
+    while (powerOfTwo < n)
+        powerOfTwo <<= 1;
+
+    return powerOfTwo;
+}
+
+void Fft::setSize(int size_)
+{
+    size = getNextPowerOfTwo(size_ < 1 ? 1 : size_);
+
+    const double pi = 3.1415926535897932384626433832795;
+
+    twiddles.resize(size / 2);
+
+    for (int k = 0; k < size / 2; k++)
+        twiddles[k] = std::polar(1.0, -2.0 * pi * k / size);
+
+    int numBits = 0;
+
+    while ((1 << numBits) < size)
+        numBits++;
+
+    bitReversed.resize(size);
+
+    for (int i = 0; i < size; i++)
+    {
+        int reversed = 0;
+
+        for (int bit = 0; bit < numBits; bit++)
+            reversed |= ((i >> bit) & 1) << (numBits - 1 - bit);
+
+        bitReversed[i] = reversed;
+    }
+}
+
+void Fft::forward(Complex* data) const
+{
+    transform(data, false);
+}
+
+void Fft::inverse(Complex* data) const
+{
+    transform(data, true);
+
+    const double scale = 1.0 / size;
+
+    for (int i = 0; i < size; i++)
+        data[i] *= scale;
+}
+
+void Fft::transform(Complex* data, bool inverse) const
+{
+    for (int i = 0; i < size; i++)
+    {
+        if (i < bitReversed[i])
+            std::swap(data[i], data[bitReversed[i]]);
+    }
+
+    // the products are written out so that the compiler does not call the
+    // library's NaN-aware complex multiply in the inner loop
+    const double sign = inverse ? -1.0 : 1.0;
+
+    for (int length = 2; length <= size; length <<= 1)
+    {
+        const int half = length / 2;
+        const int step = size / length;
+
+        for (int start = 0; start < size; start += length)
+        {
+            for (int j = 0; j < half; j++)
+            {
+                const double wr = twiddles[j * step].real();
+                const double wi = twiddles[j * step].imag() * sign;
+
+                const Complex u = data[start + j];
+                const Complex x = data[start + j + half];
+
+                const Complex v(x.real() * wr - x.imag() * wi,
+                                x.real() * wi + x.imag() * wr);
+
+                data[start + j] = Complex(u.real() + v.real(), u.imag() + v.imag());
+                data[start + j + half] = Complex(u.real() - v.real(), u.imag() - v.imag());
+            }
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef FFT_H_INCLUDED
+#define FFT_H_INCLUDED
+
+#include <complex>
+#include <vector>
+
+/**
+    In-place radix-2 complex FFT of a fixed power-of-two size.
+
+    The twiddle factors and bit-reversal table are built by setSize(), so
+    forward() and inverse() never allocate.
+ */
+class Fft
+{
+public:
+
+    typedef std::complex<double> Complex;
+
+    /** Constructor */
+    Fft(int size = 1);
+
+    /** Sets the transform size, which must be a power of two */
+    void setSize(int size);
+
+    /** Returns the transform size */
+    int getSize() const { return size; }
+
+    /** Replaces data with its discrete Fourier transform */
+    void forward(Complex* data) const;
+
+    /** Replaces data with its inverse transform, including the 1/N scaling */
+    void inverse(Complex* data) const;
+
+    /** Returns the smallest power of two that is at least n */
+    static int getNextPowerOfTwo(int n);
+
+private:
+
+    void transform(Complex* data, bool inverse) const;
+
+    int size;
+
+    std::vector<Complex> twiddles;
+    std::vector<int> bitReversed;
+};
+
+#endif
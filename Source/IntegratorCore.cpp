@@ -0,0 +1,636 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "IntegratorCore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+constexpr float IntegratorCore::outputGain;
+constexpr double IntegratorCore::minDecimatedRate;
+constexpr double IntegratorCore::bandRateRatio;
+constexpr int IntegratorCore::maxDecimation;
+constexpr double IntegratorCore::fftFixedCost;
+constexpr double IntegratorCore::fftPartitionCost;
+constexpr double IntegratorCore::maxFftTruncationError;
+
+std::mutex IntegratorCore::kernelCacheLock;
+std::map<std::vector<double>, std::weak_ptr<const IntegratorCore::FftKernel>> IntegratorCore::kernelCache;
+
+/** Writes |sum[i] - sum[i - 1]| for one row of sums, where sum[-1] is previousSum; returns the last sum.
+    The row is walked from its end, so derivative may be sum. */
+static float differentiate(const float* sum, float* derivative, int numSamples, float previousSum)
+{
+    if (numSamples <= 0)
+        return previousSum;
+
+    const float lastSum = sum[numSamples - 1];
+
+    for (int i = numSamples - 1; i > 0; i--)
+        derivative[i] = std::fabs(sum[i] - sum[i - 1]);
+
+    derivative[0] = std::fabs(sum[0] - previousSum);
+
+    return lastSum;
+}
+
+/** Ramps linearly between reduced-rate values over numSamples input samples, the first new value
+    arriving at input sample firstOutput. previousValue and nextValue are the two most recent values
+    and phase counts the input samples since the newer one; returns the phase at the end. */
+static int interpolate(const float* values, float* output, int numSamples, int firstOutput, int decimation,
+                       float& previousValue, float& nextValue, int phase)
+{
+    const float interpolationStep = 1.0f / float(decimation);
+
+    int nextOutput = firstOutput;
+    int m = 0;
+
+    for (int i = 0; i < numSamples; )
+    {
+        if (i == nextOutput)
+        {
+            previousValue = nextValue;
+            nextValue = values[m++];
+
+            phase = 0;
+            nextOutput += decimation;
+        }
+
+        // ramp towards the newest value until the next one arrives
+        const int end = std::min(nextOutput, numSamples);
+        const float slope = (nextValue - previousValue) * interpolationStep;
+
+        for (; i < end; i++)
+            output[i] = previousValue + slope * float(phase++);
+    }
+
+    return phase;
+}
+
+IntegratorCore::IntegratorCore(SimdLevel level) :
+    engine(FilterEngine::IIR),
+    filterBank(level),
+    decimator(level),
+    tileDerivatives(BandFilterBank::tileSize),
+    interpolationPhase(0),
+    channelCapacity(0),
+    windowSamples(1),
+    windowProfile(WindowProfile::QUADRATIC),
+    windowStorage(WindowStorage::DOUBLE),
+    decimation(1),
+    windowsDeferred(false)
+{
+
+}
+
+void IntegratorCore::prepare(int maxChannels)
+{
+    channelCapacity = std::max(maxChannels, channelCapacity);
+
+    // the reduced-rate workspace is tiled, so its size does not depend on the block size
+    tileSums.resize(size_t(channelCapacity) * BandFilterBank::tileSize);
+
+    tileInputs.reserve(channelCapacity);
+    sumPointers.reserve(channelCapacity);
+    previousSums.reserve(channelCapacity);
+    previousEnvelopes.reserve(channelCapacity);
+    nextEnvelopes.reserve(channelCapacity);
+    previousOutputSums.reserve(channelCapacity);
+    nextOutputSums.reserve(channelCapacity);
+    rollingAverages.reserve(channelCapacity);
+    detector.prepare(channelCapacity);
+}
+
+void IntegratorCore::setNumChannels(int numChannels)
+{
+    numChannels = std::max(numChannels, 0);
+
+    if (numChannels > channelCapacity)
+        prepare(numChannels);
+
+    filterBank.setNumChannels(numChannels);
+    overlapSave.setNumChannels(numChannels);
+    decimator.setNumChannels(numChannels);
+
+    tileInputs.resize(numChannels);
+    sumPointers.resize(numChannels);
+    previousSums.assign(numChannels, 0.0f);
+    previousEnvelopes.assign(numChannels, 0.0f);
+    nextEnvelopes.assign(numChannels, 0.0f);
+    previousOutputSums.assign(numChannels, 0.0f);
+    nextOutputSums.assign(numChannels, 0.0f);
+    interpolationPhase = 0;
+
+    for (int ch = 0; ch < numChannels; ch++)
+        sumPointers[ch] = tileSums.data() + ch * BandFilterBank::tileSize;
+
+    rollingAverages.resize(numChannels);
+    detector.setNumChannels(numChannels);
+
+    resetRollingAverages();
+}
+
+void IntegratorCore::setNumBands(int numBands)
+{
+    filterBank.setNumBands(numBands);
+
+    bandDesigns.resize(std::max(numBands, 0), BandDesign { 0.0, 0.0, 0.0, 0 });
+    bandSections.resize(bandDesigns.size());
+    bandGains.resize(bandSections.size(), 1.0);
+
+    if (engine == FilterEngine::FFT)
+        updateKernel();
+}
+
+void IntegratorCore::setBand(int band, double sampleRate, double lowCut, double highCut, int order)
+{
+    bandDesigns[band] = { sampleRate, lowCut, highCut, order };
+
+    designBand(band);
+
+    if (engine == FilterEngine::FFT)
+        updateKernel();
+}
+
+void IntegratorCore::designBand(int band)
+{
+    const BandDesign& design = bandDesigns[band];
+
+    if (design.order == 0)
+        return;
+
+    // streams at the same rate, and bands set back to earlier edges, share one design
+    bandSections[band] = BandPassDesignCache::get(design.order,
+                                                  design.sampleRate / decimation,
+                                                  design.lowCut,
+                                                  design.highCut);
+
+    filterBank.setBandSections(band, *bandSections[band]);
+}
+
+void IntegratorCore::setDecimation(int factor)
+{
+    decimation = std::min(std::max(factor, 1), maxDecimation);
+
+    decimator.setFactor(decimation);
+
+    for (int band = 0; band < getNumBands(); band++)
+        designBand(band);
+
+    if (engine == FilterEngine::FFT)
+        updateKernel();
+
+    setNumChannels(getNumChannels());
+}
+
+int IntegratorCore::chooseDecimation(double sampleRate, double highestFrequency)
+{
+    const double lowestRate = std::max(minDecimatedRate, bandRateRatio * highestFrequency);
+
+    return std::min(std::max(int(sampleRate / lowestRate), 1), maxDecimation);
+}
+
+std::vector<int> IntegratorCore::splitChannels(int numChannels, int maxGroups)
+{
+    // the widest lane group; it also keeps the FFT engine's channel pairs together
+    const int laneWidth = getSimdLaneWidth(SimdLevel::AVX);
+    const int numLaneGroups = (std::max(numChannels, 0) + laneWidth - 1) / laneWidth;
+    const int numGroups = std::max(std::min(maxGroups, numLaneGroups), 1);
+
+    std::vector<int> firstChannels(1, 0);
+
+    for (int g = 1; g <= numGroups; g++)
+    {
+        const int last = std::min((numLaneGroups * g) / numGroups * laneWidth, numChannels);
+
+        if (last > firstChannels.back())
+            firstChannels.push_back(last);
+    }
+
+    if (firstChannels.size() == 1)
+        firstChannels.push_back(std::max(numChannels, 0));
+
+    return firstChannels;
+}
+
+int IntegratorCore::getLatency() const
+{
+    const int engineLatency = engine == FilterEngine::FFT ? overlapSave.getLatency() * decimation : 0;
+
+    // the fit is evaluated lookahead samples before the newest one (no further than the window allows)
+    const int windowLatency = windowProfile == WindowProfile::SAVITZKY_GOLAY
+                            ? std::min(getDecimatedShape().lookahead, getDecimatedWindowSamples() - 1) * decimation
+                            : 0;
+
+    if (decimation == 1)
+        return engineLatency + windowLatency;
+
+    // the interpolated envelope reaches each new value one reduced-rate sample after it is computed
+    return engineLatency + windowLatency + decimator.getLatency() + decimation;
+}
+
+void IntegratorCore::setBandGain(int band, double gain)
+{
+    bandGains[band] = gain;
+
+    filterBank.setBandGain(band, gain);
+
+    if (engine == FilterEngine::FFT)
+        updateKernel();
+}
+
+void IntegratorCore::setBands(double sampleRate, const std::vector<BandSpec>& bands)
+{
+    const int numBands = int(bands.size());
+
+    filterBank.setNumBands(numBands);
+
+    bandDesigns.assign(numBands, BandDesign { 0.0, 0.0, 0.0, 0 });
+    bandSections.assign(numBands, nullptr);
+    bandGains.assign(numBands, 1.0);
+
+    for (int band = 0; band < numBands; band++)
+    {
+        if (sampleRate > 0)
+        {
+            bandDesigns[band] = { sampleRate, bands[band].lowCut, bands[band].highCut, bands[band].order };
+            designBand(band);
+        }
+
+        bandGains[band] = bands[band].gain;
+        filterBank.setBandGain(band, bands[band].gain);
+    }
+
+    if (engine == FilterEngine::FFT)
+        updateKernel();
+}
+
+void IntegratorCore::setEngine(FilterEngine engine_, int hopSize)
+{
+    engine = engine_;
+
+    if (engine == FilterEngine::FFT)
+    {
+        overlapSave.setKernel(std::vector<double>(1, 0.0), hopSize);
+        updateKernel();
+    }
+    else
+    {
+        // the FFT engine's kernel spectra and history are released, as they may be large
+        kernel.reset();
+        overlapSave = OverlapSaveFilter();
+        overlapSave.setNumChannels(getNumChannels());
+    }
+}
+
+double IntegratorCore::getEstimatedFftCost() const
+{
+    // each partition of the kernel costs a complex multiply-add per bin for every hop, plus the
+    // transforms, the derivative and the window; fitted to mbi-benchmark on a 3 GHz x86-64 core
+    const double numPartitions = std::ceil(double(getKernelLength()) / overlapSave.getLatency());
+
+    return (fftFixedCost + fftPartitionCost * numPartitions) / decimation;
+}
+
+void IntegratorCore::updateKernel()
+{
+    kernel = getKernel(bandSections, bandGains);
+
+    overlapSave.setKernel(kernel->taps, overlapSave.getLatency());
+}
+
+std::shared_ptr<const IntegratorCore::FftKernel> IntegratorCore::getKernel(const std::vector<std::shared_ptr<const BandPassDesignCache::Sections>>& sections,
+                                                                     const std::vector<double>& gains)
+{
+    // a band that is not designed yet passes nothing
+    const BandPassDesignCache::Sections noSections;
+
+    auto getSections = [&](size_t band) -> const BandPassDesignCache::Sections&
+    {
+        return sections[band] != nullptr ? *sections[band] : noSections;
+    };
+
+    std::vector<double> key;
+
+    for (size_t band = 0; band < sections.size(); band++)
+    {
+        key.push_back(gains[band]);
+        key.push_back(double(getSections(band).size()));
+
+        for (const BiquadCoefficients& c : getSections(band))
+            key.insert(key.end(), { c.b0, c.b1, c.b2, c.a1, c.a2 });
+    }
+
+    const std::lock_guard<std::mutex> lock(kernelCacheLock);
+
+    std::weak_ptr<const FftKernel>& entry = kernelCache[key];
+
+    if (std::shared_ptr<const FftKernel> cached = entry.lock())
+        return cached;
+
+    // the impulse response of the IIR bank, so that both engines compute the same weighted sum
+    BandFilterBank impulseBank(SimdLevel::SCALAR);
+
+    impulseBank.setNumBands(int(sections.size()));
+    impulseBank.setNumChannels(1);
+
+    for (int band = 0; band < int(sections.size()); band++)
+    {
+        impulseBank.setBandSections(band, getSections(band));
+        impulseBank.setBandGain(band, gains[band]);
+    }
+
+    // twice as long as the longest kernel, to measure what a kernel cut at maxKernelLength misses
+    const int responseLength = 2 * maxKernelLength;
+
+    std::vector<float> response(responseLength, 0.0f);
+    response[0] = 1.0f;
+
+    float* channel = response.data();
+    impulseBank.process(&channel, &channel, responseLength);
+
+    // truncate where the response has decayed to a negligible level
+    float peak = 0.0f;
+
+    for (int i = 0; i < maxKernelLength; i++)
+        peak = std::max(peak, std::fabs(response[i]));
+
+    int length = maxKernelLength;
+
+    while (length > 1 && std::fabs(response[length - 1]) <= 1e-5f * peak)
+        length--;
+
+    std::vector<double> taps(response.begin(), response.begin() + length);
+
+    // taper the last eighth of the kernel to soften the truncation
+    const int taperLength = length / 8;
+    const double pi = 3.1415926535897932384626433832795;
+
+    for (int i = 0; i < taperLength; i++)
+        taps[length - 1 - i] *= 0.5 - 0.5 * std::cos(pi * (i + 0.5) / taperLength);
+
+    // the energy of the response that the taper and the cut take away, relative to the whole
+    double responseEnergy = 0.0;
+    double errorEnergy = 0.0;
+
+    for (int i = 0; i < responseLength; i++)
+    {
+        const double error = response[i] - (i < length ? taps[i] : 0.0);
+
+        responseEnergy += double(response[i]) * response[i];
+        errorEnergy += error * error;
+    }
+
+    std::shared_ptr<const FftKernel> built = std::make_shared<const FftKernel>(
+        FftKernel { std::move(taps), responseEnergy > 0.0 ? errorEnergy / responseEnergy : 0.0 });
+
+    entry = built;
+
+    // drop entries whose kernels are no longer used by any core
+    for (auto it = kernelCache.begin(); it != kernelCache.end();)
+    {
+        if (it->second.expired())
+            it = kernelCache.erase(it);
+        else
+            ++it;
+    }
+
+    return built;
+}
+
+void IntegratorCore::setWindowSamples(int numSamples)
+{
+    windowSamples = std::max(numSamples, 1);
+
+    resetRollingAverages();
+}
+
+void IntegratorCore::setWindowProfile(WindowProfile profile)
+{
+    windowProfile = profile;
+
+    resetRollingAverages();
+}
+
+void IntegratorCore::setWindowStorage(WindowStorage storage)
+{
+    windowStorage = storage;
+
+    resetRollingAverages();
+}
+
+void IntegratorCore::setSavitzkyGolayShape(const SavitzkyGolayShape& shape)
+{
+    savitzkyGolayShape = shape;
+
+    resetRollingAverages();
+}
+
+void IntegratorCore::setDetectorSettings(const DetectorSettings& settings)
+{
+    detector.setSettings(settings);
+}
+
+int IntegratorCore::getDecimatedWindowSamples() const
+{
+    return std::max(int(std::lround(double(windowSamples) / decimation)), 1);
+}
+
+SavitzkyGolayShape IntegratorCore::getDecimatedShape() const
+{
+    SavitzkyGolayShape shape = savitzkyGolayShape;
+    shape.lookahead = int(std::lround(double(shape.lookahead) / decimation));
+
+    return shape;
+}
+
+void IntegratorCore::resetRollingAverages()
+{
+    // deferred windows keep their default, one-sample size until they are taken over
+    if (windowsDeferred)
+        return;
+
+    const int numChannels = int(rollingAverages.size());
+    const int windowSize = getDecimatedWindowSamples();
+
+    for (int ch = 0; ch < numChannels; ch++)
+    {
+        rollingAverages[ch].setSize(windowSize, windowProfile, windowStorage, getDecimatedShape());
+
+        // the channels wrap evenly spaced through the window rather than in the same block, so
+        // that a fixed-point window that refines its step there, rescaling every sample, does not
+        // do so on every channel at once
+        rollingAverages[ch].setResyncPhase(int(int64_t(windowSize) * ch / numChannels));
+    }
+}
+
+void IntegratorCore::takeStateFrom(IntegratorCore& other)
+{
+    // events in progress are carried over whatever else changes, so that they are ended exactly
+    // once; between cores with different channel counts, the caller ends them instead
+    detector.takeStateFrom(other.detector);
+
+    // state at another rate would not line up with this core's samples
+    if (other.decimation != decimation)
+        return;
+
+    decimator.takeStateFrom(other.decimator);
+
+    if (engine == FilterEngine::FFT && other.engine == FilterEngine::FFT)
+        overlapSave.takeStateFrom(other.overlapSave);
+    else
+        filterBank.takeStateFrom(other.filterBank);
+
+    if (other.getNumChannels() != getNumChannels())
+        return;
+
+    previousSums.swap(other.previousSums);
+    previousEnvelopes.swap(other.previousEnvelopes);
+    nextEnvelopes.swap(other.nextEnvelopes);
+    previousOutputSums.swap(other.previousOutputSums);
+    nextOutputSums.swap(other.nextOutputSums);
+    interpolationPhase = other.interpolationPhase;
+
+    // a window of a different length, profile or precision is cleared, as setWindowSamples() would
+    if (hasSameWindow(other))
+    {
+        rollingAverages.swap(other.rollingAverages);
+        std::swap(windowsDeferred, other.windowsDeferred);
+    }
+}
+
+bool IntegratorCore::hasSameFftLayout(const IntegratorCore& other) const
+{
+    return engine == FilterEngine::FFT
+        && other.engine == FilterEngine::FFT
+        && other.decimation == decimation
+        && overlapSave.hasSameLayout(other.overlapSave);
+}
+
+bool IntegratorCore::hasSameWindow(const IntegratorCore& other) const
+{
+    return other.decimation == decimation
+        && other.windowSamples == windowSamples
+        && other.windowProfile == windowProfile
+        && other.windowStorage == windowStorage
+        && other.savitzkyGolayShape == savitzkyGolayShape;
+}
+
+void IntegratorCore::process(const float* const* input, float* const* output, int numSamples,
+                             float* const* sums)
+{
+    const int numChannels = getNumChannels();
+
+    detector.beginBlock();
+
+    if (numChannels == 0 || numSamples <= 0)
+        return;
+
+    if (decimation > 1)
+    {
+        processDecimated(input, output, numSamples, sums);
+        return;
+    }
+
+    // Each stage is one pass over the whole block, in the output. Interleaving the stages tile
+    // by tile, so that the band sums stay in L1, measured no faster: the filters and the window
+    // do far more arithmetic per sample than it takes to stream the block through L2.
+    if (engine == FilterEngine::FFT)
+        overlapSave.process(input, output, numSamples);
+    else
+        filterBank.process(input, output, numSamples);
+
+    for (int ch = 0; ch < numChannels; ch++)
+    {
+        if (sums != nullptr)
+            std::copy(output[ch], output[ch] + numSamples, sums[ch]);
+
+        previousSums[ch] = differentiate(output[ch], output[ch], numSamples, previousSums[ch]);
+
+        rollingAverages[ch].process(output[ch], output[ch], numSamples, 1.0, outputGain);
+
+        detector.process(ch, output[ch], numSamples, 0);
+    }
+}
+
+void IntegratorCore::processDecimated(const float* const* input, float* const* output, int numSamples,
+                                      float* const* sums)
+{
+    const int numChannels = getNumChannels();
+
+    // each chunk of input decimates to at most one tile, which fits in tileSums
+    const int chunkSize = BandFilterBank::tileSize * decimation;
+
+    // the derivative is taken over decimation input samples; scale it back to one
+    const double derivativeScale = 1.0 / decimation;
+
+    // likewise, a derivative of the Savitzky-Golay fit is per reduced-rate sample
+    const float envelopeGain = windowProfile == WindowProfile::SAVITZKY_GOLAY
+                             ? float(outputGain / std::pow(double(decimation), savitzkyGolayShape.derivative))
+                             : outputGain;
+
+    for (int start = 0; start < numSamples; start += chunkSize)
+    {
+        const int numSamplesInChunk = std::min(chunkSize, numSamples - start);
+
+        for (int ch = 0; ch < numChannels; ch++)
+            tileInputs[ch] = input[ch] + start;
+
+        // input position of the first reduced-rate sample produced by this chunk
+        const int firstOutput = decimator.getSamplesUntilOutput() - 1;
+
+        const int numDecimated = decimator.process(tileInputs.data(), sumPointers.data(), numSamplesInChunk);
+
+        if (numDecimated > 0)
+        {
+            if (engine == FilterEngine::FFT)
+                overlapSave.process(sumPointers.data(), sumPointers.data(), numDecimated);
+            else
+                filterBank.process(sumPointers.data(), sumPointers.data(), numDecimated);
+        }
+
+        int phase = interpolationPhase;
+        float* derivative = tileDerivatives.data();
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            float* out = output[ch] + start;
+
+            if (sums != nullptr)
+                interpolate(sumPointers[ch], sums[ch] + start, numSamplesInChunk, firstOutput, decimation,
+                            previousOutputSums[ch], nextOutputSums[ch], interpolationPhase);
+
+            // the row of derivatives is replaced by the envelope at the reduced rate
+            previousSums[ch] = differentiate(sumPointers[ch], derivative, numDecimated, previousSums[ch]);
+            rollingAverages[ch].process(derivative, derivative, numDecimated, derivativeScale, envelopeGain);
+
+            phase = interpolate(derivative, out, numSamplesInChunk, firstOutput, decimation,
+                                previousEnvelopes[ch], nextEnvelopes[ch], interpolationPhase);
+
+            detector.process(ch, out, numSamplesInChunk, start);
+        }
+
+        interpolationPhase = phase;
+    }
+}
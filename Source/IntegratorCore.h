@@ -0,0 +1,335 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef INTEGRATOR_CORE_H_INCLUDED
+#define INTEGRATOR_CORE_H_INCLUDED
+
+#include "BandFilterBank.h"
+#include "BandTable.h"
+#include "Decimator.h"
+#include "OverlapSaveFilter.h"
+#include "RollingAverage.h"
+#include "ThresholdDetector.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/** How the weighted sum of the bands is computed */
+enum class FilterEngine
+{
+    IIR,    // one Butterworth band-pass per band (BandFilterBank)
+    FFT     // the same bands folded into one FIR kernel, applied by overlap-save
+};
+
+/**
+    The multi-band integration of a group of channels, independent of the GUI.
+
+    For every channel, the input is band-pass filtered into each band, the bands
+    are weighted and summed, and the output is the weighted rolling average of the
+    absolute derivative of that sum, multiplied by outputGain. The output only depends
+    on the input samples, not on how they are split into blocks. MultiBandIntegrator
+    and the offline tools run one core per group of channels.
+
+    A ThresholdDetector can scan the output for threshold crossings as each channel's
+    block of it is written, while it is still in cache.
+
+    With a decimation factor above 1, the input is first downsampled by a Decimator,
+    the bands and the rolling window run at the reduced rate, and the envelope is
+    linearly interpolated back up to the input rate.
+ */
+class IntegratorCore
+{
+public:
+
+    /** Constructor */
+    IntegratorCore(SimdLevel level = getSupportedSimdLevel());
+
+    /** Destructor */
+    ~IntegratorCore() { }
+
+    /** Allocates the workspace for up to maxChannels channels, so that process() never has to */
+    void prepare(int maxChannels);
+
+    /** Sets the number of channels, clearing all filter and window state */
+    void setNumChannels(int numChannels);
+
+    /** Returns the number of channels */
+    int getNumChannels() const { return filterBank.getNumChannels(); }
+
+    /** Sets the number of bands */
+    void setNumBands(int numBands);
+
+    /** Returns the number of bands */
+    int getNumBands() const { return int(bandSections.size()); }
+
+    /** Designs the Butterworth band-pass filter of one band for the input sample rate */
+    void setBand(int band, double sampleRate, double lowCut, double highCut, int order = 2);
+
+    /** Sets the gain applied to one band before summing */
+    void setBandGain(int band, double gain);
+
+    /** Sets every band and its gain, as setNumBands(), setBand() and setBandGain() would, but
+        rebuilds the FFT engine's kernel once rather than after each change. The bands are only
+        designed if sampleRate is above 0. */
+    void setBands(double sampleRate, const std::vector<BandSpec>& bands);
+
+    /** Selects the filter engine. For FFT, hopSize is the number of samples per
+        transform, which is also the delay the engine adds to the output. */
+    void setEngine(FilterEngine engine, int hopSize);
+
+    /** Returns the filter engine */
+    FilterEngine getEngine() const { return engine; }
+
+    /** Returns the number of taps of the FFT engine's kernel */
+    int getKernelLength() const { return overlapSave.getKernelLength(); }
+
+    /** Returns how much of the weighted bands' impulse response the FFT engine's kernel misses,
+        as it is cut at maxKernelLength and tapered: the energy of the difference over the energy
+        of the response. Close to 0 once the response has decayed within the kernel; 0 with the
+        IIR engine. */
+    double getFftTruncationError() const { return kernel != nullptr ? kernel->truncationError : 0.0; }
+
+    /** Estimates the time the whole pipeline takes per input sample of each channel with the FFT
+        engine, in ns on a current desktop core, from the length of its kernel, its hop size and the
+        decimation. The IIR engine takes about 20 ns at any sample rate. */
+    double getEstimatedFftCost() const;
+
+    /** Sets the factor by which the input is downsampled before filtering, redesigning the bands
+        and clearing all filter and window state. 1 processes everything at the input rate. The
+        decimator and the interpolation of the envelope still run at the input rate, and take
+        about 2 ns per sample between them, which bounds the speed-up to about 10x. */
+    void setDecimation(int factor);
+
+    /** Returns the decimation factor */
+    int getDecimation() const { return decimation; }
+
+    /** Returns the largest decimation factor that keeps the reduced rate at or above both
+        minDecimatedRate and bandRateRatio times the highest band edge */
+    static int chooseDecimation(double sampleRate, double highestFrequency);
+
+    /** Splits numChannels into at most maxGroups groups of consecutive channels, each made of
+        whole SIMD lane groups, so that one core per group computes exactly what a single core
+        for all the channels would. Returns the first channel of each group, then numChannels. */
+    static std::vector<int> splitChannels(int numChannels, int maxGroups);
+
+    /** Returns the delay added by the filter engine, the resampling and the Savitzky-Golay
+        lookahead, in input samples */
+    int getLatency() const;
+
+    /** Sets the length of the rolling window in input samples, clearing its contents */
+    void setWindowSamples(int numSamples);
+
+    /** Selects the weighting of the rolling window, clearing its contents */
+    void setWindowProfile(WindowProfile profile);
+
+    /** Returns the weighting of the rolling window */
+    WindowProfile getWindowProfile() const { return windowProfile; }
+
+    /** Selects the precision of the rolling window's stored samples, clearing its contents */
+    void setWindowStorage(WindowStorage storage);
+
+    /** Returns the precision of the rolling window's stored samples */
+    WindowStorage getWindowStorage() const { return windowStorage; }
+
+    /** Sets the fit of the SAVITZKY_GOLAY profile, clearing the window. The lookahead is in input
+        samples, and a derivative is output in units per input sample. */
+    void setSavitzkyGolayShape(const SavitzkyGolayShape& shape);
+
+    /** Sets the threshold detection applied to the output, keeping the events in progress */
+    void setDetectorSettings(const DetectorSettings& settings);
+
+    /** Returns the threshold crossings of the output in the last block processed */
+    const ThresholdDetector& getDetector() const { return detector; }
+
+    /** Takes over the filter state, previous sums and rolling windows of another core, wherever
+        they are compatible with this one's settings; anything else starts from silence.
+        The state is exchanged rather than copied, so this never allocates and can be
+        called on the processing thread. The events in progress are only taken over if the
+        cores have as many channels; the caller has to end them otherwise. The rolling
+        windows are taken over if the cores also have the same window (see hasSameWindow()). */
+    void takeStateFrom(IntegratorCore& other);
+
+    /** Returns true if the rolling windows run at the same rate with the same length, profile,
+        precision and fit as another core's */
+    bool hasSameWindow(const IntegratorCore& other) const;
+
+    /** Returns true if both cores filter with the FFT engine at the same rate, with the same
+        hop and number of kernel partitions, so that its input history can be taken over */
+    bool hasSameFftLayout(const IntegratorCore& other) const;
+
+    /** Leaves the rolling windows unallocated, for a core that takes them over from one with
+        as many channels and the same window before it processes anything. Saves building a
+        window's worth of memory per channel when only other settings change. Call before
+        setNumChannels(). */
+    void deferWindows() { windowsDeferred = true; }
+
+    /** Likewise for the FFT engine's input history and spectra, which grow with the kernel
+        length; they are taken over from a core with the same FFT layout (until then, the
+        engine outputs silence). Call after setEngine() and before setNumChannels(). */
+    void deferFftState() { overlapSave.deferState(); }
+
+    /** Stands in for process() on a block that is not integrated: no crossings are reported,
+        except that with endEvents the events in progress end at the block's first sample */
+    void skipBlock(bool endEvents) { detector.beginBlock(endEvents); }
+
+    /** Integrates one block of every channel. Input and output may point to the same memory.
+        If sums is not null, it receives the weighted band sum of each channel, before the
+        derivative and the rolling window (interpolated back up to the input rate at a reduced
+        rate); it may share memory with the input but not with the output. */
+    void process(const float* const* input, float* const* output, int numSamples,
+                 float* const* sums = nullptr);
+
+    /** Gain applied to the rolling average so that its units are more useful */
+    static constexpr float outputGain = 10.0f;
+
+    /** Longest FIR kernel the FFT engine will use */
+    static const int maxKernelLength = 65536;
+
+    /** Largest getFftTruncationError() at which the FFT engine still computes the same envelope
+        as the IIR engine, to about -60 dB; above it, the IIR engine should be used */
+    static constexpr double maxFftTruncationError = 1e-6;
+
+    /** Lowest rate chooseDecimation() will reduce a stream to, in Hz */
+    static constexpr double minDecimatedRate = 1000.0;
+
+    /** Lowest ratio of the reduced rate to the highest band edge chosen by chooseDecimation() */
+    static constexpr double bandRateRatio = 16.0;
+
+    /** Highest decimation factor */
+    static constexpr int maxDecimation = 64;
+
+    /** Terms of getEstimatedFftCost(), in ns per sample and channel: the cost of the pipeline
+        with a one-partition kernel, and what each further partition adds */
+    static constexpr double fftFixedCost = 45.0;
+    static constexpr double fftPartitionCost = 3.5;
+
+private:
+
+    /** Parameters of one band, kept so that it can be redesigned for a new decimation */
+    struct BandDesign
+    {
+        double sampleRate;
+        double lowCut;
+        double highCut;
+        int order;
+    };
+
+    /** Designs one band at the reduced rate */
+    void designBand(int band);
+
+    /** Sets the FFT engine's kernel for the current bands and gains */
+    void updateKernel();
+
+    /** The FFT engine's kernel: the impulse response of the weighted bands, cut where it has
+        decayed (or at maxKernelLength) and tapered */
+    struct FftKernel
+    {
+        std::vector<double> taps;
+
+        /** See getFftTruncationError() */
+        double truncationError;
+    };
+
+    /** Returns the FFT engine's kernel for a set of bands and gains, built once for every core
+        that uses the same designs and gains */
+    static std::shared_ptr<const FftKernel> getKernel(const std::vector<std::shared_ptr<const BandPassDesignCache::Sections>>& sections,
+                                                                const std::vector<double>& gains);
+
+    /** Length of the rolling window at the reduced rate */
+    int getDecimatedWindowSamples() const;
+
+    /** Savitzky-Golay fit at the reduced rate */
+    SavitzkyGolayShape getDecimatedShape() const;
+
+    /** Resizes every rolling window for the current window settings, clearing them */
+    void resetRollingAverages();
+
+    /** process() for decimation factors above 1 */
+    void processDecimated(const float* const* input, float* const* output, int numSamples, float* const* sums);
+
+    FilterEngine engine;
+
+    BandFilterBank filterBank;
+    OverlapSaveFilter overlapSave;
+
+    Decimator decimator;
+
+    std::vector<BandDesign> bandDesigns;
+
+    /** Band designs (held, so that BandPassDesignCache shares them with other cores, and null
+        until a band is designed) and gains, kept to build the FFT engine's kernel */
+    std::vector<std::shared_ptr<const BandPassDesignCache::Sections>> bandSections;
+    std::vector<double> bandGains;
+
+    /** The FFT engine's kernel, held so that other cores with the same bands can share it */
+    std::shared_ptr<const FftKernel> kernel;
+
+    /** Kernels in use, keyed by the gain and the coefficients of every band's sections */
+    static std::mutex kernelCacheLock;
+    static std::map<std::vector<double>, std::weak_ptr<const FftKernel>> kernelCache;
+
+    std::vector<RollingAverage> rollingAverages;
+
+    ThresholdDetector detector;
+
+    /** Weighted band sums of one tile at a reduced rate, one row of BandFilterBank::tileSize
+        samples per channel (at the input rate, the stages work in the output instead) */
+    std::vector<float> tileSums;
+
+    /** Per-channel pointers into the current tile of the input, and into tileSums */
+    std::vector<const float*> tileInputs;
+    std::vector<float*> sumPointers;
+
+    /** Absolute derivative of one channel's row of tileSums (at the reduced rate, replaced
+        by the envelope before it is interpolated) */
+    std::vector<float> tileDerivatives;
+
+    /** Last weighted sum of each channel, carried from one chunk and one block to the next, so that
+        the derivative does not depend on where the input is split into blocks */
+    std::vector<float> previousSums;
+
+    /** The two most recent envelope values of each channel at the reduced rate, interpolated between */
+    std::vector<float> previousEnvelopes;
+    std::vector<float> nextEnvelopes;
+
+    /** Likewise for the weighted band sums, when they are output */
+    std::vector<float> previousOutputSums;
+    std::vector<float> nextOutputSums;
+
+    /** Input samples since the most recent reduced-rate envelope value */
+    int interpolationPhase;
+
+    int channelCapacity;
+    int windowSamples;
+    WindowProfile windowProfile;
+    WindowStorage windowStorage;
+    SavitzkyGolayShape savitzkyGolayShape;
+    int decimation;
+
+    /** True while the rolling windows are placeholders, waiting to be taken over (see deferWindows()) */
+    bool windowsDeferred;
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "LatencyHistogram.h"
+
+#include <cmath>
+#include <limits>
+
+LatencyHistogram::LatencyHistogram() :
+    resetRequested(false)
+{
+    clear();
+}
+
+void LatencyHistogram::clear()
+{
+    for (auto& bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+
+    numBlocks.store(0, std::memory_order_relaxed);
+    numOverruns.store(0, std::memory_order_relaxed);
+    totalNs.store(0, std::memory_order_relaxed);
+    minNs.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+    maxNs.store(0, std::memory_order_relaxed);
+
+    resetRequested.store(false, std::memory_order_release);
+}
+
+void LatencyHistogram::reset()
+{
+    resetRequested.store(true, std::memory_order_release);
+}
+
+double LatencyHistogram::getBucketValue(int bucket)
+{
+    if (bucket < bucketsPerOctave)
+        return bucket;
+
+    const int octave = bucket / bucketsPerOctave + 1;
+    const int fraction = bucket % bucketsPerOctave;
+
+    // bucket covers [2^octave * (1 + fraction/4), 2^octave * (1 + (fraction+1)/4))
+    return std::ldexp(1.0 + (fraction + 0.5) / bucketsPerOctave, octave);
+}
+
+LatencyHistogram::Statistics LatencyHistogram::getStatistics() const
+{
+    Statistics statistics = {};
+
+    if (resetRequested.load(std::memory_order_acquire))
+        return statistics;
+
+    uint64_t counts[numBuckets];
+    uint64_t total = 0;
+
+    for (int i = 0; i < numBuckets; i++)
+    {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    if (total == 0)
+        return statistics;
+
+    statistics.numBlocks = total;
+    statistics.numOverruns = numOverruns.load(std::memory_order_relaxed);
+    statistics.minNs = double(minNs.load(std::memory_order_relaxed));
+    statistics.maxNs = double(maxNs.load(std::memory_order_relaxed));
+    statistics.meanNs = double(totalNs.load(std::memory_order_relaxed)) / double(numBlocks.load(std::memory_order_relaxed) > 0 ? numBlocks.load(std::memory_order_relaxed) : 1);
+
+    const uint64_t p50Rank = (total * 50 + 99) / 100;
+    const uint64_t p99Rank = (total * 99 + 99) / 100;
+
+    uint64_t seen = 0;
+    bool foundP50 = false;
+
+    for (int i = 0; i < numBuckets; i++)
+    {
+        seen += counts[i];
+
+        if (! foundP50 && seen >= p50Rank)
+        {
+            statistics.p50Ns = getBucketValue(i);
+            foundP50 = true;
+        }
+
+        if (seen >= p99Rank)
+        {
+            statistics.p99Ns = getBucketValue(i);
+            break;
+        }
+    }
+
+    // bucket centres can fall outside the exact extremes
+    statistics.p50Ns = std::fmin(std::fmax(statistics.p50Ns, statistics.minNs), statistics.maxNs);
+    statistics.p99Ns = std::fmin(std::fmax(statistics.p99Ns, statistics.minNs), statistics.maxNs);
+
+    return statistics;
+}
@@ -0,0 +1,133 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef LATENCY_HISTOGRAM_H_INCLUDED
+#define LATENCY_HISTOGRAM_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+
+/**
+    Distribution of block processing times, recorded on the processing thread
+    and read from any other thread without locking.
+
+    Times are sorted into logarithmic buckets, four per power of two, so that
+    percentiles are accurate to within about 20% over the whole range from
+    nanoseconds to seconds. There must be only one recording thread; readers
+    see a consistent enough picture for monitoring, though a block recorded
+    while statistics are being read may be counted in some fields and not yet
+    in others.
+ */
+class LatencyHistogram
+{
+public:
+
+    /** Summary of the recorded times, in nanoseconds */
+    struct Statistics
+    {
+        uint64_t numBlocks;
+        uint64_t numOverruns;
+
+        double minNs;
+        double meanNs;
+        double p50Ns;
+        double p99Ns;
+        double maxNs;
+    };
+
+    /** Constructor */
+    LatencyHistogram();
+
+    /** Records the processing time of one block; overrun means it took longer than the block lasts.
+        Only called from the processing thread. */
+    void record(uint64_t nanoseconds, bool overrun)
+    {
+        if (resetRequested.load(std::memory_order_acquire))
+            clear();
+
+        // a single writer can update each counter without a locked read-modify-write
+        increment(buckets[getBucket(nanoseconds)]);
+        increment(numBlocks);
+
+        if (overrun)
+            increment(numOverruns);
+
+        totalNs.store(totalNs.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+
+        if (nanoseconds < minNs.load(std::memory_order_relaxed))
+            minNs.store(nanoseconds, std::memory_order_relaxed);
+
+        if (nanoseconds > maxNs.load(std::memory_order_relaxed))
+            maxNs.store(nanoseconds, std::memory_order_relaxed);
+    }
+
+    /** Returns a summary of everything recorded since the last reset. Can be called from any thread. */
+    Statistics getStatistics() const;
+
+    /** Clears the histogram before the next block is recorded. Can be called from any thread. */
+    void reset();
+
+    static const int bucketsPerOctave = 4;
+    static const int numBuckets = 64 * bucketsPerOctave;
+
+private:
+
+    static void increment(std::atomic<uint64_t>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /** Returns the bucket for a time: the position of its highest bit, refined by the next two bits */
+    static int getBucket(uint64_t nanoseconds)
+    {
+        if (nanoseconds < bucketsPerOctave)
+            return int(nanoseconds);
+
+        int octave = 63;
+
+        while ((nanoseconds >> octave) == 0)
+            octave--;
+
+        const int fraction = int(nanoseconds >> (octave - 2)) & (bucketsPerOctave - 1);
+
+        return (octave - 1) * bucketsPerOctave + fraction;
+    }
+
+    /** Returns the time in the middle of a bucket */
+    static double getBucketValue(int bucket);
+
+    /** Zeroes every counter; only called by the recording thread */
+    void clear();
+
+    std::atomic<uint64_t> buckets[numBuckets];
+
+    std::atomic<uint64_t> numBlocks;
+    std::atomic<uint64_t> numOverruns;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> minNs;
+    std::atomic<uint64_t> maxNs;
+
+    std::atomic<bool> resetRequested;
+};
+
+#endif
@@ -29,48 +29,235 @@ First, simply filtering the data before thresholding
 
 #include "MultiBandIntegratorEditor.h"
 
-#include <vector>
+
+constexpr double MultiBandIntegratorSettings::maxFftLoad;
 
 MultiBandIntegratorSettings::MultiBandIntegratorSettings() :
-    localChannelIndex(0),
-    alphaGain(4.0f),
-    betaGain(7.0f),
-    deltaGain(-1.0f)
+    enabled(true),
+    eventChannel(nullptr),
+    sampleRate(0.0f),
+    windowSamples(1),
+    windowProfile(WindowProfile::QUADRATIC),
+    windowStorage(WindowStorage::DOUBLE),
+    engine(FilterEngine::IIR),
+    fftHopSize(256),
+    fftDeclined(false),
+    multirate(false),
+    numThreads(1)
 {
-    
-    for (int n = 0; n < 3; n = n + 1)
+    parseBandTable(defaultBandTable, bands);
+}
+
+void MultiBandIntegratorSettings::setChannels(const Array<int>& localIndices, const Array<const ContinuousChannel*>& channels)
+{
+    localChannelIndices = localIndices;
+    inputChannels = channels;
+}
+
+void MultiBandIntegratorSettings::setBands(float sampleRate_, const std::vector<BandSpec>& bands_)
+{
+    sampleRate = sampleRate_;
+    bands = bands_;
+}
+
+void MultiBandIntegratorSettings::setRollingWindowParameters(float sampleRate, var rollDuration)
+{
+
+    windowSamples = int(sampleRate * float(rollDuration) / 1000.0f);
+
+}
+
+void MultiBandIntegratorSettings::setSmoother(int smootherIndex)
+{
+    // same order as the choices of the "smoother" parameter
+    const WindowProfile profiles[] = { WindowProfile::RECTANGULAR, WindowProfile::QUADRATIC,
+                                       WindowProfile::EXPONENTIAL, WindowProfile::SAVITZKY_GOLAY,
+                                       WindowProfile::CASCADED };
+
+    windowProfile = profiles[std::min(std::max(smootherIndex, 0), 4)];
+}
+
+void MultiBandIntegratorSettings::setWindowPrecision(int precisionIndex)
+{
+    // same order as the choices of the "window_precision" parameter
+    const WindowStorage storages[] = { WindowStorage::DOUBLE, WindowStorage::FLOAT,
+                                       WindowStorage::INT32, WindowStorage::INT16 };
+
+    windowStorage = storages[std::min(std::max(precisionIndex, 0), 3)];
+}
+
+void MultiBandIntegratorSettings::setSavitzkyGolayParameters(float sampleRate, int order, int derivative, var lookaheadMs)
+{
+    savitzkyGolayShape.order = std::min(std::max(order, 0), SavitzkyGolayShape::maxOrder);
+    savitzkyGolayShape.derivative = std::max(derivative, 0);
+    savitzkyGolayShape.lookahead = int(sampleRate * float(lookaheadMs) / 1000.0f);
+}
+
+void MultiBandIntegratorSettings::setOutputChannels(const Array<const ContinuousChannel*>& envelopes,
+                                                    const Array<const ContinuousChannel*>& sums)
+{
+    envelopeChannels = envelopes;
+    sumChannels = sums;
+}
+
+void MultiBandIntegratorSettings::clearOutputChannels(AudioBuffer<float>& buffer, int numSamples) const
+{
+    for (const ContinuousChannel* channel : envelopeChannels)
+        buffer.clear(channel->getGlobalIndex(), 0, numSamples);
+
+    for (const ContinuousChannel* channel : sumChannels)
+        buffer.clear(channel->getGlobalIndex(), 0, numSamples);
+}
+
+void MultiBandIntegratorSettings::setDetectorParameters(float sampleRate, bool enabled_, float threshold,
+                                                        float hysteresis, var refractoryMs)
+{
+    detectorSettings.enabled = enabled_;
+    detectorSettings.threshold = threshold;
+    detectorSettings.hysteresis = std::max(hysteresis, 0.0f);
+    detectorSettings.refractorySamples = int(sampleRate * float(refractoryMs) / 1000.0f);
+}
+
+void MultiBandIntegratorSettings::setEngine(int engineIndex, int hopSize)
+{
+    engine = engineIndex == 1 ? FilterEngine::FFT : FilterEngine::IIR;
+    fftHopSize = hopSize;
+}
+
+void MultiBandIntegratorSettings::setMultirate(bool multirate_)
+{
+    multirate = multirate_;
+}
+
+void MultiBandIntegratorSettings::setNumThreads(int numThreads_)
+{
+    numThreads = std::max(numThreads_, 1);
+}
+
+void MultiBandIntegratorSettings::publish()
+{
+    std::unique_ptr<MultiBandIntegratorSnapshot> next = std::make_unique<MultiBandIntegratorSnapshot>();
+
+    // twice as many groups as threads, so that a thread that finishes early can take over another's
+    next->firstChannels = IntegratorCore::splitChannels(getNumChannels(), numThreads > 1 ? 2 * numThreads : 1);
+    next->cores.resize(next->firstChannels.size() - 1);
+
+    // grouped like the last snapshot, each core takes over its predecessor's rolling windows and
+    // FFT history in adoptState(), so they are only built when their own settings change
+    const MultiBandIntegratorSnapshot* previous = snapshot.getPublished();
+    const bool sameGroups = previous != nullptr && previous->firstChannels == next->firstChannels;
+
+    FilterEngine coreEngine = engine;
+    double fftLoad = 0.0;
+    double fftTruncationError = 0.0;
+
+    for (int g = 0; g < int(next->cores.size()); g++)
     {
-        filters.add(new Dsp::SmoothedFilterDesign
-            <Dsp::Butterworth::Design::BandPass    // design type
-            <2>,                                   // order
-            1,                                     // number of channels (must be const)
-            Dsp::DirectFormII>(1));               // realization
+        IntegratorCore& core = next->cores[g];
+
+        // the rate is chosen first, so that the bands are only designed once
+        if (multirate && sampleRate > 0)
+        {
+            double highestFrequency = 0.0;
+
+            for (const BandSpec& band : bands)
+                highestFrequency = std::max(highestFrequency, band.highCut);
+
+            core.setDecimation(IntegratorCore::chooseDecimation(sampleRate, highestFrequency));
+        }
+
+        // bands are only designed once the stream's sample rate is known
+        core.setBands(sampleRate, bands);
+
+        // the FFT engine's kernel is built from the bands, so it is selected once they are set
+        core.setEngine(coreEngine, fftHopSize);
+
+        // its kernel, and so its cost, grows with the sample rate, so it is only kept where it
+        // should comfortably run in real time, and where the kernel holds the bands' response
+        // without cutting off a noticeable part of it
+        if (coreEngine == FilterEngine::FFT)
+        {
+            fftLoad = core.getEstimatedFftCost() * 1e-9 * sampleRate * getNumChannels() / numThreads;
+            fftTruncationError = core.getFftTruncationError();
+
+            if (fftLoad > maxFftLoad || fftTruncationError > IntegratorCore::maxFftTruncationError)
+            {
+                coreEngine = FilterEngine::IIR;
+                core.setEngine(coreEngine, fftHopSize);
+            }
+        }
+
+        core.setWindowSamples(windowSamples);
+        core.setWindowProfile(windowProfile);
+        core.setWindowStorage(windowStorage);
+        core.setSavitzkyGolayShape(savitzkyGolayShape);
+        core.setDetectorSettings(detectorSettings);
+
+        if (sameGroups && core.hasSameWindow(previous->cores[g]))
+            core.deferWindows();
+
+        if (sameGroups && core.hasSameFftLayout(previous->cores[g]))
+            core.deferFftState();
+
+        core.setNumChannels(next->firstChannels[g + 1] - next->firstChannels[g]);
     }
 
+    next->inputChannels.assign(inputChannels.begin(), inputChannels.end());
+    next->envelopeChannels.assign(envelopeChannels.begin(), envelopeChannels.end());
+    next->sumChannels.assign(sumChannels.begin(), sumChannels.end());
+    next->inputPointers.resize(getNumChannels());
+    next->channelPointers.resize(getNumChannels());
+    next->sumPointers.resize(getNumChannels());
+    next->eventChannel = eventChannel;
+    next->endingLines.reserve(MultiBandIntegratorSnapshot::maxEventLines);
+    next->enabled = enabled;
+
+    snapshot.publish(std::move(next), adoptState);
+
+    const bool declined = engine == FilterEngine::FFT && coreEngine == FilterEngine::IIR;
+
+    if (declined && ! fftDeclined)
+        LOGC("Multi-Band Integrator: the FFT engine would take about ", int(100 * fftLoad), "% of each thread for ",
+             getNumChannels(), " channels at ", sampleRate, " Hz, and its kernel would miss ", fftTruncationError,
+             " of the energy of the bands' response; using the IIR engine instead");
+
+    fftDeclined = declined;
 }
 
-void MultiBandIntegratorSettings::updateFilter(int index, float sampleRate,
-                                                var lowCut,
-                                                var highCut)
+MultiBandIntegratorSnapshot* MultiBandIntegratorSettings::acquireSnapshot()
 {
-    
-    Dsp::Params params;
-    params[0] = sampleRate;                               // sample rate
-    params[1] = 2;                                        // order
-    params[2] = (float(highCut) + float(lowCut)) / 2;     // center frequency
-    params[3] = float(highCut) - float(lowCut);           // bandwidth
-
-    filters[index]->setParams(params);
+    return snapshot.acquire(adoptState);
+}
 
+void MultiBandIntegratorSettings::reclaim()
+{
+    snapshot.reclaim();
 }
 
-void MultiBandIntegratorSettings::setRollingWindowParameters(float sampleRate, var rollDuration)
+void MultiBandIntegratorSettings::adoptState(MultiBandIntegratorSnapshot& next, MultiBandIntegratorSnapshot& previous)
 {
+    // state is only carried over while the channels are grouped the same way; otherwise the
+    // events in progress are ended, so that no TTL line stays high
+    if (next.firstChannels != previous.firstChannels)
+    {
+        for (size_t g = 0; g < previous.cores.size(); g++)
+        {
+            const ThresholdDetector& detector = previous.cores[g].getDetector();
+
+            for (int ch = 0; ch < detector.getNumChannels(); ch++)
+            {
+                const int line = previous.firstChannels[g] + ch;
 
-    int buffSize = int(sampleRate * float(rollDuration) / 1000.0f);
+                if (line < MultiBandIntegratorSnapshot::maxEventLines && detector.isEventActive(ch))
+                    next.endingLines.push_back(line);
+            }
+        }
 
-    rollingAverage.setSize(buffSize);
+        return;
+    }
 
+    for (size_t g = 0; g < next.cores.size(); g++)
+        next.cores[g].takeStateFrom(previous.cores[g]);
 }
 
 
@@ -79,44 +266,89 @@ MultiBandIntegrator::MultiBandIntegrator()
 {
     
     addSelectedChannelsParameter(Parameter::STREAM_SCOPE,
-                                 "Channel", "The input channel to analyze", 1);
+                                 "Channel", "The input channels to analyze");
     
     
     addIntParameter(Parameter::GLOBAL_SCOPE,
                     "window_ms", "The size of the rolling average window in milliseconds",
                     1000, 10, 5000);
+
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE,
+                            "smoother", "Weighting of the rolling window: equal, quadratic or exponential towards the newest sample, a Savitzky-Golay polynomial fit, or cascaded leaky integrators that need no window memory",
+                            { "Rectangular", "Quadratic", "Exponential", "Savitzky-Golay", "Cascaded IIR" }, 1);
+
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE,
+                            "window_precision", "How the rolling window stores its samples: double, or float, 32-bit or 16-bit fixed point to cut the memory of long windows",
+                            { "double", "float", "int32", "int16" }, 0);
+
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE,
+                            "output", "Where the envelopes are written: over the selected channels, or to new channels appended to the stream, optionally followed by each channel's weighted band sum",
+                            { "overwrite", "append", "append + sum" }, 0, true);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "sg_order", "Order of the polynomial fitted by the Savitzky-Golay smoother",
+                    2, 0, SavitzkyGolayShape::maxOrder);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "sg_derivative", "Derivative of the Savitzky-Golay fit to output (0 for the fit itself), per sample",
+                    0, 0, SavitzkyGolayShape::maxOrder);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "sg_lookahead_ms", "How far before the newest sample the Savitzky-Golay fit is evaluated, which delays the output by as much",
+                    0, 0, 5000);
     
-    addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "alpha_low", "The alpha band low cut",
-                    6.0, 0.1, 300.0, false);
-    addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "alpha_high", "The alpha band high cut",
-                    9.0, 0.1, 300.0, false);
-    addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "alpha_gain", "The alpha band gain",
-                    4.0, -20.0, 20.0, false);
-    
-    addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "beta_low", "The beta band low cut",
-                    13.0, 0.1, 300.0, false);
-    addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "beta_high", "The beta band high cut",
-                    18.0, 0.1, 300.0, false);
-    addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "beta_gain", "The beta band gain",
-                    7.0, -20.0, 20.0, false);
+    addCategoricalParameter(Parameter::GLOBAL_SCOPE,
+                            "engine", "How the bands are filtered: one IIR band-pass per band (about 20 ns per sample), or one FFT "
+                                      "convolution for all bands (about 4x that at 2 kHz and 50x at 30 kHz; IIR is used instead "
+                                      "where FFT would take over half of each thread, or the bands ring for longer than its kernel)",
+                            { "IIR", "FFT" }, 0);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "fft_hop", "Samples per transform of the FFT engine, which is also the delay it adds",
+                    256, 16, 8192);
     
+    addBooleanParameter(Parameter::GLOBAL_SCOPE,
+                        "multirate", "Filter and average at a reduced sample rate chosen from the highest band edge, and interpolate the result",
+                        false);
+
+    addStringParameter(Parameter::GLOBAL_SCOPE,
+                       "bands", "Comma-separated bands, each low:high:gain[:order] (Hz, Hz, weight, Butterworth order 1-8, default 2)",
+                       defaultBandTable);
+
+    addBooleanParameter(Parameter::GLOBAL_SCOPE,
+                        "detect", "Send a TTL event on each channel's line while its envelope is above the threshold",
+                        false);
+
     addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "delta_low", "The delta band low cut",
-                    1.0, 0.1, 300.0, false);
-    addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "delta_high", "The delta band high cut",
-                    4.0, 0.1, 300.0, false);
+                      "threshold", "Envelope level at which an event starts",
+                      1.0f, 0.0f, 100000.0f, 0.01f);
+
     addFloatParameter(Parameter::GLOBAL_SCOPE,
-                    "delta_gain", "The delta band gain",
-                    -1.0, -20.0, 20.0, false);
-    
-    scratchBuffer.setSize(3, 10000);
+                      "hysteresis", "How far below the threshold the envelope has to fall to end an event",
+                      0.0f, 0.0f, 100000.0f, 0.01f);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "refractory_ms", "Shortest time between the starts of two events on a channel, in milliseconds",
+                    0, 0, 60000);
+
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "threads", "Number of threads that share the processing of each block, including the processing thread",
+                    1, 1, 32, true);
+
+    startTimer(reclaimIntervalMs);
+}
+
+MultiBandIntegrator::~MultiBandIntegrator()
+{
+    stopTimer();
+}
+
+void MultiBandIntegrator::timerCallback()
+{
+    // frees the snapshots the processing thread has switched away from, which would otherwise
+    // stay resident alongside the current one until the next change of settings
+    for (auto stream : getDataStreams())
+        settings[stream->getStreamId()]->reclaim();
 }
 
 AudioProcessorEditor* MultiBandIntegrator::createEditor()
@@ -131,196 +363,336 @@ void MultiBandIntegrator::updateSettings()
 {
     
     settings.update(getDataStreams());
+
+    streams = getDataStreams();
     
-    for (auto stream : getDataStreams())
+    for (auto stream : streams)
     {
-        for (int i = 0; i < 3; i++)
-        {
-            
-            var lowCut, highCut;
-            
-            if (i == 0)
-            {
-                lowCut = getParameter("alpha_low")->getValue();
-                highCut = getParameter("alpha_high")->getValue();
-            } else if (i == 1)
-            {
-                lowCut = getParameter("beta_low")->getValue();
-                highCut = getParameter("beta_high")->getValue();
-            } else if (i == 2)
-            {
-                lowCut = getParameter("delta_low")->getValue();
-                highCut = getParameter("delta_high")->getValue();
-            }
-            
-            settings[stream->getStreamId()]->updateFilter(i,
-                                                           stream->getSampleRate(),
-                                                          lowCut, highCut);
+        MultiBandIntegratorSettings* module = settings[stream->getStreamId()];
 
-        }
+        module->enabled = (*stream)["enable_stream"];
+
+        setSelectedChannels(stream, (*stream)["Channel"]);
+        addOutputChannels(stream);
+
+        // a table that cannot be parsed (e.g. from an edited settings file) falls back to the defaults
+        std::vector<BandSpec> bands;
+
+        if (! parseBandTable(getParameter("bands")->getValue().toString().toStdString(), bands))
+            parseBandTable(defaultBandTable, bands);
+
+        module->setBands(stream->getSampleRate(), bands);
         
         settings[stream->getStreamId()]->setRollingWindowParameters(stream->getSampleRate(),
                                                                     getParameter("window_ms")->getValue());
-        
+        module->setSmoother(getParameter("smoother")->getValue());
+        module->setWindowPrecision(getParameter("window_precision")->getValue());
+        module->setSavitzkyGolayParameters(stream->getSampleRate(),
+                                           getParameter("sg_order")->getValue(),
+                                           getParameter("sg_derivative")->getValue(),
+                                           getParameter("sg_lookahead_ms")->getValue());
+
+        module->setDetectorParameters(stream->getSampleRate(),
+                                      getParameter("detect")->getValue(),
+                                      getParameter("threshold")->getValue(),
+                                      getParameter("hysteresis")->getValue(),
+                                      getParameter("refractory_ms")->getValue());
+
+        module->setEngine(getParameter("engine")->getValue(), getParameter("fft_hop")->getValue());
+        module->setMultirate(getParameter("multirate")->getValue());
+        module->setNumThreads(getParameter("threads")->getValue());
+
+        // created whether or not detection is enabled, so that it can be turned on during acquisition
+        EventChannel::Settings eventSettings {
+            EventChannel::Type::TTL,
+            "Multi-band integrator threshold",
+            "High while the envelope of the channel on each line is above the threshold",
+            "multiband.threshold",
+            getDataStream(stream->getStreamId())
+        };
+
+        eventChannels.add(new EventChannel(eventSettings));
+        eventChannels.getLast()->addProcessor(processorInfo.get());
+        module->eventChannel = eventChannels.getLast();
+
+        module->publish();
     }
+
+    updateWorkerPool();
 }
 
-void MultiBandIntegrator::process(AudioBuffer<float>& continuousBuffer)
+void MultiBandIntegrator::updateWorkerPool()
 {
-    
-    for (auto stream : getDataStreams())
+    const int numThreads = getParameter("threads")->getValue();
+
+    if (numThreads <= 1)
+        workerPool.reset();
+    else if (workerPool == nullptr || workerPool->getNumThreads() != numThreads)
+        workerPool = std::make_unique<WorkerPool>(numThreads);
+
+    // every stream is split into at most 2 * numThreads groups (see MultiBandIntegratorSettings::publish)
+    tasks.reserve(size_t(streams.size()) * 2 * size_t(numThreads));
+    processedStreams.reserve(size_t(streams.size()));
+    eventStreams.reserve(size_t(streams.size()));
+}
+
+OutputMode MultiBandIntegrator::getOutputMode()
+{
+    // same order as the choices of the "output" parameter
+    const OutputMode modes[] = { OutputMode::OVERWRITE, OutputMode::APPEND, OutputMode::APPEND_WITH_SUM };
+
+    return modes[std::min(std::max(int(getParameter("output")->getValue()), 0), 2)];
+}
+
+void MultiBandIntegrator::addOutputChannels(const DataStream* stream)
+{
+    MultiBandIntegratorSettings* module = settings[stream->getStreamId()];
+    const OutputMode mode = getOutputMode();
+
+    Array<const ContinuousChannel*> envelopes;
+    Array<const ContinuousChannel*> sums;
+
+    if (mode != OutputMode::OVERWRITE)
     {
+        Array<ContinuousChannel*> inputs = stream->getContinuousChannels();
 
-        if ((*stream)["enable_stream"])
+        // the new channels are scaled like their inputs when they are recorded
+        auto appendChannel = [&] (const ContinuousChannel* input, const String& name, const String& description,
+                                  const String& identifier) -> const ContinuousChannel*
         {
-            MultiBandIntegratorSettings* module = settings[stream->getStreamId()];
-            
-            const uint16 streamId = stream->getStreamId();
-            const uint32 numSamplesInBlock = getNumSamplesInBlock(streamId);
-
-            int localIndex = module->localChannelIndex;
-            
-            if (localIndex < 0 || numSamplesInBlock == 0)
-                continue;
-            
-            int globalIndex = stream->getContinuousChannels()[localIndex]->getGlobalIndex();
-            
-            for (int i = 0; i < 3; i++)
-            {
-                scratchBuffer.copyFrom(i,
-                                       0,
-                                       continuousBuffer,
-                                       globalIndex,
-                                       0,
-                                       numSamplesInBlock);
-            }
-            
-            float* ptrA = scratchBuffer.getWritePointer(0);
-            module->filters[0]->process(numSamplesInBlock, &ptrA);
-            scratchBuffer.applyGain(0,
-                                    0,
-                                    numSamplesInBlock,
-                                    module->alphaGain);
-
-            float* ptrB = scratchBuffer.getWritePointer(1);
-            module->filters[1]->process(numSamplesInBlock, &ptrB);
-            scratchBuffer.applyGain(1,
-                                    0,
-                                    numSamplesInBlock,
-                                    module->betaGain);
-
-            float* ptrD = scratchBuffer.getWritePointer(2);
-            module->filters[2]->process(numSamplesInBlock, &ptrD);
-            scratchBuffer.applyGain(2,
-                                    0,
-                                    numSamplesInBlock,
-                                    module->deltaGain);
-
-            //Now sum the samples together into channel 0 of the scratch buffer
-            scratchBuffer.addFrom(0,                  //dest channel
-                                 0,                   //dest start sample
-                                 scratchBuffer,       //source buffer
-                                 1,                   //source channel
-                                 0,                   //source start sample
-                                 numSamplesInBlock);  //num samples
-
-            scratchBuffer.addFrom(0,                  //dest channel
-                                 0,                   //dest start sample
-                                 scratchBuffer,       //source buffer
-                                 2,                   //source channel
-                                 0,                   //source start sample
-                                 numSamplesInBlock);  //num samples
-            
-            //put the rolling mean into channel 1 of the scratch buffer
-            scratchBuffer.setSample(1, 0, module->rollingAverage.calculate());
-
-            for (int i = 0; i < numSamplesInBlock-1; i++)
-            {
-                
-                module->rollingAverage.addSample(
-                        std::fabs(scratchBuffer.getSample(0, i + 1)
-                                - scratchBuffer.getSample(0, i)));
-                
-                
-                scratchBuffer.setSample(1, i+1, module->rollingAverage.calculate());
-            }
+            ContinuousChannel::Settings channelSettings {
+                ContinuousChannel::Type::AUX,
+                input->getName() + " " + name,
+                description + " " + input->getName(),
+                identifier,
+                input->getBitVolts(),
+                getDataStream(stream->getStreamId())
+            };
+
+            continuousChannels.add(new ContinuousChannel(channelSettings));
+            continuousChannels.getLast()->addProcessor(processorInfo.get());
 
-            //add gain to output signal so that its units are more useful
-            scratchBuffer.applyGain(1, 0, numSamplesInBlock, 10);
+            return continuousChannels.getLast();
+        };
 
-            //overwrite the input channel with averaged data
-            continuousBuffer.copyFrom(globalIndex,
-                                      0,
-                                      scratchBuffer,
-                                      1,
-                                      0,
-                                      numSamplesInBlock);
+        for (int localIndex : module->localChannelIndices)
+            envelopes.add(appendChannel(inputs[localIndex], "envelope", "Multi-band integrator envelope of", "multiband.envelope"));
+
+        if (mode == OutputMode::APPEND_WITH_SUM)
+        {
+            for (int localIndex : module->localChannelIndices)
+                sums.add(appendChannel(inputs[localIndex], "band sum", "Weighted band sum of", "multiband.sum"));
         }
     }
+
+    module->setOutputChannels(envelopes, sums);
 }
 
-void MultiBandIntegrator::parameterValueChanged(Parameter* param)
+bool MultiBandIntegrator::getValidBandTable(std::vector<BandSpec>& bands)
 {
-    if (param->getName().equalsIgnoreCase("alpha_low"))
-    {
+    if (! parseBandTable(getParameter("bands")->getValue().toString().toStdString(), bands))
+        return false;
 
-        if (param->getValue() >= getParameter("alpha_high")->getValue())
+    // every band has to fit below the Nyquist frequency of every stream
+    for (auto stream : getDataStreams())
+    {
+        for (const BandSpec& band : bands)
         {
-            param->restorePreviousValue();
-            return;
+            if (band.highCut >= stream->getSampleRate() / 2)
+                return false;
         }
+    }
 
-        for (auto stream : getDataStreams())
+    return true;
+}
+
+void MultiBandIntegrator::setSelectedChannels(const DataStream* stream, const var& selection)
+{
+    Array<int> localIndices;
+    Array<const ContinuousChannel*> inputChannels;
+
+    if (Array<var>* array = selection.getArray())
+    {
+        Array<ContinuousChannel*> channels = stream->getContinuousChannels();
+
+        for (const var& value : *array)
         {
-            settings[stream->getStreamId()]->updateFilter(0,
-                                                          stream->getSampleRate(),
-                                                          param->getValue(),
-                                                          getParameter("alpha_high")->getValue());
+            const int localIndex = int(value);
+
+            if (localIndex >= 0 && localIndex < channels.size())
+            {
+                localIndices.add(localIndex);
+                inputChannels.add(channels[localIndex]);
+            }
         }
     }
-    else if (param->getName().equalsIgnoreCase("alpha_high"))
+
+    settings[stream->getStreamId()]->setChannels(localIndices, inputChannels);
+}
+
+void MultiBandIntegrator::process(AudioBuffer<float>& continuousBuffer)
+{
+    // everything used below is allocated in updateSettings() or when parameters change
+    AllocationTracker::RealtimeScope realtimeScope;
+
+    tasks.clear();
+    processedStreams.clear();
+    eventStreams.clear();
+    
+    for (auto stream : streams)
     {
+        MultiBandIntegratorSettings* module = settings[stream->getStreamId()];
+
+        // picks up settings published by the message thread since the last block
+        MultiBandIntegratorSnapshot* snapshot = module->acquireSnapshot();
+
+        const uint16 streamId = stream->getStreamId();
+        const uint32 numSamplesInBlock = getNumSamplesInBlock(streamId);
 
-        if (param->getValue() <= getParameter("alpha_low")->getValue())
+        // a stream that is not integrated outputs silence on its appended channels
+        if (snapshot == nullptr || ! snapshot->enabled || snapshot->firstChannels.back() == 0 || numSamplesInBlock == 0)
         {
-            param->restorePreviousValue();
-            return;
+            module->clearOutputChannels(continuousBuffer, int(numSamplesInBlock));
+
+            // a disabled stream ends its events, as nothing would end them later; an empty block
+            // leaves everything to the next one
+            if (snapshot != nullptr && numSamplesInBlock > 0)
+            {
+                for (IntegratorCore& core : snapshot->cores)
+                    core.skipBlock(! snapshot->enabled);
+
+                eventStreams.push_back({ snapshot, getFirstSampleNumberForBlock(streamId) });
+            }
+
+            continue;
         }
 
-        for (auto stream : getDataStreams())
+        const int numChannels = snapshot->firstChannels.back();
+
+        const int64 startTicks = Time::getHighResolutionTicks();
+
+        eventStreams.push_back({ snapshot, getFirstSampleNumberForBlock(streamId) });
+
+        // the integrated output overwrites the input channels unless it has channels of its own
+        for (int ch = 0; ch < numChannels; ch++)
         {
-            settings[stream->getStreamId()]->updateFilter(0,
-                                                          stream->getSampleRate(),
-                                                          getParameter("alpha_low")->getValue(),
-                                                          param->getValue());
+            const int inputIndex = snapshot->inputChannels[ch]->getGlobalIndex();
+            const int outputIndex = snapshot->envelopeChannels.empty()
+                                  ? inputIndex
+                                  : snapshot->envelopeChannels[ch]->getGlobalIndex();
+
+            snapshot->inputPointers[ch] = continuousBuffer.getReadPointer(inputIndex);
+            snapshot->channelPointers[ch] = continuousBuffer.getWritePointer(outputIndex);
+
+            if (! snapshot->sumChannels.empty())
+                snapshot->sumPointers[ch] = continuousBuffer.getWritePointer(snapshot->sumChannels[ch]->getGlobalIndex());
         }
-    } else if (param->getName().equalsIgnoreCase("alpha_gain"))
-    {
-        for (auto stream : getDataStreams())
+
+        for (int g = 0; g < int(snapshot->cores.size()); g++)
         {
-            settings[stream->getStreamId()]->alphaGain = float(param->getValue());
+            const int first = snapshot->firstChannels[g];
+
+            const float* const* inputs = snapshot->inputPointers.data() + first;
+            float* const* outputs = snapshot->channelPointers.data() + first;
+            float* const* sums = snapshot->sumChannels.empty() ? nullptr : snapshot->sumPointers.data() + first;
+
+            if (workerPool != nullptr)
+                tasks.push_back({ &snapshot->cores[g], inputs, outputs, sums, int(numSamplesInBlock) });
+            else
+                snapshot->cores[g].process(inputs, outputs, int(numSamplesInBlock), sums);
+        }
+
+        if (workerPool != nullptr)
+        {
+            processedStreams.push_back({ module, numSamplesInBlock, stream->getSampleRate() });
+            continue;
         }
-    } if (param->getName().equalsIgnoreCase("beta_low"))
+
+        // a block overruns if processing it took longer than the block lasts
+        const double seconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+
+        module->latency.record(uint64(seconds * 1e9),
+                               seconds * stream->getSampleRate() > double(numSamplesInBlock));
+    }
+
+    if (! tasks.empty())
     {
+        const int64 startTicks = Time::getHighResolutionTicks();
 
-        if (param->getValue() >= getParameter("beta_high")->getValue())
+        auto runTask = [this] (int index)
         {
-            param->restorePreviousValue();
-            return;
+            const ProcessTask& task = tasks[index];
+
+            task.core->process(task.inputs, task.outputs, task.numSamples, task.sums);
+        };
+
+        workerPool->run(int(tasks.size()), runTask);
+
+        // the streams are processed together, so each is charged the time of the whole batch
+        const double seconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+
+        for (const ProcessedStream& processed : processedStreams)
+        {
+            processed.module->latency.record(uint64(seconds * 1e9),
+                                             seconds * processed.sampleRate > double(processed.numSamples));
         }
+    }
 
-        for (auto stream : getDataStreams())
+    // processing must not touch the heap
+    jassert(! realtimeScope.hasTouchedHeap());
+
+    // the GUI allocates TTL events, so they are only created once the processing has been checked
+    for (const EventStream& eventStream : eventStreams)
+        addCrossingEvents(*eventStream.snapshot, eventStream.firstSampleNumber);
+}
+
+void MultiBandIntegrator::addCrossingEvents(MultiBandIntegratorSnapshot& snapshot, int64 firstSampleNumber)
+{
+    if (snapshot.eventChannel == nullptr)
+        return;
+
+    for (int line : snapshot.endingLines)
+    {
+        TTLEventPtr event = TTLEvent::createTTLEvent(snapshot.eventChannel, firstSampleNumber, uint8(line), false);
+
+        addEvent(event, 0);
+    }
+
+    snapshot.endingLines.clear();
+
+    for (int g = 0; g < int(snapshot.cores.size()); g++)
+    {
+        const ThresholdDetector& detector = snapshot.cores[g].getDetector();
+
+        for (int ch = 0; ch < detector.getNumChannels(); ch++)
         {
-            settings[stream->getStreamId()]->updateFilter(1,
-                                                          stream->getSampleRate(),
-                                                          param->getValue(),
-                                                          getParameter("beta_high")->getValue());
+            const int line = snapshot.firstChannels[g] + ch;
+
+            if (line >= MultiBandIntegratorSnapshot::maxEventLines)
+                return;
+
+            const ThresholdCrossing* crossings = detector.getCrossings(ch);
+
+            for (int i = 0; i < detector.getNumCrossings(ch); i++)
+            {
+                TTLEventPtr event = TTLEvent::createTTLEvent(snapshot.eventChannel,
+                                                             firstSampleNumber + crossings[i].sample,
+                                                             uint8(line),
+                                                             crossings[i].rising);
+
+                addEvent(event, crossings[i].sample);
+            }
         }
     }
-    else if (param->getName().equalsIgnoreCase("beta_high"))
+}
+
+void MultiBandIntegrator::parameterValueChanged(Parameter* param)
+{
+    if (param->getName().equalsIgnoreCase("bands"))
     {
+        std::vector<BandSpec> bands;
 
-        if (param->getValue() <= getParameter("beta_low")->getValue())
+        if (! getValidBandTable(bands))
         {
             param->restorePreviousValue();
             return;
@@ -328,144 +700,185 @@ void MultiBandIntegrator::parameterValueChanged(Parameter* param)
 
         for (auto stream : getDataStreams())
         {
-            settings[stream->getStreamId()]->updateFilter(1,
-                                                          stream->getSampleRate(),
-                                                          getParameter("beta_low")->getValue(),
-                                                          param->getValue());
+            settings[stream->getStreamId()]->setBands(stream->getSampleRate(), bands);
+            settings[stream->getStreamId()]->publish();
         }
-    } else if (param->getName().equalsIgnoreCase("beta_gain"))
+    }  else if (param->getName().equalsIgnoreCase("window_ms"))
     {
         for (auto stream : getDataStreams())
         {
-            settings[stream->getStreamId()]->betaGain = float(param->getValue());
+            settings[stream->getStreamId()]->setRollingWindowParameters(stream->getSampleRate(), param->getValue());
+            settings[stream->getStreamId()]->publish();
         }
-    }  if (param->getName().equalsIgnoreCase("delta_low"))
+    } else if (param->getName().equalsIgnoreCase("smoother"))
     {
-
-        if (param->getValue() >= getParameter("delta_high")->getValue())
+        for (auto stream : getDataStreams())
         {
-            param->restorePreviousValue();
-            return;
+            settings[stream->getStreamId()]->setSmoother(param->getValue());
+            settings[stream->getStreamId()]->publish();
         }
-
+    } else if (param->getName().equalsIgnoreCase("window_precision"))
+    {
         for (auto stream : getDataStreams())
         {
-            settings[stream->getStreamId()]->updateFilter(2,
-                                                          stream->getSampleRate(),
-                                                          param->getValue(),
-                                                          getParameter("delta_high")->getValue());
+            settings[stream->getStreamId()]->setWindowPrecision(param->getValue());
+            settings[stream->getStreamId()]->publish();
         }
-    }
-    else if (param->getName().equalsIgnoreCase("delta_high"))
+    } else if (param->getName().equalsIgnoreCase("sg_order") || param->getName().equalsIgnoreCase("sg_derivative")
+               || param->getName().equalsIgnoreCase("sg_lookahead_ms"))
     {
-
-        if (param->getValue() <= getParameter("delta_low")->getValue())
+        for (auto stream : getDataStreams())
         {
-            param->restorePreviousValue();
-            return;
+            settings[stream->getStreamId()]->setSavitzkyGolayParameters(stream->getSampleRate(),
+                                                                        getParameter("sg_order")->getValue(),
+                                                                        getParameter("sg_derivative")->getValue(),
+                                                                        getParameter("sg_lookahead_ms")->getValue());
+            settings[stream->getStreamId()]->publish();
         }
-
+    } else if (param->getName().equalsIgnoreCase("detect") || param->getName().equalsIgnoreCase("threshold")
+               || param->getName().equalsIgnoreCase("hysteresis") || param->getName().equalsIgnoreCase("refractory_ms"))
+    {
         for (auto stream : getDataStreams())
         {
-            settings[stream->getStreamId()]->updateFilter(2,
-                                                          stream->getSampleRate(),
-                                                          getParameter("delta_low")->getValue(),
-                                                          param->getValue());
+            settings[stream->getStreamId()]->setDetectorParameters(stream->getSampleRate(),
+                                                                   getParameter("detect")->getValue(),
+                                                                   getParameter("threshold")->getValue(),
+                                                                   getParameter("hysteresis")->getValue(),
+                                                                   getParameter("refractory_ms")->getValue());
+            settings[stream->getStreamId()]->publish();
         }
-    } else if (param->getName().equalsIgnoreCase("delta_gain"))
+    } else if (param->getName().equalsIgnoreCase("engine") || param->getName().equalsIgnoreCase("fft_hop"))
     {
         for (auto stream : getDataStreams())
         {
-            settings[stream->getStreamId()]->deltaGain = float(param->getValue());
+            settings[stream->getStreamId()]->setEngine(getParameter("engine")->getValue(), getParameter("fft_hop")->getValue());
+            settings[stream->getStreamId()]->publish();
         }
-    }  else if (param->getName().equalsIgnoreCase("window_ms"))
+    } else if (param->getName().equalsIgnoreCase("multirate"))
     {
         for (auto stream : getDataStreams())
         {
-            settings[stream->getStreamId()]->setRollingWindowParameters(stream->getSampleRate(), param->getValue());
+            settings[stream->getStreamId()]->setMultirate(param->getValue());
+            settings[stream->getStreamId()]->publish();
         }
+    } else if (param->getName().equalsIgnoreCase("threads"))
+    {
+        for (auto stream : getDataStreams())
+        {
+            settings[stream->getStreamId()]->setNumThreads(param->getValue());
+            settings[stream->getStreamId()]->publish();
+        }
+
+        updateWorkerPool();
+    } else if (param->getName().equalsIgnoreCase("output"))
+    {
+        // adds or removes the appended channels
+        CoreServices::updateSignalChain(getEditor());
     } else if (param->getName().equalsIgnoreCase("Channel"))
     {
-        Array<var>* array = param->getValue().getArray();
-        
-        if (array->size() > 0)
-            settings[param->getStreamId()]->localChannelIndex = int(array->getReference(0));
-        else
-            settings[param->getStreamId()]->localChannelIndex = -1;
+        // appended channels follow the selection, so the stream's channels have to be rebuilt,
+        // which cannot happen during acquisition
+        if (getOutputMode() != OutputMode::OVERWRITE)
+        {
+            if (CoreServices::getAcquisitionStatus())
+                param->restorePreviousValue();
+            else
+                CoreServices::updateSignalChain(getEditor());
+
+            return;
+        }
+
+        setSelectedChannels(getDataStream(param->getStreamId()), param->getValue());
+        settings[param->getStreamId()]->publish();
+    } else if (param->getName().equalsIgnoreCase("enable_stream"))
+    {
+        settings[param->getStreamId()]->enabled = bool(param->getValue());
+        settings[param->getStreamId()]->publish();
     }
 }
 
-RollingAverage::RollingAverage()
+void MultiBandIntegrator::loadCustomParametersFromXml(XmlElement* xml)
 {
-	setSize(1);
+    XmlElement* parameters = xml->getChildByName("GLOBAL_PARAMETERS");
 
-	// newSamples = 0;
-	// sum = 0;
-}
+    if (parameters == nullptr)
+        parameters = xml;
 
-void RollingAverage::setSize(int numSamples)
-{
-	buffer.clear();
-	buffer.insertMultiple(0, 0, numSamples);
-	index = 0;
+    if (parameters->hasAttribute("bands")
+        || ! (parameters->hasAttribute("alpha_low") || parameters->hasAttribute("beta_low") || parameters->hasAttribute("delta_low")))
+        return;
 
-	// sum = 0;
-}
+    // the three fixed bands had the same order as the default band table, and their
+    // defaults stand in for any value the file leaves out
+    const char* const names[] = { "alpha", "beta", "delta" };
 
-void RollingAverage::addSample(double sample)
-{
-	// sum -= buffer[index];
-	// sum += sample;
+    std::vector<BandSpec> bands;
+    parseBandTable(defaultBandTable, bands);
 
-	buffer.set(index, sample);
+    for (int i = 0; i < 3; i++)
+    {
+        const String name(names[i]);
 
-	index += 1;
-	index %= buffer.size();
-}
+        bands[i].lowCut = parameters->getDoubleAttribute(name + "_low", bands[i].lowCut);
+        bands[i].highCut = parameters->getDoubleAttribute(name + "_high", bands[i].highCut);
+        bands[i].gain = parameters->getDoubleAttribute(name + "_gain", bands[i].gain);
+    }
 
+    const std::string table = formatBandTable(bands);
 
-double RollingAverage::calculate() {
+    if (! parseBandTable(table, bands))
+    {
+        LOGC("Multi-Band Integrator: could not convert the saved alpha, beta and delta bands (", table, "); using ", defaultBandTable);
+        return;
+    }
 
-	// return sum / buffer.size();
+    LOGC("Multi-Band Integrator: converted the saved alpha, beta and delta bands to the band table ", table);
 
-    // v0.1_fixed
-    // int window_size = buffer.size();
-    
-    // double result = 0;
-    // double norm = 0;
-    
-    // for (int i = 0; i < window_size; i++) {
-    //     double x = i; // x 现在只从 0 到窗口大小 - 1 遍历，不再有负数
-    //     double weight = 1.0 + (1.0 + x * x);  // 直接使用二次多项式权重，更接近当前点的历史数据得到更大的权重
-        
-    //     // 取过去的历史数据，计算相应的加权值
-    //     int buf_index = (index + i) % window_size;
-    //     result += weight * buffer[buf_index];
-    //     norm += weight;
-    // }
+    getParameter("bands")->setNextValue(String(table));
+}
 
-    // return result / norm; // 返回加权平均值
-    
+String MultiBandIntegrator::handleConfigMessage(String msg)
+{
+    if (msg.equalsIgnoreCase("latency"))
+        return getLatencyReport();
 
-    // v0.2
-    static std::vector<double> weights;  // 静态权重数组，只计算一次
-    static double weight_sum = 0;
-
-    // 只在第一次调用或buffer大小改变时初始化权重
-    if (weights.size() != buffer.size()) {
-        weights.resize(buffer.size());
-        weight_sum = 0;
-        for (int i = 0; i < buffer.size(); i++) {
-            weights[i] = 1.0 + (1.0 + i * i); // 直接使用二次多项式权重，更接近当前点的历史数据得到更大的权重
-            weight_sum += weights[i];
-        }
+    if (msg.equalsIgnoreCase("latency reset"))
+    {
+        resetLatencyStatistics();
+        return "Latency statistics cleared";
     }
 
-    // 点乘计算
-    double result = 0;
-    for (int i = 0; i < buffer.size(); i++) {
-        result += buffer[(index + i) % buffer.size()] * weights[i];
+    return "";
+}
+
+LatencyHistogram::Statistics MultiBandIntegrator::getLatencyStatistics(uint16 streamId)
+{
+    return settings[streamId]->latency.getStatistics();
+}
+
+String MultiBandIntegrator::getLatencyReport()
+{
+    String report;
+
+    for (auto stream : getDataStreams())
+    {
+        const LatencyHistogram::Statistics statistics = getLatencyStatistics(stream->getStreamId());
+
+        report += stream->getName() + ": "
+                + String(int(statistics.numBlocks)) + " blocks, "
+                + "min " + String(statistics.minNs / 1000.0, 1) + " us, "
+                + "mean " + String(statistics.meanNs / 1000.0, 1) + " us, "
+                + "p50 " + String(statistics.p50Ns / 1000.0, 1) + " us, "
+                + "p99 " + String(statistics.p99Ns / 1000.0, 1) + " us, "
+                + "max " + String(statistics.maxNs / 1000.0, 1) + " us, "
+                + String(int(statistics.numOverruns)) + " overruns\n";
     }
 
-    return result / weight_sum; // 返回加权平均值
-}
\ No newline at end of file
+    return report;
+}
+
+void MultiBandIntegrator::resetLatencyStatistics()
+{
+    for (auto stream : getDataStreams())
+        settings[stream->getStreamId()]->latency.reset();
+}
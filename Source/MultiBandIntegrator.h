@@ -22,11 +22,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 
-/* The multi-band integrator allows the user to take a weighted sum of up to 3 frequency bands and apply a rolling average to build a power signal for complex waveforms with well-defined spectral properties. It was initially developed to detect absence-like seizures in real time from EEG recorded in awake, head-fixed mice. The user sets the duration of the rolling window and input channel, as well as frequency ranges and gains that define the waveform of interest. The processed signal is output on the same channel as the input channel. Two adjacent channels are overwritten with the initial raw input channel and the weighted summed signal before averaging to allow the user to fine-tune frequency ranges and gains on a per-animal basis.
+/* The multi-band integrator allows the user to take a weighted sum of several frequency bands and apply a rolling average to build a power signal for complex waveforms with well-defined spectral properties. It was initially developed to detect absence-like seizures in real time from EEG recorded in awake, head-fixed mice. The user sets the duration of the rolling window and input channels, as well as frequency ranges and gains that define the waveform of interest. By default each processed signal is output on the same channel as its input channel.
  
- Because channels are overwritten, I recommend using a split path in Open Ephys. One of the split paths includes the seizure detector followed by an LFP viewer to show how the input channel is being filtered. The other contains a second LFP viewer to show all of the channels without any multi-band integrator processing.
+ The output can instead be appended to the stream as new channels, leaving the inputs untouched, optionally together with the weighted summed signal before averaging to allow the user to fine-tune frequency ranges and gains on a per-animal basis. This makes a split path to keep the raw channels unnecessary.
  
- This plugin can be used with the third party crossing detector plugin to trigger events based on the processed output from the multi-band integrator.*/
+ Events can be triggered from the processed output either by the built-in threshold detector, which sends a TTL event on one line per channel while its envelope is above the threshold, or by the third party crossing detector plugin.*/
 
 
 #ifndef MULTIBAND_INTEGRATOR_H_INCLUDED
@@ -38,44 +38,74 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 
 #include <ProcessorHeaders.h>
-#include <algorithm> // max
+#include "AllocationTracker.h"
+#include "BandTable.h"
+#include "IntegratorCore.h"
+#include "LatencyHistogram.h"
+#include "RcuPointer.h"
+#include "WorkerPool.h"
+#include <memory>
+#include <vector>
 
 
 
+/** Where the envelopes are written */
+enum class OutputMode
+{
+    OVERWRITE,          // over the selected input channels
+    APPEND,             // to a new channel per selected channel
+    APPEND_WITH_SUM     // likewise, followed by a channel per selected channel for its weighted band sum
+};
+
 /**
-    Computes the rolling average of a signal.
+    Everything process() needs for one stream. Snapshots are built on the message
+    thread and their settings never change once they have been published.
  */
-class RollingAverage
+struct MultiBandIntegratorSnapshot
 {
-public:
-    
-    /** Constructor */
-	RollingAverage();
-    
-    /** Destructor */
-    ~RollingAverage() { }
+    /** Filters, band sum and rolling windows, one core per group of selected channels */
+    std::vector<IntegratorCore> cores;
 
-    /** Sets the size of the buffer */
-	void setSize(int numSamples);
-    
-    /** Adds a sample to the buffer*/
-	void addSample(double sample);
-    
-    /** Returns the average of the current buffer*/
-	double calculate();
+    /** First channel of each core's group, followed by the number of channels */
+    std::vector<int> firstChannels;
 
-private:
+    /** Each integrated channel; its buffer index is looked up by process(), as appending
+        channels can renumber the channels of the streams that follow */
+    std::vector<const ContinuousChannel*> inputChannels;
 
-	Array<double> buffer;
-	int index;
+    /** Appended channels for the envelopes and the band sums, empty if they are not output */
+    std::vector<const ContinuousChannel*> envelopeChannels;
+    std::vector<const ContinuousChannel*> sumChannels;
 
-	double sum;
-	int newSamples;
-	double lastAvg;
-};
+    /** Buffer pointers for each integrated channel's input, envelope and band sum (filled in by process()) */
+    std::vector<const float*> inputPointers;
+    std::vector<float*> channelPointers;
+    std::vector<float*> sumPointers;
+
+    /** TTL channel that threshold crossings are sent on, one line per integrated channel */
+    EventChannel* eventChannel;
+
+    /** Lines with an event in progress in the snapshot this one replaced that this one could not
+        take over, as the channels were grouped differently; each is ended at the start of the
+        next block. Filled in on the processing thread, into room reserved by publish(). */
+    std::vector<int> endingLines;
 
+    /** Number of TTL lines of an event channel; channels past the last line are not reported */
+    static const int maxEventLines = 256;
 
-/** Holds settings for one stream's multi-band integrator */
+    bool enabled;
+};
+
+/**
+    Holds settings for one stream's multi-band integrator.
+
+    The settings are only changed on the message thread. Each change is applied
+    by building a new snapshot and publishing it to the processing thread, which
+    switches to it at the start of its next block and carries over the filter
+    and window state that is still valid. The rolling windows, which hold most
+    of a snapshot's memory, are only built for a snapshot that changes them;
+    otherwise the new snapshot takes over the old one's.
+ */
 class MultiBandIntegratorSettings
 {
 public:
@@ -84,39 +114,125 @@ public:
 
     /** Destructor*/
     ~MultiBandIntegratorSettings() { }
+
+    /** Sets the channels to integrate */
+    void setChannels(const Array<int>& localIndices, const Array<const ContinuousChannel*>& channels);
     
-    /** Updates filter parameters */
-    void updateFilter(int index,
-                      float sampleRate,
-                      var lowCut,
-                      var highCut);
+    /** Replaces the band table, designing the filters for the stream's sample rate */
+    void setBands(float sampleRate, const std::vector<BandSpec>& bands);
 
     /** Updates rolling window parameters*/
     void setRollingWindowParameters(float sampleRate, var durationMs);
 
-    OwnedArray<Dsp::Filter> filters;
-    
-    RollingAverage rollingAverage;
+    /** Selects the weighting of the rolling window ("smoother" parameter index) */
+    void setSmoother(int smootherIndex);
 
-    int localChannelIndex;
-    
-    float alphaGain;
-    float betaGain;
-    float deltaGain;
+    /** Selects the precision of the rolling window's stored samples ("window_precision" parameter index) */
+    void setWindowPrecision(int precisionIndex);
+
+    /** Sets the polynomial order, derivative and lookahead of the Savitzky-Golay smoother */
+    void setSavitzkyGolayParameters(float sampleRate, int order, int derivative, var lookaheadMs);
+
+    /** Sets the channels appended to the stream for the envelopes and band sums (empty if not output) */
+    void setOutputChannels(const Array<const ContinuousChannel*>& envelopes, const Array<const ContinuousChannel*>& sums);
+
+    /** Zeroes the appended channels for a block that is not integrated, as they would otherwise
+        carry whatever the buffer held (processing thread; they only change while acquisition is stopped) */
+    void clearOutputChannels(AudioBuffer<float>& buffer, int numSamples) const;
+
+    /** Sets the threshold detection applied to the envelopes */
+    void setDetectorParameters(float sampleRate, bool enabled, float threshold, float hysteresis, var refractoryMs);
+
+    /** Selects the filter engine ("engine" parameter index) and the FFT engine's hop size */
+    void setEngine(int engineIndex, int hopSize);
+
+    /** Enables filtering and averaging at a reduced rate chosen from the highest band edge */
+    void setMultirate(bool multirate);
+
+    /** Sets the number of threads that process() spreads the channels over */
+    void setNumThreads(int numThreads);
+
+    /** Builds a snapshot of the current settings and hands it to the processing thread */
+    void publish();
+
+    /** Returns true if the FFT engine is selected but the last snapshot filters with the IIR
+        engine instead, because the FFT engine was not expected to keep up, or its kernel would
+        cut off the bands' response (see IntegratorCore::maxFftTruncationError) */
+    bool isFftEngineDeclined() const { return fftDeclined; }
+
+    /** Largest share of each processing thread the FFT engine may be estimated to take
+        (from IntegratorCore::getEstimatedFftCost()); above it, the IIR engine is used */
+    static constexpr double maxFftLoad = 0.5;
+
+    /** Returns the snapshot to process with (processing thread only) */
+    MultiBandIntegratorSnapshot* acquireSnapshot();
+
+    /** Deletes the snapshots the processing thread has switched away from (message thread only) */
+    void reclaim();
+
+    /** Returns the number of channels being integrated */
+    int getNumChannels() const { return localChannelIndices.size(); }
+
+    /** Local (within-stream) index of each integrated channel */
+    Array<int> localChannelIndices;
+
+    /** Each integrated channel */
+    Array<const ContinuousChannel*> inputChannels;
+
+    /** Cached value of the stream's "enable_stream" parameter */
+    bool enabled;
+
+    /** TTL channel created for the stream's threshold crossings by updateSettings() */
+    EventChannel* eventChannel;
+
+    /** Time taken by process() for each block of this stream */
+    LatencyHistogram latency;
+
+private:
+
+    float sampleRate;
+    std::vector<BandSpec> bands;
+
+    Array<const ContinuousChannel*> envelopeChannels;
+    Array<const ContinuousChannel*> sumChannels;
+
+    int windowSamples;
+    WindowProfile windowProfile;
+    WindowStorage windowStorage;
+    SavitzkyGolayShape savitzkyGolayShape;
+
+    DetectorSettings detectorSettings;
+
+    FilterEngine engine;
+    int fftHopSize;
+    bool fftDeclined;
+
+    bool multirate;
+
+    int numThreads;
+
+    /** Hands the state of a snapshot to the one replacing it: on the processing thread when it
+        switches snapshots, or on the message thread for a snapshot replaced before it was used */
+    static void adoptState(MultiBandIntegratorSnapshot& next, MultiBandIntegratorSnapshot& previous);
+
+    RcuPointer<MultiBandIntegratorSnapshot> snapshot;
 };
 
 /**
  
- Computes a weighted sum of up to 3 frequency bands and applies a rolling average to build a power signal
+ Computes a weighted sum of any number of frequency bands and applies a rolling average to build a power signal
  for complex waveforms with well-defined spectral properties.
  
  It was initially developed to detect absence-like seizures in real time from EEG recorded in awake, head-fixed mice.
  
  The user sets the duration of the rolling as well as frequency ranges and gains that define
- the waveform of interest. The processed signals are output on the input channels that have been selected.
+ the waveform of interest. The processed signals are output on the input channels that have been selected,
+ or on new channels appended to their stream, and threshold crossings of the processed signals can be sent
+ as TTL events.
  
  */
-class MultiBandIntegrator : public GenericProcessor
+class MultiBandIntegrator : public GenericProcessor,
+                            private Timer
 {
     friend class MultiBandIntegratorEditor;
 
@@ -126,7 +242,7 @@ public:
     MultiBandIntegrator();
     
     /** Destructor */
-    ~MultiBandIntegrator() { }
+    ~MultiBandIntegrator();
     
     /** Creates the custom editor for this plugin */
     AudioProcessorEditor* createEditor() override;
@@ -140,11 +256,90 @@ public:
     /** Called whenever a parameter's value is changed (called by GenericProcessor::setParameter())*/
     void parameterValueChanged(Parameter* param) override;
 
+    /** Responds to "latency" (returns the latency report) and "latency reset" */
+    String handleConfigMessage(String msg) override;
+
+    /** Converts the alpha_*, beta_* and delta_* parameters of settings saved before the
+        band table into the "bands" parameter */
+    void loadCustomParametersFromXml(XmlElement* xml) override;
+
+    /** Returns the block processing times of one stream */
+    LatencyHistogram::Statistics getLatencyStatistics(uint16 streamId);
+
+    /** Returns a summary of the block processing times of every stream, one line per stream */
+    String getLatencyReport();
+
+    /** Clears the block processing times of every stream */
+    void resetLatencyStatistics();
+
 private:
+
+    /** Parses the "bands" parameter; returns false if it is malformed or a band does not fit below
+        the Nyquist frequency of every stream */
+    bool getValidBandTable(std::vector<BandSpec>& bands);
+
+    /** Applies a "Channel" parameter value to a stream's settings */
+    void setSelectedChannels(const DataStream* stream, const var& selection);
+
+    /** Creates the worker pool for the "threads" parameter (none for one thread) and
+        reserves room for the tasks of every stream */
+    void updateWorkerPool();
+
+    /** Returns the "output" parameter */
+    OutputMode getOutputMode();
+
+    /** Appends the output channels of one stream if the output mode asks for them */
+    void addOutputChannels(const DataStream* stream);
+
+    /** Deletes the snapshots every stream has finished with (message thread) */
+    void timerCallback() override;
+
+    /** Interval at which timerCallback() reclaims snapshots */
+    static const int reclaimIntervalMs = 200;
+
+    /** Sends the threshold crossings of a stream's last block, and the ends of the events its
+        snapshot could not take over, as TTL events */
+    void addCrossingEvents(MultiBandIntegratorSnapshot& snapshot, int64 firstSampleNumber);
+
+    /** One group of channels of one stream, run by the worker pool */
+    struct ProcessTask
+    {
+        IntegratorCore* core;
+        const float* const* inputs;
+        float* const* outputs;
+        float* const* sums;
+        int numSamples;
+    };
     
     StreamSettings<MultiBandIntegratorSettings> settings;
 
-    AudioBuffer<float> scratchBuffer;
+    /** Threads that share the work of process(), or null to process on the calling thread only */
+    std::unique_ptr<WorkerPool> workerPool;
+
+    /** Tasks of the current block, with capacity for every group of every stream */
+    std::vector<ProcessTask> tasks;
+
+    /** A stream given tasks in the current block, whose processing time is recorded afterwards */
+    struct ProcessedStream
+    {
+        MultiBandIntegratorSettings* module;
+        uint32 numSamples;
+        double sampleRate;
+    };
+
+    std::vector<ProcessedStream> processedStreams;
+
+    /** A stream processed in the current block, whose threshold crossings are sent afterwards */
+    struct EventStream
+    {
+        MultiBandIntegratorSnapshot* snapshot;
+        int64 firstSampleNumber;
+    };
+
+    std::vector<EventStream> eventStreams;
+
+    /** Streams handled by process(), cached by updateSettings() */
+    Array<const DataStream*> streams;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MultiBandIntegrator);
 };
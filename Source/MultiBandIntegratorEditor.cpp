@@ -23,15 +23,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "MultiBandIntegratorEditor.h"
 #include "MultiBandIntegrator.h"
 
-CustomLabel::CustomLabel(Parameter* param, Colour colour) : ParameterEditor(param)
+BandTableEditor::BandTableEditor(Parameter* param) : ParameterEditor(param)
 {
     label.addListener(this);
-    label.setBounds(0, 0, 40, 15);
+    label.setBounds(0, 0, 120, 40);
     label.setEditable(true);
-    label.setColour(Label::backgroundColourId, colour);
+    label.setJustificationType(Justification::topLeft);
+    label.setColour(Label::backgroundColourId, Colour(30,30,30));
     label.setColour(Label::textColourId, Colour(200,200,200));
+    label.setTooltip(param->getDescription());
     addAndMakeVisible(&label);
-    setBounds(0, 0, 40, 15);
+    setBounds(0, 0, 120, 40);
 }
 
 
@@ -41,51 +43,85 @@ void BackgroundComponent::paint(Graphics& g)
     g.fillRoundedRectangle(115, 25, 130, 65, 3.0f);
     
     g.setColour(Colours::darkgrey);
-    g.drawText("low", 120, 12, 40, 10, Justification::centred);
-    g.drawText("high", 160, 12, 40, 10, Justification::centred);
-    g.drawText("gain", 200, 12, 40, 10, Justification::centred);
-    
-    g.drawText(CharPointer_UTF8("α"), 103, 32, 50, 10, Justification::left);
-    g.drawText(CharPointer_UTF8("β"), 103, 52, 50, 10, Justification::left);
-    g.drawText(CharPointer_UTF8("δ"), 103, 72, 50, 10, Justification::left);
-    
-    
+    g.drawText("bands", 120, 12, 120, 10, Justification::left);
+    g.drawText("low:high:gain[:order]", 120, 72, 120, 10, Justification::left);
 }
 
 MultiBandIntegratorEditor::MultiBandIntegratorEditor(GenericProcessor* parentNode)
-    : GenericEditor(parentNode)
+    : GenericEditor(parentNode),
+      latencyLabel("Latency", ""),
+      dumpButton("dump", Font("Small Text", 12, Font::plain))
 {
-	desiredWidth = 254;
+	desiredWidth = 850;
     
     addAndMakeVisible(&backgroundComponent);
     backgroundComponent.setBounds(0, 25, 250, 140);
 
     addSelectedChannelsParameterEditor("Channel", 15, 43);
     addTextBoxParameterEditor("window_ms", 15, 74);
+
+    addComboBoxParameterEditor("engine", 255, 29);
+    addTextBoxParameterEditor("fft_hop", 255, 74);
+    addCheckBoxParameterEditor("multirate", 340, 29);
+    addTextBoxParameterEditor("threads", 340, 74);
+    addComboBoxParameterEditor("smoother", 425, 29);
+    addComboBoxParameterEditor("window_precision", 425, 74);
+    addTextBoxParameterEditor("sg_order", 510, 29);
+    addTextBoxParameterEditor("sg_derivative", 510, 74);
+    addTextBoxParameterEditor("sg_lookahead_ms", 595, 29);
+    addCheckBoxParameterEditor("detect", 595, 74);
+    addTextBoxParameterEditor("threshold", 680, 29);
+    addTextBoxParameterEditor("hysteresis", 680, 74);
+    addTextBoxParameterEditor("refractory_ms", 765, 29);
+    addComboBoxParameterEditor("output", 765, 74);
     
-    Colour alphaColour = Colour(30,30,30);
-    Colour betaColour = Colour(60,60,60);
-    Colour deltaColour = Colour(90,90,90);
-    
-    Parameter* param = getProcessor()->getParameter("alpha_low");
-    addCustomParameterEditor(new CustomLabel(param, alphaColour), 120, 55);
-    param = getProcessor()->getParameter("alpha_high");
-    addCustomParameterEditor(new CustomLabel(param, alphaColour), 160, 55);
-    param = getProcessor()->getParameter("alpha_gain");
-    addCustomParameterEditor(new CustomLabel(param, alphaColour), 200, 55);
-    
-    param = getProcessor()->getParameter("beta_low");
-    addCustomParameterEditor(new CustomLabel(param, betaColour), 120, 75);
-    param = getProcessor()->getParameter("beta_high");
-    addCustomParameterEditor(new CustomLabel(param, betaColour), 160, 75);
-    param = getProcessor()->getParameter("beta_gain");
-    addCustomParameterEditor(new CustomLabel(param, betaColour), 200, 75);
-    
-    param = getProcessor()->getParameter("delta_low");
-    addCustomParameterEditor(new CustomLabel(param, deltaColour), 120, 95);
-    param = getProcessor()->getParameter("delta_high");
-    addCustomParameterEditor(new CustomLabel(param, deltaColour), 160, 95);
-    param = getProcessor()->getParameter("delta_gain");
-    addCustomParameterEditor(new CustomLabel(param, deltaColour), 200, 95);
+    Parameter* param = getProcessor()->getParameter("bands");
+    addCustomParameterEditor(new BandTableEditor(param), 120, 55);
+
+    latencyLabel.setFont(Font("Small Text", 11, Font::plain));
+    latencyLabel.setColour(Label::textColourId, Colours::darkgrey);
+    latencyLabel.setTooltip("99th percentile block processing time and blocks that overran");
+    latencyLabel.setBounds(10, 118, 130, 15);
+    addAndMakeVisible(&latencyLabel);
+
+    dumpButton.setRadius(3.0f);
+    dumpButton.setTooltip("Print block processing times of every stream to the console");
+    dumpButton.addListener(this);
+    dumpButton.setBounds(200, 118, 40, 15);
+    addAndMakeVisible(&dumpButton);
+
+}
+
+void MultiBandIntegratorEditor::startAcquisition()
+{
+    MultiBandIntegrator* processor = (MultiBandIntegrator*) getProcessor();
+    processor->resetLatencyStatistics();
+
+    startTimer(500);
+}
+
+void MultiBandIntegratorEditor::stopAcquisition()
+{
+    stopTimer();
+}
+
+void MultiBandIntegratorEditor::buttonClicked(Button* button)
+{
+    if (button == &dumpButton)
+    {
+        MultiBandIntegrator* processor = (MultiBandIntegrator*) getProcessor();
+
+        LOGC("Multi-Band Integrator block processing times:\n", processor->getLatencyReport());
+    }
+}
+
+void MultiBandIntegratorEditor::timerCallback()
+{
+    MultiBandIntegrator* processor = (MultiBandIntegrator*) getProcessor();
+
+    const LatencyHistogram::Statistics statistics = processor->getLatencyStatistics(getCurrentStream());
 
+    latencyLabel.setText("p99 " + String(statistics.p99Ns / 1000.0, 0) + " us, "
+                         + String(int(statistics.numOverruns)) + " over",
+                         dontSendNotification);
 }
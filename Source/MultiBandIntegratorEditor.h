@@ -31,21 +31,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <algorithm>
 
 
-class CustomLabel
+/** Edits the "bands" table as text; invalid tables are rejected by the processor */
+class BandTableEditor
     : public ParameterEditor,
       public Label::Listener
 {
 public:
     /** Constructor*/
-    CustomLabel(Parameter* param, Colour colour);
+    BandTableEditor(Parameter* param);
 
     /** Destructor */
-    ~CustomLabel() { }
+    ~BandTableEditor() { }
 
     /** Respond to text input*/
     void labelTextChanged(Label*)
     {
-        param->setNextValue(label.getText().getFloatValue());
+        param->setNextValue(label.getText());
     }
 
     /** Updates the view*/
@@ -70,14 +71,23 @@ public:
 
 /**
 Editor (in signal chain) contains:
-- Input channel selector (filtered output will appear on this channel as well)
-- Rolling window duration (ms)
-- Low-cut and High-cut frequencies for 3 frequency bands of interest
-- Gains for each frequency band
+- Input channel selector (filtered output will appear on this channel as well, unless it is appended)
+- Rolling window duration (ms) and weighting (rectangular, quadratic, exponential, Savitzky-Golay or cascaded IIR)
+- Precision of the rolling window's stored samples (double, float, int32 or int16)
+- Polynomial order, derivative and lookahead (ms) of the Savitzky-Golay smoother
+- Output: over the input channels, or on new channels appended to the stream, optionally with the band sums
+- Threshold detection: TTL events while each envelope is above a threshold, with hysteresis and a refractory period
+- Band table: low-cut and high-cut frequency, gain and filter order of each band of interest
+- Filter engine (IIR or FFT) and the FFT engine's hop size
+- Multirate processing (filters and window at a reduced sample rate)
+- Number of threads that share the processing of each block
+- Block processing time of the selected stream, and a button to dump it for every stream
 */
 
 class MultiBandIntegratorEditor
-	: public GenericEditor
+	: public GenericEditor,
+      public Button::Listener,
+      public Timer
 {
 public:
     
@@ -86,10 +96,27 @@ public:
     
     /** Destructor */
     ~MultiBandIntegratorEditor() { }
+
+    /** Starts showing block processing times */
+    void startAcquisition() override;
+
+    /** Stops updating block processing times */
+    void stopAcquisition() override;
+
+    /** Dumps the latency report to the console */
+    void buttonClicked(Button* button) override;
+
+    /** Shows the latest block processing times */
+    void timerCallback() override;
     
 private:
     
     BackgroundComponent backgroundComponent;
+
+    /** p99 block processing time and number of overruns of the current stream */
+    Label latencyLabel;
+
+    UtilityButton dumpButton;
 };
 
 
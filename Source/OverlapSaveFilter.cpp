@@ -0,0 +1,227 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "OverlapSaveFilter.h"
+
+#include <algorithm>
+#include <cstring>
+
+OverlapSaveFilter::OverlapSaveFilter() :
+    hopSize(1),
+    kernelLength(1),
+    numPartitions(1),
+    numChannels(0),
+    position(0),
+    newestSpectrum(0),
+    stateDeferred(false)
+{
+    setKernel(std::vector<double>(1, 1.0), 1);
+}
+
+void OverlapSaveFilter::setKernel(const std::vector<double>& impulseResponse, int hopSize_)
+{
+    hopSize = Fft::getNextPowerOfTwo(std::max(hopSize_, 1));
+    kernelLength = std::max(int(impulseResponse.size()), 1);
+    numPartitions = (kernelLength + hopSize - 1) / hopSize;
+
+    const int fftSize = 2 * hopSize;
+
+    fft.setSize(fftSize);
+
+    kernelSpectra.assign(size_t(numPartitions) * fftSize, Fft::Complex());
+
+    for (int partition = 0; partition < numPartitions; partition++)
+    {
+        Fft::Complex* spectrum = kernelSpectra.data() + size_t(partition) * fftSize;
+
+        const int first = partition * hopSize;
+        const int last = std::min(first + hopSize, int(impulseResponse.size()));
+
+        for (int i = first; i < last; i++)
+            spectrum[i - first] = impulseResponse[i];
+
+        fft.forward(spectrum);
+    }
+
+    workspace.resize(fftSize);
+    accumulator.resize(fftSize);
+
+    setNumChannels(numChannels);
+}
+
+void OverlapSaveFilter::setNumChannels(int numChannels_)
+{
+    numChannels = std::max(numChannels_, 0);
+
+    const int numPairs = (numChannels + 1) / 2;
+    const int fftSize = 2 * hopSize;
+
+    if (! stateDeferred)
+    {
+        history.resize(size_t(numChannels) * fftSize);
+        inputSpectra.resize(size_t(numPairs) * numPartitions * fftSize);
+        pendingOutput.resize(size_t(numChannels) * hopSize);
+    }
+
+    reset();
+}
+
+void OverlapSaveFilter::reset()
+{
+    std::fill(history.begin(), history.end(), 0.0);
+    std::fill(inputSpectra.begin(), inputSpectra.end(), Fft::Complex());
+    std::fill(pendingOutput.begin(), pendingOutput.end(), 0.0f);
+
+    position = 0;
+    newestSpectrum = 0;
+}
+
+bool OverlapSaveFilter::takeStateFrom(OverlapSaveFilter& other)
+{
+    if (! hasSameLayout(other) || other.numChannels != numChannels)
+        return false;
+
+    history.swap(other.history);
+    inputSpectra.swap(other.inputSpectra);
+    pendingOutput.swap(other.pendingOutput);
+    std::swap(stateDeferred, other.stateDeferred);
+
+    position = other.position;
+    newestSpectrum = other.newestSpectrum;
+
+    return true;
+}
+
+bool OverlapSaveFilter::hasSameLayout(const OverlapSaveFilter& other) const
+{
+    return other.hopSize == hopSize && other.numPartitions == numPartitions;
+}
+
+void OverlapSaveFilter::process(const float* const* input, float* const* output, int numSamples)
+{
+    if (stateDeferred)
+    {
+        for (int ch = 0; ch < numChannels; ch++)
+            std::fill(output[ch], output[ch] + numSamples, 0.0f);
+
+        return;
+    }
+
+    const int fftSize = 2 * hopSize;
+
+    int done = 0;
+
+    while (done < numSamples)
+    {
+        const int numSamplesInSegment = std::min(numSamples - done, hopSize - position);
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            double* newest = history.data() + size_t(ch) * fftSize + hopSize + position;
+            const float* pending = pendingOutput.data() + size_t(ch) * hopSize + position;
+
+            const float* source = input[ch] + done;
+            float* destination = output[ch] + done;
+
+            // read before writing, so that input and output may alias
+            for (int i = 0; i < numSamplesInSegment; i++)
+            {
+                newest[i] = source[i];
+                destination[i] = pending[i];
+            }
+        }
+
+        position += numSamplesInSegment;
+        done += numSamplesInSegment;
+
+        if (position == hopSize)
+        {
+            transform();
+            position = 0;
+        }
+    }
+}
+
+void OverlapSaveFilter::transform()
+{
+    const int fftSize = 2 * hopSize;
+
+    Fft::Complex* work = workspace.data();
+    Fft::Complex* sum = accumulator.data();
+
+    for (int first = 0; first < numChannels; first += 2)
+    {
+        const bool hasPair = first + 1 < numChannels;
+
+        double* a = history.data() + size_t(first) * fftSize;
+        double* b = hasPair ? a + fftSize : nullptr;
+
+        Fft::Complex* spectra = inputSpectra.data() + size_t(first / 2) * numPartitions * fftSize;
+        Fft::Complex* newest = spectra + size_t(newestSpectrum) * fftSize;
+
+        for (int i = 0; i < fftSize; i++)
+            newest[i] = Fft::Complex(a[i], hasPair ? b[i] : 0.0);
+
+        fft.forward(newest);
+
+        std::fill(sum, sum + fftSize, Fft::Complex());
+
+        // partition p of the kernel meets the input from p hops ago
+        for (int partition = 0; partition < numPartitions; partition++)
+        {
+            const int slot = (newestSpectrum - partition + numPartitions) % numPartitions;
+
+            const Fft::Complex* x = spectra + size_t(slot) * fftSize;
+            const Fft::Complex* h = kernelSpectra.data() + size_t(partition) * fftSize;
+
+            for (int k = 0; k < fftSize; k++)
+            {
+                sum[k] = Fft::Complex(sum[k].real() + x[k].real() * h[k].real() - x[k].imag() * h[k].imag(),
+                                      sum[k].imag() + x[k].real() * h[k].imag() + x[k].imag() * h[k].real());
+            }
+        }
+
+        std::copy(sum, sum + fftSize, work);
+        fft.inverse(work);
+
+        // the kernel is real, so the two channels come back in the real and imaginary parts
+        float* outA = pendingOutput.data() + size_t(first) * hopSize;
+
+        for (int i = 0; i < hopSize; i++)
+            outA[i] = float(work[hopSize + i].real());
+
+        std::memcpy(a, a + hopSize, sizeof(double) * hopSize);
+
+        if (hasPair)
+        {
+            float* outB = outA + hopSize;
+
+            for (int i = 0; i < hopSize; i++)
+                outB[i] = float(work[hopSize + i].imag());
+
+            std::memcpy(b, b + hopSize, sizeof(double) * hopSize);
+        }
+    }
+
+    newestSpectrum = (newestSpectrum + 1) % numPartitions;
+}
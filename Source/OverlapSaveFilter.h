@@ -0,0 +1,124 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef OVERLAP_SAVE_FILTER_H_INCLUDED
+#define OVERLAP_SAVE_FILTER_H_INCLUDED
+
+#include "Fft.h"
+
+#include <vector>
+
+/**
+    Streaming FIR filter for many channels, using uniformly partitioned FFT overlap-save.
+
+    Every channel is convolved with the same impulse response, which is cut into
+    partitions of one hop each. Each hop of input is transformed once (together
+    with the previous hop), and the output spectrum is the sum of the last
+    transforms multiplied by the spectra of the matching partitions. Two channels
+    share each transform, one in the real and one in the imaginary part. The
+    output is delayed by one hop, whatever the length of the kernel, and the
+    cost does not depend on how many bands were folded into the kernel.
+ */
+class OverlapSaveFilter
+{
+public:
+
+    /** Constructor */
+    OverlapSaveFilter();
+
+    /** Destructor */
+    ~OverlapSaveFilter() { }
+
+    /** Sets the impulse response and the number of samples per transform, clearing all state */
+    void setKernel(const std::vector<double>& impulseResponse, int hopSize);
+
+    /** Sets the number of channels, clearing all state */
+    void setNumChannels(int numChannels);
+
+    /** Clears the input history, spectra and pending output */
+    void reset();
+
+    /** Exchanges state with another filter with the same hop, number of partitions and channels.
+        Never allocates. Returns true if the state was taken. */
+    bool takeStateFrom(OverlapSaveFilter& other);
+
+    /** Returns true if the filters have the same hop and number of partitions, so that
+        takeStateFrom() succeeds between them once they have as many channels */
+    bool hasSameLayout(const OverlapSaveFilter& other) const;
+
+    /** Leaves the input history and spectra unallocated, for a filter that takes them over
+        from one with the same layout and channels before it runs; until then it outputs
+        silence. Call before setNumChannels(). */
+    void deferState() { stateDeferred = true; }
+
+    /** Filters each input channel into the matching output channel, one hop late.
+        Input and output may point to the same memory. */
+    void process(const float* const* input, float* const* output, int numSamples);
+
+    /** Returns the delay of the output, in samples */
+    int getLatency() const { return hopSize; }
+
+    /** Returns the number of taps of the kernel */
+    int getKernelLength() const { return kernelLength; }
+
+    int getNumChannels() const { return numChannels; }
+
+private:
+
+    /** Filters the latest hop of every channel into the pending output */
+    void transform();
+
+    /** Transform of two hops */
+    Fft fft;
+
+    int hopSize;
+    int kernelLength;
+    int numPartitions;
+    int numChannels;
+
+    /** Samples of the current hop received so far */
+    int position;
+
+    /** Slot of the delay line that receives the next input spectrum */
+    int newestSpectrum;
+
+    /** Spectrum of each partition of the kernel */
+    std::vector<Fft::Complex> kernelSpectra;
+
+    /** Input spectra of the last numPartitions hops of each channel pair (frequency-domain delay line) */
+    std::vector<Fft::Complex> inputSpectra;
+
+    std::vector<Fft::Complex> workspace;
+    std::vector<Fft::Complex> accumulator;
+
+    /** Last two hops of input of each channel */
+    std::vector<double> history;
+
+    /** Output of the last transform, hopSize samples per channel, released during the current hop */
+    std::vector<float> pendingOutput;
+
+    /** True while the history, spectra and pending output wait to be taken over (see deferState()) */
+    bool stateDeferred;
+};
+
+#endif
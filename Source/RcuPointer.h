@@ -0,0 +1,157 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RCU_POINTER_H_INCLUDED
+#define RCU_POINTER_H_INCLUDED
+
+#include <atomic>
+#include <memory>
+
+/**
+    Hands immutable snapshots from the message thread to the processing thread.
+
+    The message thread builds a complete new object and publishes it with a
+    single atomic exchange. The processing thread picks it up at the start of
+    its next block and retires the object it was using onto a lock-free list.
+    Retired objects are deleted when the message thread next publishes or calls
+    reclaim(), which its owner does from a timer, so the processing thread never
+    allocates or frees memory and a retired object does not stay resident until
+    the next change of settings.
+
+    There must be one publishing thread and one processing thread.
+ */
+template <class T>
+class RcuPointer
+{
+public:
+
+    /** Constructor */
+    RcuPointer() : published(nullptr), active(nullptr), pending(nullptr), retired(nullptr) { }
+
+    /** Destructor -- must not run while the processing thread is using the pointer */
+    ~RcuPointer()
+    {
+        delete pending.exchange(nullptr);
+        delete active;
+
+        reclaim();
+    }
+
+    /** Makes a new object current from the next acquire(). Called on the message thread.
+        If the object published before it was never picked up, adopt(object, dropped) is
+        called first, so that the new object can take over whatever the dropped one held. */
+    template <class Adopt>
+    void publish(std::unique_ptr<T> object, Adopt&& adopt)
+    {
+        Node* node = new Node(std::move(object));
+
+        // an object that was never picked up is taken back before the new one is visible, so the
+        // processing thread sees neither while one hands over to the other; the exchange decides
+        // who owns it
+        if (Node* dropped = pending.exchange(nullptr, std::memory_order_acq_rel))
+        {
+            adopt(*node->object, *dropped->object);
+            delete dropped;
+        }
+
+        published = node->object.get();
+        pending.store(node, std::memory_order_release);
+
+        reclaim();
+    }
+
+    /** Returns the object published last, or nullptr. Called on the message thread, which may
+        read what the processing thread does not change until the next publish(). */
+    const T* getPublished() const { return published; }
+
+    /** Deletes every object the processing thread has finished with. Called on the message thread. */
+    void reclaim()
+    {
+        Node* node = retired.exchange(nullptr, std::memory_order_acquire);
+
+        while (node != nullptr)
+        {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    /** Returns the current object, switching to a newly published one if there is one.
+        Before switching, adopt(next, previous) is called so that state can be carried over.
+        Called on the processing thread; returns nullptr until something has been published. */
+    template <class Adopt>
+    T* acquire(Adopt&& adopt)
+    {
+        Node* next = pending.exchange(nullptr, std::memory_order_acq_rel);
+
+        if (next != nullptr)
+        {
+            if (active != nullptr)
+            {
+                adopt(*next->object, *active->object);
+                retire(active);
+            }
+
+            active = next;
+        }
+
+        return active != nullptr ? active->object.get() : nullptr;
+    }
+
+private:
+
+    struct Node
+    {
+        Node(std::unique_ptr<T> object_) : object(std::move(object_)), next(nullptr) { }
+
+        std::unique_ptr<T> object;
+        Node* next;
+    };
+
+    /** Pushes a node onto the retired list */
+    void retire(Node* node)
+    {
+        node->next = retired.load(std::memory_order_relaxed);
+
+        while (! retired.compare_exchange_weak(node->next, node,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed))
+        {
+        }
+    }
+
+    /** Only touched by the message thread */
+    T* published;
+
+    /** Only touched by the processing thread (and the destructor) */
+    Node* active;
+
+    std::atomic<Node*> pending;
+    std::atomic<Node*> retired;
+
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+};
+
+#endif
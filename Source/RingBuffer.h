@@ -0,0 +1,133 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RING_BUFFER_H_INCLUDED
+#define RING_BUFFER_H_INCLUDED
+
+#include <vector>
+
+/**
+    Holds the most recent samples of a signal in a circular buffer whose capacity
+    is a power of two, so positions wrap with a mask instead of a division.
+
+    Samples are addressed from the oldest one in the window: [0] is the oldest and
+    [getLength() - 1] the newest. The capacity is at least the window length plus
+    the requested slack, and the slots past the newest sample can be filled a
+    block at a time (through getWriteSpans() or [getLength() + i]) before
+    advance() moves them into the window. Until then the samples they will push
+    out can still be read.
+
+    The window and the write area are each at most two contiguous runs of memory,
+    so loops over them need no per-sample wrapping and can be vectorized.
+ */
+template <class T>
+class RingBuffer
+{
+public:
+
+    /** A run of consecutive samples */
+    struct Span
+    {
+        T* data;
+        int size;
+    };
+
+    /** Constructor -- creates an empty buffer */
+    RingBuffer() : mask(0), length(0), head(0) { }
+
+    /** Sets the window length and allocates room for it and at least minSlack samples
+        more, clearing the contents. A length of 0 releases the memory. */
+    void setLength(int numSamples, int minSlack = 0)
+    {
+        length = numSamples;
+        head = 0;
+
+        int capacity = 0;
+
+        if (numSamples > 0)
+        {
+            capacity = 1;
+
+            while (capacity < numSamples + minSlack)
+                capacity <<= 1;
+        }
+
+        mask = capacity - 1;
+
+        // assign() keeps the old allocation when it is large enough
+        samples.assign(capacity, T());
+
+        if (capacity == 0)
+            samples.shrink_to_fit();
+    }
+
+    /** Returns the window length */
+    int getLength() const { return length; }
+
+    /** Returns the number of samples allocated, a power of two */
+    int getCapacity() const { return int(samples.size()); }
+
+    /** Returns the number of samples that can be written past the newest one before advance() */
+    int getSlack() const { return getCapacity() - length; }
+
+    /** Returns the sample k places after the oldest one in the window */
+    T& operator[](int k) { return samples[(head + k) & mask]; }
+
+    const T& operator[](int k) const { return samples[(head + k) & mask]; }
+
+    /** Moves the window forward by numSamples, dropping its oldest samples */
+    void advance(int numSamples)
+    {
+        head = (head + numSamples) & mask;
+    }
+
+    /** Returns the window, oldest sample first, as up to two runs (second.size may be 0) */
+    void getWindowSpans(Span& first, Span& second) { getSpans(0, length, first, second); }
+
+    /** Returns the numSamples slots after the newest sample as up to two runs; numSamples
+        must not exceed getSlack() */
+    void getWriteSpans(int numSamples, Span& first, Span& second) { getSpans(length, numSamples, first, second); }
+
+private:
+
+    void getSpans(int offset, int numSamples, Span& first, Span& second)
+    {
+        const int start = (head + offset) & mask;
+        const int toEnd = getCapacity() - start;
+
+        first.data = samples.data() + start;
+        first.size = numSamples < toEnd ? numSamples : toEnd;
+        second.data = samples.data();
+        second.size = numSamples - first.size;
+    }
+
+    std::vector<T> samples;
+
+    int mask;
+    int length;
+
+    /** Position of the oldest sample of the window */
+    int head;
+};
+
+#endif
@@ -0,0 +1,947 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "RollingAverage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+const char* getWindowProfileName(WindowProfile profile)
+{
+    switch (profile)
+    {
+    case WindowProfile::RECTANGULAR:
+        return "rectangular";
+    case WindowProfile::EXPONENTIAL:
+        return "exponential";
+    case WindowProfile::SAVITZKY_GOLAY:
+        return "savitzky-golay";
+    case WindowProfile::CASCADED:
+        return "cascaded";
+    default:
+        return "quadratic";
+    }
+}
+
+bool parseWindowProfile(const std::string& name, WindowProfile& profile)
+{
+    for (WindowProfile candidate : { WindowProfile::RECTANGULAR, WindowProfile::QUADRATIC,
+                                     WindowProfile::EXPONENTIAL, WindowProfile::SAVITZKY_GOLAY,
+                                     WindowProfile::CASCADED })
+    {
+        if (name == getWindowProfileName(candidate))
+        {
+            profile = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* getWindowStorageName(WindowStorage storage)
+{
+    switch (storage)
+    {
+    case WindowStorage::FLOAT:
+        return "float";
+    case WindowStorage::INT32:
+        return "int32";
+    case WindowStorage::INT16:
+        return "int16";
+    default:
+        return "double";
+    }
+}
+
+bool parseWindowStorage(const std::string& name, WindowStorage& storage)
+{
+    for (WindowStorage candidate : { WindowStorage::DOUBLE, WindowStorage::FLOAT,
+                                     WindowStorage::INT32, WindowStorage::INT16 })
+    {
+        if (name == getWindowStorageName(candidate))
+        {
+            storage = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::mutex WindowKernel::cacheLock;
+std::map<std::tuple<int, WindowProfile, int, int, int>, std::weak_ptr<const WindowKernel>> WindowKernel::cache;
+
+std::shared_ptr<const WindowKernel> WindowKernel::get(int numSamples, WindowProfile profile, const SavitzkyGolayShape& shape_)
+{
+    // the other profiles share one kernel whatever the shape
+    const SavitzkyGolayShape shape = profile == WindowProfile::SAVITZKY_GOLAY ? shape_ : SavitzkyGolayShape();
+
+    const std::lock_guard<std::mutex> lock(cacheLock);
+
+    std::weak_ptr<const WindowKernel>& entry = cache[std::make_tuple(numSamples, profile, shape.order,
+                                                                     shape.derivative, shape.lookahead)];
+
+    std::shared_ptr<const WindowKernel> kernel = entry.lock();
+
+    if (kernel == nullptr)
+    {
+        kernel = std::make_shared<const WindowKernel>(numSamples, profile, shape);
+        entry = kernel;
+    }
+
+    // drop entries whose kernels are no longer used by any window
+    for (auto it = cache.begin(); it != cache.end();)
+    {
+        if (it->second.expired())
+            it = cache.erase(it);
+        else
+            ++it;
+    }
+
+    return kernel;
+}
+
+/** Limits a Savitzky-Golay shape to what a window of numSamples can support */
+static SavitzkyGolayShape fitShapeToWindow(int numSamples, SavitzkyGolayShape shape)
+{
+    // fewer samples than coefficients: the fit passes through every sample
+    shape.order = std::min(std::max(shape.order, 0), std::min(SavitzkyGolayShape::maxOrder, numSamples - 1));
+    shape.derivative = std::max(shape.derivative, 0);
+    shape.lookahead = std::min(std::max(shape.lookahead, 0), numSamples - 1);
+
+    return shape;
+}
+
+static double getPositionScale(int numSamples, WindowProfile profile)
+{
+    return profile == WindowProfile::SAVITZKY_GOLAY && numSamples > 1 ? 1.0 / (numSamples - 1) : 1.0;
+}
+
+/** Weights of the least-squares polynomial through the window, differentiated and evaluated
+    at the shape's lookahead, as coefficients of the moments in u = i / (N - 1) */
+static void fitSavitzkyGolay(int numSamples, const SavitzkyGolayShape& shape, double* polynomial)
+{
+    const int size = shape.order + 1;
+    const double scale = getPositionScale(numSamples, WindowProfile::SAVITZKY_GOLAY);
+
+    for (int k = 0; k <= SavitzkyGolayShape::maxOrder; k++)
+        polynomial[k] = 0.0;
+
+    // a derivative above the order of the fit is zero
+    if (shape.derivative >= size)
+        return;
+
+    // normal equations in u, which keeps them well conditioned for long windows
+    double powerSums[2 * SavitzkyGolayShape::maxOrder + 1] = {};
+
+    for (int i = 0; i < numSamples; i++)
+    {
+        const double u = i * scale;
+        double power = 1.0;
+
+        for (int k = 0; k < 2 * size - 1; k++)
+        {
+            powerSums[k] += power;
+            power *= u;
+        }
+    }
+
+    // the fit's coefficients a solve M a = S, and the output is e . a for e the derivative of
+    // the basis at the evaluation point; M is symmetric, so the output is (M^-1 e) . S
+    const double evaluatedAt = (numSamples - 1 - shape.lookahead) * scale;
+
+    double m[SavitzkyGolayShape::maxOrder + 1][SavitzkyGolayShape::maxOrder + 2];
+
+    for (int row = 0; row < size; row++)
+    {
+        for (int col = 0; col < size; col++)
+            m[row][col] = powerSums[row + col];
+
+        // d^derivative/du^derivative of u^row, converted to units per sample
+        double e = 0.0;
+
+        if (row >= shape.derivative)
+        {
+            e = std::pow(evaluatedAt, row - shape.derivative) * std::pow(scale, shape.derivative);
+
+            for (int factor = row; factor > row - shape.derivative; factor--)
+                e *= factor;
+        }
+
+        m[row][size] = e;
+    }
+
+    // Gauss-Jordan elimination
+    for (int pivot = 0; pivot < size; pivot++)
+    {
+        for (int row = 0; row < size; row++)
+        {
+            if (row == pivot)
+                continue;
+
+            const double factor = m[row][pivot] / m[pivot][pivot];
+
+            for (int col = pivot; col <= size; col++)
+                m[row][col] -= factor * m[pivot][col];
+        }
+    }
+
+    for (int k = 0; k < size; k++)
+        polynomial[k] = m[k][size] / m[k][k];
+}
+
+static double getDecay(int numSamples)
+{
+    // time constant of a quarter of the window
+    return std::exp(-4.0 / numSamples);
+}
+
+static std::vector<double> buildWindowWeights(int numSamples, WindowProfile profile, const SavitzkyGolayShape& shape)
+{
+    // the cascade has an infinite impulse response and no taps to weight
+    if (profile == WindowProfile::CASCADED)
+        return std::vector<double>();
+
+    std::vector<double> weights(numSamples);
+
+    double polynomial[SavitzkyGolayShape::maxOrder + 1];
+    fitSavitzkyGolay(numSamples, shape, polynomial);
+
+    const double scale = getPositionScale(numSamples, profile);
+    const double decay = getDecay(numSamples);
+
+    for (int i = 0; i < numSamples; i++)
+    {
+        switch (profile)
+        {
+        case WindowProfile::RECTANGULAR:
+            weights[i] = 1.0;
+            break;
+        case WindowProfile::QUADRATIC:
+            weights[i] = 2.0 + double(i) * i;
+            break;
+        case WindowProfile::EXPONENTIAL:
+            weights[i] = std::pow(decay, numSamples - 1 - i);
+            break;
+        case WindowProfile::SAVITZKY_GOLAY:
+        {
+            const double u = i * scale;
+            double weight = 0.0;
+
+            for (int k = shape.order; k >= 0; k--)
+                weight = weight * u + polynomial[k];
+
+            weights[i] = weight;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    return weights;
+}
+
+WindowKernel::WindowKernel(int numSamples, WindowProfile profile_, const SavitzkyGolayShape& shape_) :
+    weights(buildWindowWeights(numSamples, profile_, fitShapeToWindow(numSamples, shape_))),
+    weightSum(std::accumulate(weights.begin(), weights.end(), 0.0)),
+    profile(profile_),
+    shape(fitShapeToWindow(numSamples, shape_)),
+    positionScale(getPositionScale(numSamples, profile_)),
+    decay(getDecay(numSamples)),
+    leavingDecay(std::pow(decay, numSamples)),
+    // time constant of N / 6; see getCascadedAverage()
+    smoothing(1.0 - std::exp(-6.0 / numSamples))
+{
+    fitSavitzkyGolay(numSamples, shape, polynomial);
+
+    switch (profile)
+    {
+    case WindowProfile::RECTANGULAR:
+        numMoments = 1;
+        break;
+    case WindowProfile::QUADRATIC:
+        numMoments = 3;
+        break;
+    case WindowProfile::SAVITZKY_GOLAY:
+        numMoments = shape.order + 1;
+        break;
+    default:
+        numMoments = 0;
+        break;
+    }
+
+    // moving the window takes u to u - positionScale, and (u - h)^k expands binomially
+    for (int k = 0; k <= SavitzkyGolayShape::maxOrder; k++)
+    {
+        double binomial = 1.0;
+
+        for (int j = k; j >= 0; j--)
+        {
+            shift[k][j] = binomial * std::pow(-positionScale, k - j);
+            binomial = binomial * j / (k - j + 1);
+        }
+
+        for (int j = k + 1; j <= SavitzkyGolayShape::maxOrder; j++)
+            shift[k][j] = 0.0;
+
+        lastPowers[k] = std::pow((numSamples - 1) * positionScale, k);
+    }
+}
+
+/** How samples are rounded for storage, and whether the moments need compensated sums */
+template <class Sample>
+struct StorageTraits
+{
+    static const bool fixedPoint = true;
+    static const bool compensated = true;
+
+    /** Largest stored code */
+    static constexpr double maxCode = double(std::numeric_limits<Sample>::max());
+};
+
+template <>
+struct StorageTraits<double>
+{
+    static const bool fixedPoint = false;
+    static const bool compensated = false;
+    static constexpr double maxCode = 0;
+};
+
+template <>
+struct StorageTraits<float>
+{
+    static const bool fixedPoint = false;
+    static const bool compensated = true;
+    static constexpr double maxCode = 0;
+};
+
+/** Step of a new fixed-point window; the first sample coarsens it to the signal's level */
+static const double initialStep = std::ldexp(1.0, -40);
+
+/** Adds increment to sum, keeping the rounding error in compensation (Kahan summation);
+    the compensated total is sum - compensation */
+static inline void addCompensated(double& sum, double& compensation, double increment)
+{
+    const double corrected = increment - compensation;
+    const double total = sum + corrected;
+
+    compensation = (total - sum) - corrected;
+    sum = total;
+}
+
+template <>
+RingBuffer<double>& RollingAverage::getBuffer<double>() { return buffer; }
+
+template <>
+RingBuffer<float>& RollingAverage::getBuffer<float>() { return floatBuffer; }
+
+template <>
+RingBuffer<int32_t>& RollingAverage::getBuffer<int32_t>() { return int32Buffer; }
+
+template <>
+RingBuffer<int16_t>& RollingAverage::getBuffer<int16_t>() { return int16Buffer; }
+
+RollingAverage::RollingAverage()
+{
+	setSize(1);
+}
+
+void RollingAverage::setSize(int numSamples, WindowProfile profile, WindowStorage storage_, const SavitzkyGolayShape& shape)
+{
+    numSamples = std::max(numSamples, 1);
+
+    storage = storage_;
+    windowSize = numSamples;
+    step = initialStep;
+
+    // only the buffer of the storage type in use is allocated; the cascade keeps no window
+    const int bufferSize = profile == WindowProfile::CASCADED ? 0 : numSamples;
+
+    buffer.setLength(storage == WindowStorage::DOUBLE ? bufferSize : 0, blockSize);
+    floatBuffer.setLength(storage == WindowStorage::FLOAT ? bufferSize : 0, blockSize);
+    int32Buffer.setLength(storage == WindowStorage::INT32 ? bufferSize : 0, blockSize);
+    int16Buffer.setLength(storage == WindowStorage::INT16 ? bufferSize : 0, blockSize);
+	index = 0;
+
+    kernel = WindowKernel::get(numSamples, profile, shape);
+
+    for (int k = 0; k <= SavitzkyGolayShape::maxOrder; k++)
+    {
+        moments[k] = 0;
+        compensations[k] = 0;
+        freshMoments[k] = 0;
+    }
+
+    decayedSum = 0;
+    freshDecayedSum = 0;
+    freshPeak = 0;
+
+    for (double& section : sections)
+        section = 0;
+}
+
+void RollingAverage::setResyncPhase(int phase)
+{
+    index = ((phase % windowSize) + windowSize) % windowSize;
+
+    // the cascade keeps no window to resynchronise
+    if (kernel->profile == WindowProfile::CASCADED)
+        return;
+
+    // the newest index samples are the oldest of the window when it next wraps
+    switch (storage)
+    {
+    case WindowStorage::DOUBLE:
+        restartFreshSums<double>(index);
+        break;
+    case WindowStorage::FLOAT:
+        restartFreshSums<float>(index);
+        break;
+    case WindowStorage::INT32:
+        restartFreshSums<int32_t>(index);
+        break;
+    case WindowStorage::INT16:
+        restartFreshSums<int16_t>(index);
+        break;
+    }
+}
+
+size_t RollingAverage::getStorageBytes() const
+{
+    return size_t(buffer.getCapacity()) * sizeof(double)
+         + size_t(floatBuffer.getCapacity()) * sizeof(float)
+         + size_t(int32Buffer.getCapacity()) * sizeof(int32_t)
+         + size_t(int16Buffer.getCapacity()) * sizeof(int16_t);
+}
+
+/** The weighted average of the window from the running state */
+template <WindowProfile profile, int numMoments>
+static inline double getAverage(const WindowKernel& kernel, const double* moments, double decayedSum)
+{
+    switch (profile)
+    {
+    case WindowProfile::RECTANGULAR:
+        return moments[0] / kernel.weightSum;
+    case WindowProfile::QUADRATIC:
+        return (2.0 * moments[0] + moments[2]) / kernel.weightSum;
+    case WindowProfile::EXPONENTIAL:
+        return decayedSum / kernel.weightSum;
+    default:
+    {
+        double result = kernel.polynomial[0] * moments[0];
+
+        for (int k = 1; k < numMoments; k++)
+            result += kernel.polynomial[k] * moments[k];
+
+        return result;
+    }
+    }
+}
+
+template <WindowProfile profile, int numMoments, class Sample>
+void RollingAverage::processWith(const float* input, float* output, int numSamples, double inputScale, float outputScale)
+{
+    typedef StorageTraits<Sample> Traits;
+
+    const WindowKernel& k = *kernel;
+
+    RingBuffer<Sample>& window = getBuffer<Sample>();
+
+    // running sums after each sample of a block: the moments, or the decayed sum in the first row
+    double sums[numMoments][blockSize];
+
+    auto storeSums = [&] (int j)
+    {
+        if (profile == WindowProfile::EXPONENTIAL)
+        {
+            sums[0][j] = decayedSum;
+        }
+        else
+        {
+            for (int m = 0; m < numMoments; m++)
+                sums[m][j] = moments[m] - compensations[m];
+        }
+    };
+
+    for (int start = 0; start < numSamples; )
+    {
+        // a block ends where the window wraps, so that the loop below never resynchronises
+        const int end = start + std::min({ numSamples - start, int(blockSize), windowSize - index });
+
+        // double and float samples are stored as they are, so a whole block is converted into the
+        // slots past the newest sample at once; fixed-point samples may rescale the window, so they
+        // are quantized one at a time
+        if (! Traits::fixedPoint)
+        {
+            typename RingBuffer<Sample>::Span spans[2];
+            window.getWriteSpans(end - start, spans[0], spans[1]);
+
+            const float* source = input + start;
+
+            for (const auto& span : spans)
+            {
+                for (int j = 0; j < span.size; j++)
+                    span.data[j] = Sample(source[j] * inputScale);
+
+                source += span.size;
+            }
+        }
+
+        for (int i = start; i < end; i++)
+        {
+            // where the sample will be in the window when it next wraps
+            const int position = index + (i - start);
+
+            double sample;
+
+            // the moments see exactly the stored value, so that it leaves the window as it entered
+            if (Traits::fixedPoint)
+            {
+                sample = input[i] * inputScale;
+
+                // a fixed-point window has no code for infinity or NaN
+                if (! std::isfinite(sample))
+                    sample = 0;
+
+                if (std::fabs(sample) > Traits::maxCode * step)
+                    coarsenStep<Sample>(sample, position);
+
+                const Sample code = Sample(std::nearbyint(sample / step));
+
+                window[windowSize] = code;
+                sample = double(code) * step;
+                freshPeak = std::max(freshPeak, std::fabs(double(code)));
+            }
+            else
+            {
+                sample = double(window[windowSize]);
+            }
+
+            const double leaving = Traits::fixedPoint ? double(window[0]) * step : double(window[0]);
+
+            window.advance(1);
+
+            // the oldest sample (i = 0) leaves, every other sample moves from i to i - 1,
+            // and the new sample enters at i = size - 1
+            if (profile == WindowProfile::EXPONENTIAL)
+            {
+                decayedSum = decayedSum * k.decay + sample - k.leavingDecay * leaving;
+                freshDecayedSum = freshDecayedSum * k.decay + sample;
+            }
+            else if (Traits::compensated)
+            {
+                const double remaining = (moments[0] - compensations[0]) - leaving;
+
+                // each moment is updated from the lower ones before they change
+                for (int m = numMoments - 1; m > 0; m--)
+                {
+                    double increment = k.shift[m][0] * remaining;
+
+                    for (int j = 1; j < m; j++)
+                        increment += k.shift[m][j] * (moments[j] - compensations[j]);
+
+                    addCompensated(moments[m], compensations[m], increment + k.lastPowers[m] * sample);
+                }
+
+                addCompensated(moments[0], compensations[0], sample - leaving);
+            }
+            else
+            {
+                const double remaining = moments[0] - leaving;
+
+                for (int m = numMoments - 1; m > 0; m--)
+                {
+                    double moment = moments[m];
+
+                    for (int j = m - 1; j > 0; j--)
+                        moment += k.shift[m][j] * moments[j];
+
+                    moments[m] = moment + k.shift[m][0] * remaining + k.lastPowers[m] * sample;
+                }
+
+                moments[0] = remaining + sample;
+            }
+
+            // the same sums as resynchronise() computes, one sample at a time
+            if (profile != WindowProfile::EXPONENTIAL)
+            {
+                const double u = position * k.positionScale;
+                double power = 1.0;
+
+                for (int m = 0; m < numMoments; m++)
+                {
+                    freshMoments[m] += power * sample;
+                    power *= u;
+                }
+            }
+
+            storeSums(i - start);
+        }
+
+        index += end - start;
+
+        if (index == windowSize)
+        {
+            // the fresh sums now hold the whole window
+            index = 0;
+            decayedSum = freshDecayedSum;
+            freshDecayedSum = 0;
+
+            for (int m = 0; m <= SavitzkyGolayShape::maxOrder; m++)
+            {
+                moments[m] = freshMoments[m];
+                compensations[m] = 0;
+                freshMoments[m] = 0;
+            }
+
+            if (Traits::fixedPoint)
+                refineStep<Sample>(freshPeak);
+
+            freshPeak = 0;
+
+            // the last sample's average is taken from the resynchronised state
+            storeSums(end - start - 1);
+        }
+
+        // the averages only depend on the sums, so this loop has no carried state and vectorizes
+        float* blockOutput = output + start;
+
+        if (profile == WindowProfile::EXPONENTIAL)
+        {
+            for (int j = 0; j < end - start; j++)
+                blockOutput[j] = float(getAverage<profile, numMoments>(k, nullptr, sums[0][j])) * outputScale;
+        }
+        else
+        {
+            for (int j = 0; j < end - start; j++)
+            {
+                double blockMoments[numMoments];
+
+                for (int m = 0; m < numMoments; m++)
+                    blockMoments[m] = sums[m][j];
+
+                blockOutput[j] = float(getAverage<profile, numMoments>(k, blockMoments, 0)) * outputScale;
+            }
+        }
+
+        start = end;
+    }
+}
+
+template <WindowProfile profile, int numMoments>
+void RollingAverage::processWith(const float* input, float* output, int numSamples, double inputScale, float outputScale)
+{
+    switch (storage)
+    {
+    case WindowStorage::DOUBLE:
+        processWith<profile, numMoments, double>(input, output, numSamples, inputScale, outputScale);
+        break;
+    case WindowStorage::FLOAT:
+        processWith<profile, numMoments, float>(input, output, numSamples, inputScale, outputScale);
+        break;
+    case WindowStorage::INT32:
+        processWith<profile, numMoments, int32_t>(input, output, numSamples, inputScale, outputScale);
+        break;
+    case WindowStorage::INT16:
+        processWith<profile, numMoments, int16_t>(input, output, numSamples, inputScale, outputScale);
+        break;
+    }
+}
+
+void RollingAverage::process(const float* input, float* output, int numSamples, double inputScale, float outputScale)
+{
+    switch (kernel->profile)
+    {
+    case WindowProfile::RECTANGULAR:
+        processWith<WindowProfile::RECTANGULAR, 1>(input, output, numSamples, inputScale, outputScale);
+        break;
+    case WindowProfile::QUADRATIC:
+        processWith<WindowProfile::QUADRATIC, 3>(input, output, numSamples, inputScale, outputScale);
+        break;
+    case WindowProfile::EXPONENTIAL:
+        processWith<WindowProfile::EXPONENTIAL, 1>(input, output, numSamples, inputScale, outputScale);
+        break;
+    case WindowProfile::SAVITZKY_GOLAY:
+        // one instantiation per order, so that the moment loops unroll
+        switch (kernel->numMoments)
+        {
+        case 1:
+            processWith<WindowProfile::SAVITZKY_GOLAY, 1>(input, output, numSamples, inputScale, outputScale);
+            break;
+        case 2:
+            processWith<WindowProfile::SAVITZKY_GOLAY, 2>(input, output, numSamples, inputScale, outputScale);
+            break;
+        case 3:
+            processWith<WindowProfile::SAVITZKY_GOLAY, 3>(input, output, numSamples, inputScale, outputScale);
+            break;
+        case 4:
+            processWith<WindowProfile::SAVITZKY_GOLAY, 4>(input, output, numSamples, inputScale, outputScale);
+            break;
+        default:
+            processWith<WindowProfile::SAVITZKY_GOLAY, 5>(input, output, numSamples, inputScale, outputScale);
+            break;
+        }
+        break;
+    case WindowProfile::CASCADED:
+    {
+        // the cascade keeps no window, so the storage precision does not apply
+        const WindowKernel& k = *kernel;
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            double value = input[i] * inputScale;
+
+            for (double& section : sections)
+            {
+                section += k.smoothing * (value - section);
+                value = section;
+            }
+
+            output[i] = float(getCascadedAverage()) * outputScale;
+        }
+
+        break;
+    }
+    }
+}
+
+double RollingAverage::getCascadedAverage() const
+{
+    // The quadratic window's weights fall from about 3 / N for the newest sample to nearly
+    // nothing for the oldest, with a mean delay of N / 4. The mean of the outputs of the
+    // two sections, each with a time constant of N / 6, has the same newest-sample weight,
+    // mean delay and unity gain, and a spread of delays within a few percent of the window's.
+    return 0.5 * (sections[0] + sections[1]);
+}
+
+template <class Sample>
+void RollingAverage::resynchronise()
+{
+    typename RingBuffer<Sample>::Span spans[2];
+    getBuffer<Sample>().getWindowSpans(spans[0], spans[1]);
+
+    const double scale = StorageTraits<Sample>::fixedPoint ? step : 1.0;
+
+    if (kernel->profile == WindowProfile::EXPONENTIAL)
+    {
+        double sum = 0;
+
+        for (const auto& span : spans)
+        {
+            for (int j = 0; j < span.size; j++)
+                sum = sum * kernel->decay + double(span.data[j]) * scale;
+        }
+
+        decayedSum = sum;
+        return;
+    }
+
+    const int numMoments = kernel->numMoments;
+    double sums[SavitzkyGolayShape::maxOrder + 1] = {};
+
+    // the runs hold the window oldest first, so i is the weight index
+    int i = 0;
+
+    for (const auto& span : spans)
+    {
+        for (int j = 0; j < span.size; j++, i++)
+        {
+            const double x = double(span.data[j]) * scale;
+            const double u = i * kernel->positionScale;
+
+            double power = 1.0;
+
+            for (int m = 0; m < numMoments; m++)
+            {
+                sums[m] += power * x;
+                power *= u;
+            }
+        }
+    }
+
+    for (int m = 0; m <= SavitzkyGolayShape::maxOrder; m++)
+    {
+        moments[m] = sums[m];
+        compensations[m] = 0;
+    }
+}
+
+template <class Sample>
+void RollingAverage::restartFreshSums(int numFresh)
+{
+    const RingBuffer<Sample>& window = getBuffer<Sample>();
+    const double scale = StorageTraits<Sample>::fixedPoint ? step : 1.0;
+
+    for (int m = 0; m <= SavitzkyGolayShape::maxOrder; m++)
+        freshMoments[m] = 0;
+
+    freshDecayedSum = 0;
+    freshPeak = 0;
+
+    for (int i = 0; i < numFresh; i++)
+    {
+        const double code = double(window[windowSize - numFresh + i]);
+        const double x = code * scale;
+
+        if (kernel->profile == WindowProfile::EXPONENTIAL)
+        {
+            freshDecayedSum = freshDecayedSum * kernel->decay + x;
+        }
+        else
+        {
+            const double u = i * kernel->positionScale;
+            double power = 1.0;
+
+            for (int m = 0; m < kernel->numMoments; m++)
+            {
+                freshMoments[m] += power * x;
+                power *= u;
+            }
+        }
+
+        freshPeak = std::max(freshPeak, std::fabs(code));
+    }
+}
+
+template <class Sample>
+void RollingAverage::coarsenStep(double sample, int numFresh)
+{
+    const double target = 0.5 * StorageTraits<Sample>::maxCode;
+
+    // a power of two, so that the requantized codes are the old ones shifted right
+    int shift = 0;
+
+    while (std::fabs(sample) > target * std::ldexp(step, shift))
+        shift++;
+
+    step = std::ldexp(step, shift);
+
+    const double factor = std::ldexp(1.0, -shift);
+
+    typename RingBuffer<Sample>::Span spans[2];
+    getBuffer<Sample>().getWindowSpans(spans[0], spans[1]);
+
+    for (const auto& span : spans)
+    {
+        for (int j = 0; j < span.size; j++)
+            span.data[j] = Sample(std::nearbyint(double(span.data[j]) * factor));
+    }
+
+    // the stored values have been rounded, so the moments are rebuilt from them
+    resynchronise<Sample>();
+    restartFreshSums<Sample>(numFresh);
+}
+
+template <class Sample>
+void RollingAverage::refineStep(double peak)
+{
+    const double quarter = 0.25 * StorageTraits<Sample>::maxCode;
+
+    // a silent window gives no level to refine to
+    if (peak == 0)
+        return;
+
+    int shift = 0;
+
+    while (std::ldexp(peak, shift + 1) <= quarter)
+        shift++;
+
+    if (shift == 0)
+        return;
+
+    // shifting left is exact, so the moments still describe the stored samples
+    step = std::ldexp(step, -shift);
+
+    const double factor = std::ldexp(1.0, shift);
+
+    typename RingBuffer<Sample>::Span spans[2];
+    getBuffer<Sample>().getWindowSpans(spans[0], spans[1]);
+
+    for (const auto& span : spans)
+    {
+        for (int j = 0; j < span.size; j++)
+            span.data[j] = Sample(double(span.data[j]) * factor);
+    }
+}
+
+double RollingAverage::getStoredSample(int k) const
+{
+    switch (storage)
+    {
+    case WindowStorage::FLOAT:
+        return floatBuffer[k];
+    case WindowStorage::INT32:
+        return int32Buffer[k] * step;
+    case WindowStorage::INT16:
+        return int16Buffer[k] * step;
+    default:
+        return buffer[k];
+    }
+}
+
+double RollingAverage::calculate() const
+{
+    double corrected[SavitzkyGolayShape::maxOrder + 1];
+
+    for (int m = 0; m <= SavitzkyGolayShape::maxOrder; m++)
+        corrected[m] = moments[m] - compensations[m];
+
+    switch (kernel->profile)
+    {
+    case WindowProfile::RECTANGULAR:
+        return getAverage<WindowProfile::RECTANGULAR, 1>(*kernel, corrected, 0);
+    case WindowProfile::QUADRATIC:
+        return getAverage<WindowProfile::QUADRATIC, 3>(*kernel, corrected, 0);
+    case WindowProfile::EXPONENTIAL:
+        return getAverage<WindowProfile::EXPONENTIAL, 1>(*kernel, corrected, decayedSum);
+    case WindowProfile::CASCADED:
+        return getCascadedAverage();
+    default:
+        // the unused moments are 0
+        return getAverage<WindowProfile::SAVITZKY_GOLAY, SavitzkyGolayShape::maxOrder + 1>(*kernel, corrected, 0);
+    }
+}
+
+double RollingAverage::calculateDirect() const
+{
+    // nothing to evaluate tap by tap
+    if (kernel->profile == WindowProfile::CASCADED)
+        return calculate();
+
+    const std::vector<double>& weights = kernel->weights;
+
+    double result = 0;
+
+    for (int i = 0; i < windowSize; i++)
+        result += getStoredSample(i) * weights[i];
+
+    // the fitted weights already sum to one (or, for a derivative, to zero)
+    if (kernel->profile == WindowProfile::SAVITZKY_GOLAY)
+        return result;
+
+    return result / kernel->weightSum;
+}
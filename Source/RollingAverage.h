@@ -0,0 +1,328 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef ROLLING_AVERAGE_H_INCLUDED
+#define ROLLING_AVERAGE_H_INCLUDED
+
+#include "RingBuffer.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/** Weighting profiles available for the rolling window; i = 0 is the oldest sample and
+    N is the window length */
+enum class WindowProfile
+{
+    RECTANGULAR,        // equal weights: a plain moving average
+    QUADRATIC,          // 2 + i^2
+    EXPONENTIAL,        // exp(-(N - 1 - i) / (N / 4)), so the oldest sample has about e^-4 of the newest's weight
+    SAVITZKY_GOLAY,     // least-squares polynomial fit to the window (see SavitzkyGolayShape),
+                        // by default a quadratic evaluated at the newest sample
+    CASCADED            // two cascaded one-pole low-passes, mixed to approximate QUADRATIC; keeps
+                        // no window, so it needs no memory per sample
+};
+
+/** How the samples of a rolling window are stored */
+enum class WindowStorage
+{
+    DOUBLE,     // 8 bytes per sample, exact
+    FLOAT,      // 4 bytes per sample, rounded to single precision
+    INT32,      // 4 bytes per sample, fixed point with a power-of-two step that follows the signal level
+    INT16       // 2 bytes per sample, likewise
+};
+
+/** Polynomial fit of the SAVITZKY_GOLAY profile */
+struct SavitzkyGolayShape
+{
+    /** Highest supported polynomial order */
+    static constexpr int maxOrder = 4;
+
+    /** Order of the fitted polynomial, 0 to maxOrder; windows shorter than order + 1
+        samples are fitted at their length minus one */
+    int order = 2;
+
+    /** Derivative of the fit to output (0 for the fit itself), in units per sample */
+    int derivative = 0;
+
+    /** Samples before the newest one at which the fit is evaluated; the output is delayed
+        by as much, in exchange for a fit that is centred on the samples around it */
+    int lookahead = 0;
+
+    bool operator== (const SavitzkyGolayShape& other) const
+    {
+        return order == other.order && derivative == other.derivative && lookahead == other.lookahead;
+    }
+
+    bool operator!= (const SavitzkyGolayShape& other) const { return ! (*this == other); }
+};
+
+/** Returns the name of a profile as used by the tools, e.g. "quadratic" */
+const char* getWindowProfileName(WindowProfile profile);
+
+/** Looks up a profile by name; returns false if there is none */
+bool parseWindowProfile(const std::string& name, WindowProfile& profile);
+
+/** Returns the name of a storage precision as used by the tools, e.g. "float" */
+const char* getWindowStorageName(WindowStorage storage);
+
+/** Looks up a storage precision by name; returns false if there is none */
+bool parseWindowStorage(const std::string& name, WindowStorage& storage);
+
+/**
+    Immutable table of window weights and their sum.
+
+    Kernels are shared between all streams and plugin instances that use the
+    same window length, profile and Savitzky-Golay shape, and are only ever built
+    on the message thread.
+ */
+class WindowKernel
+{
+public:
+
+    /** Returns the shared kernel for a window length and profile, building it if necessary;
+        the shape only applies to SAVITZKY_GOLAY */
+    static std::shared_ptr<const WindowKernel> get(int numSamples, WindowProfile profile,
+                                                   const SavitzkyGolayShape& shape = SavitzkyGolayShape());
+
+    /** Constructor -- use get() to obtain a shared instance */
+    WindowKernel(int numSamples, WindowProfile profile, const SavitzkyGolayShape& shape);
+
+    /** Weight for each tap, oldest sample first */
+    const std::vector<double> weights;
+
+    /** Sum of all weights */
+    const double weightSum;
+
+    /** Profile used to build the weights */
+    const WindowProfile profile;
+
+    /** Savitzky-Golay fit, with the order reduced to fit the window */
+    const SavitzkyGolayShape shape;
+
+    /** Number of running moments S_k = sum(u_i^k * x_i) the profile needs, where
+        u_i = i * positionScale */
+    int numMoments;
+
+    /** 1 for the rectangular and quadratic windows, whose moments are in i; 1 / (N - 1) for
+        Savitzky-Golay, whose moments are in u from 0 to 1, to keep the higher orders well
+        conditioned */
+    double positionScale;
+
+    /** Savitzky-Golay weights as a polynomial in u: c[0] + c[1] * u + ... + c[order] * u^order,
+        so that the output is the sum of c[k] * S_k */
+    double polynomial[SavitzkyGolayShape::maxOrder + 1];
+
+    /** Moments after the window moves by one sample: S_k becomes the sum over j <= k of
+        shift[k][j] * S_j (with the leaving sample taken out of S_0) plus lastPowers[k] times
+        the new sample */
+    double shift[SavitzkyGolayShape::maxOrder + 1][SavitzkyGolayShape::maxOrder + 1];
+    double lastPowers[SavitzkyGolayShape::maxOrder + 1];
+
+    /** Exponential weight ratio between neighbouring samples, and the weight lost by the
+        sample leaving the window */
+    double decay;
+    double leavingDecay;
+
+    /** Smoothing coefficient of each CASCADED section: y += smoothing * (x - y) */
+    double smoothing;
+
+    /** Number of one-pole sections of the CASCADED profile */
+    static const int numCascadedSections = 2;
+
+private:
+
+    static std::mutex cacheLock;
+    static std::map<std::tuple<int, WindowProfile, int, int, int>, std::weak_ptr<const WindowKernel>> cache;
+};
+
+/**
+    Computes a weighted rolling average of a signal in constant time per sample.
+
+    The rectangular, quadratic and Savitzky-Golay weights are polynomials in the
+    position i of a sample in the window, so their weighted sum is rebuilt from
+    the running moments S_k = sum(i^k * x_i), one per power up to the degree of
+    the weights. Moving the window by one sample updates each moment from the
+    lower ones (binomially), so a fit of order p costs O(p^2) per sample, however
+    long the window. The exponential weights follow a
+    one-pole recursion instead. Either way the state is recomputed from the buffer
+    once per pass through the window to remove accumulated rounding error.
+
+    The window can be stored at a lower precision than double, to cut the memory
+    and bandwidth of long windows on many channels. The moments then see exactly
+    the rounded samples that are stored, so that a sample leaving the window
+    removes what it added, and they are accumulated with compensated (Kahan)
+    summation. Fixed-point windows track the signal level with a power-of-two
+    step: a sample that does not fit coarsens the step and requantizes the window,
+    and a window that uses under a quarter of the range is refined, losslessly,
+    when it is resynchronised.
+
+    The cascaded profile is not a window: it mixes the outputs of a chain of leaky
+    integrators into an impulse response shaped like the quadratic window's, and it
+    keeps no buffer at all, so its memory does not grow with the window length.
+
+    process() selects the update rule for the profile once per call; each rule is
+    a separate instantiation of the sample loop, so the loop itself never branches
+    on the profile.
+
+    process() works through its input in blocks that end where the window wraps.
+    The window is a RingBuffer with room for a block of samples past the newest
+    one, so double and float input is converted into it a block at a time. The
+    running sums are then updated sample by sample, which is the only serial
+    part, and the averages of the whole block are evaluated from them in a
+    separate loop that the compiler vectorizes.
+
+    The resynchronisation is spread over the samples instead of taking a pass
+    over the window: each new sample is also added to a second set of sums at the
+    position it will have when the window next wraps, when those sums hold exactly
+    the window and replace the running ones. They are the same sums, in the same
+    order, that a pass over the window would compute. A fixed-point window still
+    takes a pass over its samples when its step changes, which only happens when
+    the signal's level rises past the stored range or falls below a quarter of it.
+ */
+class RollingAverage
+{
+public:
+    
+    /** Constructor */
+	RollingAverage();
+    
+    /** Destructor */
+    ~RollingAverage() { }
+
+    /** Sets the size of the buffer, the weighting profile, the storage precision and the
+        Savitzky-Golay fit, clearing the window */
+	void setSize(int numSamples,
+                 WindowProfile profile = WindowProfile::QUADRATIC,
+                 WindowStorage storage = WindowStorage::DOUBLE,
+                 const SavitzkyGolayShape& shape = SavitzkyGolayShape());
+
+    /** Moves the point, once every window length, at which the running sums are recomputed
+        from the window, to phase samples earlier. Windows of many channels that are given
+        different phases spread that pass over different blocks instead of all taking it in
+        the same one. The window is kept. */
+    void setResyncPhase(int phase);
+
+    /** Returns the weighting profile */
+    WindowProfile getProfile() const { return kernel->profile; }
+
+    /** Returns the storage precision */
+    WindowStorage getStorage() const { return storage; }
+
+    /** Returns the number of bytes used to store the window */
+    size_t getStorageBytes() const;
+
+    /** Adds inputScale * input[i] to the window for each sample, and writes the weighted
+        average after each addition times outputScale to output[i] */
+    void process(const float* input, float* output, int numSamples, double inputScale, float outputScale);
+    
+    /** Returns the weighted average of the current buffer*/
+	double calculate() const;
+
+    /** Returns the weighted average by evaluating every tap of the window (reference implementation)*/
+    double calculateDirect() const;
+
+private:
+
+    /** process() for one profile, number of moments and storage type */
+    template <WindowProfile profile, int numMoments, class Sample>
+    void processWith(const float* input, float* output, int numSamples, double inputScale, float outputScale);
+
+    /** process() for one profile and number of moments */
+    template <WindowProfile profile, int numMoments>
+    void processWith(const float* input, float* output, int numSamples, double inputScale, float outputScale);
+
+    /** Returns the buffer for a storage type */
+    template <class Sample>
+    RingBuffer<Sample>& getBuffer();
+
+    /** Returns the stored sample k places after the oldest, in the units of the input */
+    double getStoredSample(int k) const;
+
+    /** Coarsens the fixed-point step until sample fits with room to spare, and requantizes the
+        window, of which the newest numFresh samples entered since the last resynchronisation */
+    template <class Sample>
+    void coarsenStep(double sample, int numFresh);
+
+    /** Refines the fixed-point step while the window, whose largest code is peak, uses less
+        than a quarter of the range */
+    template <class Sample>
+    void refineStep(double peak);
+
+    /** Output of the CASCADED profile */
+    double getCascadedAverage() const;
+
+    /** Recomputes the running state from the buffer contents */
+    template <class Sample>
+    void resynchronise();
+
+    /** Recomputes the fresh sums from the newest numFresh samples of the window */
+    template <class Sample>
+    void restartFreshSums(int numFresh);
+
+    /** Window samples; only the buffer of the storage type in use is allocated */
+	RingBuffer<double> buffer;
+    RingBuffer<float> floatBuffer;
+    RingBuffer<int32_t> int32Buffer;
+    RingBuffer<int16_t> int16Buffer;
+
+    /** Samples converted into the buffer at a time, beyond the window (rounded up with the
+        window to a power of two) */
+    static const int blockSize = 256;
+
+    /** Samples since the state was last resynchronised */
+	int index;
+    int windowSize;
+
+    WindowStorage storage;
+
+    /** Value of one step of a fixed-point buffer (a power of two) */
+    double step;
+
+    std::shared_ptr<const WindowKernel> kernel;
+
+    double moments[SavitzkyGolayShape::maxOrder + 1];
+
+    /** Rounding errors still to be taken off the moments (always 0 for DOUBLE storage) */
+    double compensations[SavitzkyGolayShape::maxOrder + 1];
+
+    /** Exponentially weighted sum of the window */
+    double decayedSum;
+
+    /** Moments and decayed sum of the samples since the last resynchronisation, each at the
+        position it will have when the window next wraps, and the largest magnitude of their
+        fixed-point codes */
+    double freshMoments[SavitzkyGolayShape::maxOrder + 1];
+    double freshDecayedSum;
+    double freshPeak;
+
+    /** Outputs of the CASCADED sections */
+    double sections[WindowKernel::numCascadedSections];
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SimdSupport.h"
+
+#if MBI_SIMD_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static SimdLevel detectSimdLevel()
+{
+#if MBI_SIMD_X86 && defined(_MSC_VER)
+
+    int info[4];
+    __cpuid(info, 1);
+
+    const bool hasSse2 = (info[3] & (1 << 26)) != 0;
+    const bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+    const bool hasAvx = (info[2] & (1 << 28)) != 0;
+
+    // the OS must also save the upper halves of the ymm registers
+    if (hasOsxsave && hasAvx && (_xgetbv(0) & 6) == 6)
+        return SimdLevel::AVX;
+
+    if (hasSse2)
+        return SimdLevel::SSE2;
+
+#elif MBI_SIMD_X86 && defined(__GNUC__)
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx"))
+        return SimdLevel::AVX;
+
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+
+#endif
+
+    return SimdLevel::SCALAR;
+}
+
+SimdLevel getSupportedSimdLevel()
+{
+    static const SimdLevel level = detectSimdLevel();
+
+    return level;
+}
+
+int getSimdLaneWidth(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX:
+        return 4;
+    case SimdLevel::SSE2:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+const char* getSimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX:
+        return "avx";
+    case SimdLevel::SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
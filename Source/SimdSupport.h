@@ -0,0 +1,50 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SIMD_SUPPORT_H_INCLUDED
+#define SIMD_SUPPORT_H_INCLUDED
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MBI_SIMD_X86 1
+#else
+#define MBI_SIMD_X86 0
+#endif
+
+/** Instruction sets that the vectorized kernels are compiled for */
+enum class SimdLevel
+{
+    SCALAR,     // one lane, plain C++
+    SSE2,       // two double lanes
+    AVX         // four double lanes
+};
+
+/** Returns the widest instruction set supported by the running CPU (detected once) */
+SimdLevel getSupportedSimdLevel();
+
+/** Returns the number of double lanes processed together at a given level */
+int getSimdLaneWidth(SimdLevel level);
+
+/** Returns a short name for a level, e.g. for benchmark output */
+const char* getSimdLevelName(SimdLevel level);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+Lane types for the vectorized kernels. This header is only included by the
+kernel translation units, each of which is compiled for one instruction set
+(see the *_avx.cpp files and CMakeLists.txt). Everything is kept in an
+anonymous namespace so that code built with AVX enabled can never be picked
+by the linker for a caller running on an older CPU.
+
+All lane types use separate multiplies and adds (no FMA), so every level
+produces bit-identical results.
+*/
+
+#ifndef SIMD_VECTOR_H_INCLUDED
+#define SIMD_VECTOR_H_INCLUDED
+
+#include "SimdSupport.h"
+
+#if MBI_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+#if MBI_SIMD_X86 && defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+/** One double per lane, used where no vector instruction set is available */
+struct ScalarVector
+{
+    static const int width = 1;
+
+    double v;
+
+    static ScalarVector load(const double* p) { return { *p }; }
+    static ScalarVector broadcast(double x) { return { x }; }
+    static ScalarVector zero() { return { 0.0 }; }
+    void store(double* p) const { *p = v; }
+};
+
+inline ScalarVector operator+(ScalarVector a, ScalarVector b) { return { a.v + b.v }; }
+inline ScalarVector operator-(ScalarVector a, ScalarVector b) { return { a.v - b.v }; }
+inline ScalarVector operator*(ScalarVector a, ScalarVector b) { return { a.v * b.v }; }
+
+#if MBI_SIMD_X86
+
+/** Two doubles per lane group (SSE2) */
+struct Sse2Vector
+{
+    static const int width = 2;
+
+    __m128d v;
+
+    static Sse2Vector load(const double* p) { return { _mm_loadu_pd(p) }; }
+    static Sse2Vector broadcast(double x) { return { _mm_set1_pd(x) }; }
+    static Sse2Vector zero() { return { _mm_setzero_pd() }; }
+    void store(double* p) const { _mm_storeu_pd(p, v); }
+};
+
+inline Sse2Vector operator+(Sse2Vector a, Sse2Vector b) { return { _mm_add_pd(a.v, b.v) }; }
+inline Sse2Vector operator-(Sse2Vector a, Sse2Vector b) { return { _mm_sub_pd(a.v, b.v) }; }
+inline Sse2Vector operator*(Sse2Vector a, Sse2Vector b) { return { _mm_mul_pd(a.v, b.v) }; }
+
+#endif
+
+#if MBI_SIMD_X86 && defined(__AVX__)
+
+/** Four doubles per lane group (AVX) */
+struct AvxVector
+{
+    static const int width = 4;
+
+    __m256d v;
+
+    static AvxVector load(const double* p) { return { _mm256_loadu_pd(p) }; }
+    static AvxVector broadcast(double x) { return { _mm256_set1_pd(x) }; }
+    static AvxVector zero() { return { _mm256_setzero_pd() }; }
+    void store(double* p) const { _mm256_storeu_pd(p, v); }
+};
+
+inline AvxVector operator+(AvxVector a, AvxVector b) { return { _mm256_add_pd(a.v, b.v) }; }
+inline AvxVector operator-(AvxVector a, AvxVector b) { return { _mm256_sub_pd(a.v, b.v) }; }
+inline AvxVector operator*(AvxVector a, AvxVector b) { return { _mm256_mul_pd(a.v, b.v) }; }
+
+#endif
+
+}
+
+#endif
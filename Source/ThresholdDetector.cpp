@@ -0,0 +1,122 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "ThresholdDetector.h"
+
+#include <algorithm>
+
+ThresholdDetector::ThresholdDetector()
+{
+
+}
+
+void ThresholdDetector::prepare(int maxChannels)
+{
+    channels.reserve(maxChannels);
+    crossings.resize(std::max(crossings.size(), size_t(maxChannels) * maxCrossingsPerChannel));
+}
+
+void ThresholdDetector::setNumChannels(int numChannels)
+{
+    numChannels = std::max(numChannels, 0);
+
+    prepare(numChannels);
+
+    channels.assign(numChannels, ChannelState());
+}
+
+void ThresholdDetector::setSettings(const DetectorSettings& settings_)
+{
+    settings = settings_;
+}
+
+bool ThresholdDetector::takeStateFrom(ThresholdDetector& other)
+{
+    if (other.getNumChannels() != getNumChannels())
+        return false;
+
+    channels.swap(other.channels);
+
+    return true;
+}
+
+void ThresholdDetector::beginBlock(bool endEvents)
+{
+    for (int ch = 0; ch < getNumChannels(); ch++)
+    {
+        ChannelState& state = channels[ch];
+
+        state.numCrossings = 0;
+
+        // events must not be left open once nothing will end them
+        if (state.active && (endEvents || ! settings.enabled))
+        {
+            state.active = false;
+            crossings[ch * maxCrossingsPerChannel] = { 0, false };
+            state.numCrossings = 1;
+        }
+    }
+}
+
+void ThresholdDetector::scan(ChannelState& state, const float* envelope, int numSamples, int blockOffset)
+{
+    ThresholdCrossing* const channelCrossings = crossings.data() + (&state - channels.data()) * maxCrossingsPerChannel;
+
+    const float threshold = settings.threshold;
+    const float releaseLevel = settings.threshold - settings.hysteresis;
+
+    int i = 0;
+
+    while (state.numCrossings < maxCrossingsPerChannel)
+    {
+        if (state.active)
+        {
+            while (i < numSamples && ! (envelope[i] < releaseLevel))
+                i++;
+        }
+        else
+        {
+            // no event starts until the refractory period of the previous one is over
+            i = std::max(i, state.refractoryRemaining);
+
+            while (i < numSamples && ! (envelope[i] >= threshold))
+                i++;
+        }
+
+        if (i >= numSamples)
+            break;
+
+        state.active = ! state.active;
+
+        if (state.active)
+            state.refractoryRemaining = i + settings.refractorySamples;
+
+        channelCrossings[state.numCrossings++] = { blockOffset + i, state.active };
+
+        // the opposite crossing can come one sample later at the earliest
+        i++;
+    }
+
+    state.refractoryRemaining = std::max(state.refractoryRemaining - numSamples, 0);
+}
@@ -0,0 +1,149 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef THRESHOLD_DETECTOR_H_INCLUDED
+#define THRESHOLD_DETECTOR_H_INCLUDED
+
+#include <vector>
+
+/** Settings of the envelope threshold detector */
+struct DetectorSettings
+{
+    /** Whether crossings are detected at all */
+    bool enabled = false;
+
+    /** Envelope level at or above which an event starts */
+    float threshold = 1.0f;
+
+    /** How far below the threshold the envelope has to fall to end the event */
+    float hysteresis = 0.0f;
+
+    /** Shortest time from the start of one event to the start of the next, in samples */
+    int refractorySamples = 0;
+
+    bool operator== (const DetectorSettings& other) const
+    {
+        return enabled == other.enabled && threshold == other.threshold
+            && hysteresis == other.hysteresis && refractorySamples == other.refractorySamples;
+    }
+
+    bool operator!= (const DetectorSettings& other) const { return ! (*this == other); }
+};
+
+/** The start (rising) or end of an event on one channel */
+struct ThresholdCrossing
+{
+    /** Position in the block */
+    int sample;
+
+    bool rising;
+};
+
+/**
+    Finds where the envelope of each channel of a group crosses a threshold.
+
+    An event starts at the first sample at or above the threshold, unless the
+    previous event started less than the refractory period before, and ends at
+    the first sample below the threshold minus the hysteresis. The state of each
+    channel carries over from one block to the next, so the crossings only depend
+    on the envelope, not on how it is split into blocks.
+
+    Crossings are collected for one block at a time, into room reserved by
+    prepare(). A channel that has used up its room holds its state until the next
+    block, so its events still alternate between starts and ends.
+ */
+class ThresholdDetector
+{
+public:
+
+    /** Constructor */
+    ThresholdDetector();
+
+    /** Reserves room for the crossings of up to maxChannels channels */
+    void prepare(int maxChannels);
+
+    /** Sets the number of channels, ending every event */
+    void setNumChannels(int numChannels);
+
+    /** Returns the number of channels */
+    int getNumChannels() const { return int(channels.size()); }
+
+    /** Applies new settings; events in progress carry on under them */
+    void setSettings(const DetectorSettings& settings);
+
+    /** Returns the settings */
+    const DetectorSettings& getSettings() const { return settings; }
+
+    /** Takes over the event state of another detector with as many channels, without allocating.
+        Returns false, leaving both detectors unchanged, if the channel counts differ. */
+    bool takeStateFrom(ThresholdDetector& other);
+
+    /** Returns true if an event is in progress on a channel */
+    bool isEventActive(int channel) const { return channels[channel].active; }
+
+    /** Forgets the crossings of the previous block. With endEvents, or once detection is
+        disabled, this ends the events still in progress at the start of the block. */
+    void beginBlock(bool endEvents = false);
+
+    /** Scans numSamples envelope values of one channel, starting blockOffset samples into the block */
+    void process(int channel, const float* envelope, int numSamples, int blockOffset)
+    {
+        if (settings.enabled)
+            scan(channels[channel], envelope, numSamples, blockOffset);
+    }
+
+    /** Returns the crossings of one channel in the current block, in order */
+    const ThresholdCrossing* getCrossings(int channel) const { return crossings.data() + channel * maxCrossingsPerChannel; }
+
+    /** Returns the number of crossings of one channel in the current block */
+    int getNumCrossings(int channel) const { return channels[channel].numCrossings; }
+
+    /** Most crossings recorded per channel and block */
+    static const int maxCrossingsPerChannel = 64;
+
+private:
+
+    struct ChannelState
+    {
+        /** Whether an event is in progress */
+        bool active = false;
+
+        /** Samples from the start of the current scan until another event may start */
+        int refractoryRemaining = 0;
+
+        int numCrossings = 0;
+    };
+
+    /** process() for an enabled detector */
+    void scan(ChannelState& state, const float* envelope, int numSamples, int blockOffset);
+
+    DetectorSettings settings;
+
+    std::vector<ChannelState> channels;
+
+    /** maxCrossingsPerChannel crossings for each channel */
+    std::vector<ThresholdCrossing> crossings;
+};
+
+#endif
@@ -0,0 +1,224 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "WorkerPool.h"
+#include "AllocationTracker.h"
+#include "SimdSupport.h"
+
+#include <algorithm>
+
+#if MBI_SIMD_X86
+#include <xmmintrin.h>
+#endif
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <cerrno>
+#include <semaphore.h>
+#endif
+
+static unsigned int getFloatingPointMode()
+{
+#if MBI_SIMD_X86
+    return _mm_getcsr();
+#else
+    return 0;
+#endif
+}
+
+static void setFloatingPointMode(unsigned int mode)
+{
+#if MBI_SIMD_X86
+    _mm_setcsr(mode);
+#else
+    (void) mode;
+#endif
+}
+
+/* The operating system's semaphore: posting it is a single atomic operation unless a
+   worker is asleep on it, and then only a system call (a futex wake on Linux). */
+struct WorkerPool::Semaphore
+{
+#if defined(_WIN32)
+    Semaphore() : handle(CreateSemaphore(nullptr, 0, LONG_MAX, nullptr)) { }
+    ~Semaphore() { CloseHandle(handle); }
+
+    void post() { ReleaseSemaphore(handle, 1, nullptr); }
+    void wait() { WaitForSingleObject(handle, INFINITE); }
+
+    HANDLE handle;
+#elif defined(__APPLE__)
+    Semaphore() : handle(dispatch_semaphore_create(0)) { }
+    ~Semaphore() { dispatch_release(handle); }
+
+    void post() { dispatch_semaphore_signal(handle); }
+    void wait() { dispatch_semaphore_wait(handle, DISPATCH_TIME_FOREVER); }
+
+    dispatch_semaphore_t handle;
+#else
+    Semaphore() { sem_init(&handle, 0, 0); }
+    ~Semaphore() { sem_destroy(&handle); }
+
+    void post() { sem_post(&handle); }
+    void wait() { while (sem_wait(&handle) != 0 && errno == EINTR) { } }
+
+    sem_t handle;
+#endif
+};
+
+WorkerPool::WorkerPool(int numThreads_) :
+    numThreads(std::max(numThreads_, 1)),
+    queues(new Queue[size_t(std::max(numThreads_, 1))]),
+    batch { nullptr, nullptr, 0, false },
+    generation(0),
+    numCompleted(0),
+    semaphores(new Semaphore[size_t(std::max(numThreads_, 1))]),
+    quit(false)
+{
+    for (int thread = 1; thread < numThreads; thread++)
+        workers.emplace_back(&WorkerPool::workerLoop, this, thread);
+}
+
+WorkerPool::~WorkerPool()
+{
+    quit.store(true, std::memory_order_release);
+
+    for (int thread = 1; thread < numThreads; thread++)
+        semaphores[thread].post();
+
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void WorkerPool::runBatch(int numTasks, TaskFunction function, void* object)
+{
+    if (numTasks <= 0)
+        return;
+
+    batch.function = function;
+    batch.object = object;
+    batch.floatingPointMode = getFloatingPointMode();
+    batch.realtime = AllocationTracker::isRealtimeThread();
+    numCompleted.store(0, std::memory_order_relaxed);
+
+    generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+    // contiguous ranges, so that a thread's tasks are usually the ones it ran last time
+    for (int thread = 0; thread < numThreads; thread++)
+    {
+        const uint64_t begin = uint64_t(numTasks) * thread / numThreads;
+        const uint64_t end = uint64_t(numTasks) * (thread + 1) / numThreads;
+
+        queues[thread].range.store(begin | (end << 32), std::memory_order_release);
+    }
+
+    if (numTasks > 1)
+    {
+        for (int thread = 1; thread < numThreads; thread++)
+            semaphores[thread].post();
+    }
+
+    runTasks(0);
+
+    // barrier: the remaining tasks are already running on the workers
+    while (numCompleted.load(std::memory_order_acquire) < numTasks)
+        std::this_thread::yield();
+}
+int WorkerPool::claim(Queue& queue)
+{
+    uint64_t range = queue.range.load(std::memory_order_acquire);
+
+    while (true)
+    {
+        const uint32_t next = uint32_t(range);
+        const uint32_t end = uint32_t(range >> 32);
+
+        if (next >= end)
+            return -1;
+
+        if (queue.range.compare_exchange_weak(range, range + 1,
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_acquire))
+            return int(next);
+    }
+}
+
+void WorkerPool::runTasks(int thread)
+{
+    // the batch is read again whenever a task turns out to belong to a new one, e.g. when a
+    // worker that woke late finds the tasks of the batch after the one it was woken for
+    uint64_t batchGeneration = 0;
+    Batch current = { nullptr, nullptr, 0, false };
+
+    // own queue first, then the others in turn
+    for (int offset = 0; offset < numThreads; offset++)
+    {
+        Queue& queue = queues[(thread + offset) % numThreads];
+
+        for (int index = claim(queue); index >= 0; index = claim(queue))
+        {
+            // the queue was filled after the generation was advanced, and it cannot advance again
+            // until this task has completed
+            const uint64_t taskGeneration = generation.load(std::memory_order_acquire);
+
+            if (taskGeneration != batchGeneration)
+            {
+                batchGeneration = taskGeneration;
+                current = batch;
+
+                if (thread != 0)
+                    setFloatingPointMode(current.floatingPointMode);
+            }
+
+            if (current.realtime)
+            {
+                AllocationTracker::RealtimeScope realtimeScope;
+                current.function(current.object, index);
+            }
+            else
+            {
+                current.function(current.object, index);
+            }
+
+            numCompleted.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+}
+
+void WorkerPool::workerLoop(int thread)
+{
+    while (true)
+    {
+        semaphores[thread].wait();
+
+        if (quit.load(std::memory_order_acquire))
+            return;
+
+        runTasks(thread);
+    }
+}
@@ -0,0 +1,129 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef WORKER_POOL_H_INCLUDED
+#define WORKER_POOL_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+    A fixed set of threads that run batches of independent tasks for the
+    processing thread.
+
+    run() hands out the tasks of one batch in contiguous ranges, one per
+    thread, with the calling thread taking the first range itself. A thread
+    that finishes its own range steals the remaining tasks of the others, one
+    at a time, so an uneven batch still finishes together. run() returns only
+    once every task has completed, so whatever the tasks wrote is visible to
+    the caller. Nothing is allocated after construction, and the caller never
+    takes a lock: it wakes the workers by posting a semaphore each. Workers run
+    each batch with the caller's floating-point mode (e.g. flush-to-zero), so a
+    task gives the same result whichever thread runs it, and inside a real-time
+    scope (see AllocationTracker) if the caller was in one, so that their heap
+    activity is caught too.
+
+    There must be only one thread calling run().
+ */
+class WorkerPool
+{
+public:
+
+    /** Starts numThreads - 1 workers; the thread calling run() is the remaining one */
+    WorkerPool(int numThreads);
+
+    /** Stops and joins the workers */
+    ~WorkerPool();
+
+    /** Returns the number of threads that run tasks, including the caller */
+    int getNumThreads() const { return numThreads; }
+
+    /** Calls task(index) for every index from 0 to numTasks - 1, spread over all threads,
+        and returns when all of them have finished */
+    template <class Task>
+    void run(int numTasks, Task& task)
+    {
+        runBatch(numTasks, [] (void* object, int index) { (*static_cast<Task*>(object))(index); }, &task);
+    }
+
+private:
+
+    typedef void (*TaskFunction)(void* object, int index);
+
+    /** Everything a thread needs to run the tasks of one batch */
+    struct Batch
+    {
+        TaskFunction function;
+        void* object;
+        unsigned int floatingPointMode;
+        bool realtime;
+    };
+
+    /** Wakes one worker; posting it never blocks (defined in WorkerPool.cpp) */
+    struct Semaphore;
+
+    /** Remaining range of one thread's tasks, packed into one word so that it is claimed atomically */
+    struct alignas(64) Queue
+    {
+        std::atomic<uint64_t> range { 0 };      // next task in the low half, end in the high half
+    };
+
+    void runBatch(int numTasks, TaskFunction function, void* object);
+
+    /** Runs tasks from the thread's own queue, then from the others, until none are left */
+    void runTasks(int thread);
+
+    /** Claims the next task of a queue; returns -1 if it is empty */
+    int claim(Queue& queue);
+
+    void workerLoop(int thread);
+
+    const int numThreads;
+
+    std::unique_ptr<Queue[]> queues;
+
+    /** The current batch, written before its generation is published */
+    Batch batch;
+
+    /** Advanced (with release) for every batch once it has been written; a thread that claims a
+        task reads the batch after acquiring the generation, which cannot advance until that task
+        has completed */
+    std::atomic<uint64_t> generation;
+
+    std::atomic<int> numCompleted;
+
+    /** One per worker, posted for every batch */
+    std::unique_ptr<Semaphore[]> semaphores;
+    std::atomic<bool> quit;
+
+    std::vector<std::thread> workers;
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+};
+
+#endif
@@ -0,0 +1,632 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+Offline multi-band integration of Open Ephys binary recordings.
+
+Reads structure.oebin, maps each continuous.dat into memory and runs the
+selected channels through the same IntegratorCore as the plugin, spread over
+several threads. The envelope is written as a new recording (int16
+continuous.dat, timestamps and structure.oebin) in the output directory.
+*/
+
+#include "BandTable.h"
+#include "IntegratorCore.h"
+#include "JsonValue.h"
+#include "MappedFile.h"
+#include "OpenEphysBinaryReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct BatchOptions
+{
+    std::string recordingDirectory;
+    std::string outputDirectory;
+
+    /** Bands to integrate; the plugin's defaults (defaultBandTable) if none are given */
+    std::vector<BandSpec> bands;
+
+    double windowMs = 1000.0;
+    WindowProfile windowProfile = WindowProfile::QUADRATIC;
+    WindowStorage windowStorage = WindowStorage::DOUBLE;
+
+    /** Fit of the savitzky-golay smoother, with the lookahead in ms */
+    int sgOrder = 2;
+    int sgDerivative = 0;
+    double sgLookaheadMs = 0.0;
+
+    FilterEngine engine = FilterEngine::IIR;
+    int fftHopSize = 256;
+    bool multirate = false;
+    int numThreads = 0;
+    int chunkSize = 1024;
+
+    /** Scale of the written int16 samples; 0 keeps each channel's input bit_volts */
+    double bitVolts = 0.0;
+
+    /** Stream indices (into the "continuous" array) and channels to process; empty means all */
+    std::vector<int> streams;
+    std::vector<int> channels;
+};
+
+static void printUsage()
+{
+    std::printf("Usage: mbi-batch <recording directory> <output directory> [options]\n"
+                "\n"
+                "The recording directory must contain structure.oebin.\n"
+                "\n"
+                "Options:\n"
+                "  --band low:high:gain[:order]\n"
+                "                         add a band (Hz, Hz, weight, filter order 1-8,\n"
+                "                         default 2); may be repeated. Defaults to the\n"
+                "                         plugin's bands, %s\n"
+                "  --bands table          all bands at once, comma-separated\n"
+                "  --window-ms ms         rolling window length (default 1000)\n"
+                "  --smoother name        rolling window weighting: rectangular, quadratic,\n"
+                "                         exponential, savitzky-golay or cascaded\n"
+                "                         (default quadratic)\n"
+                "  --window-precision p   rolling window storage: double, float, int32 or\n"
+                "                         int16 (default double)\n"
+                "  --sg-order n           polynomial order of the savitzky-golay fit, 0-4\n"
+                "                         (default 2)\n"
+                "  --sg-derivative n      derivative of the fit to output (default 0)\n"
+                "  --sg-lookahead-ms ms   evaluate the fit this long before the newest\n"
+                "                         sample, delaying the output (default 0)\n"
+                "  --engine iir|fft       filter engine (default iir)\n"
+                "  --fft-hop n            hop size of the FFT engine (default 256)\n"
+                "  --multirate            filter and average at a reduced rate\n"
+                "  --threads n            worker threads (default: all cores)\n"
+                "  --channels list        comma-separated channel indices (default: all)\n"
+                "  --streams list         comma-separated continuous stream indices (default: all)\n"
+                "  --chunk n              samples per processing block (default 1024)\n"
+                "  --bit-volts v          scale of the output samples (default: input bit_volts)\n",
+                defaultBandTable);
+}
+
+static bool parseIndexList(const std::string& text, std::vector<int>& indices)
+{
+    std::stringstream stream(text);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+    {
+        char* end = nullptr;
+        const long value = std::strtol(item.c_str(), &end, 10);
+
+        if (item.empty() || *end != 0 || value < 0)
+            return false;
+
+        indices.push_back(int(value));
+    }
+
+    return ! indices.empty();
+}
+
+static bool parseArguments(int argc, char** argv, BatchOptions& options)
+{
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+
+        if (argument == "--help" || argument == "-h")
+            return false;
+
+        if (argument.compare(0, 2, "--") != 0)
+        {
+            positional.push_back(argument);
+            continue;
+        }
+
+        if (argument == "--multirate")
+        {
+            options.multirate = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::fprintf(stderr, "Missing value for %s\n", argument.c_str());
+            return false;
+        }
+
+        const std::string value = argv[++i];
+        bool valid = true;
+
+        if (argument == "--band" || argument == "--bands")
+        {
+            std::vector<BandSpec> bands;
+            valid = parseBandTable(value, bands)
+                 && (argument == "--bands" || bands.size() == 1)
+                 && options.bands.size() + bands.size() <= size_t(maxBands);
+
+            if (valid)
+                options.bands.insert(options.bands.end(), bands.begin(), bands.end());
+        }
+        else if (argument == "--window-ms")
+        {
+            options.windowMs = std::atof(value.c_str());
+            valid = options.windowMs > 0;
+        }
+        else if (argument == "--smoother")
+        {
+            valid = parseWindowProfile(value, options.windowProfile);
+        }
+        else if (argument == "--window-precision")
+        {
+            valid = parseWindowStorage(value, options.windowStorage);
+        }
+        else if (argument == "--sg-order")
+        {
+            options.sgOrder = std::atoi(value.c_str());
+            valid = options.sgOrder >= 0 && options.sgOrder <= SavitzkyGolayShape::maxOrder;
+        }
+        else if (argument == "--sg-derivative")
+        {
+            options.sgDerivative = std::atoi(value.c_str());
+            valid = options.sgDerivative >= 0;
+        }
+        else if (argument == "--sg-lookahead-ms")
+        {
+            options.sgLookaheadMs = std::atof(value.c_str());
+            valid = options.sgLookaheadMs >= 0;
+        }
+        else if (argument == "--engine")
+        {
+            valid = value == "iir" || value == "fft";
+            options.engine = value == "fft" ? FilterEngine::FFT : FilterEngine::IIR;
+        }
+        else if (argument == "--fft-hop")
+        {
+            options.fftHopSize = std::atoi(value.c_str());
+            valid = options.fftHopSize > 0;
+        }
+        else if (argument == "--threads")
+        {
+            options.numThreads = std::atoi(value.c_str());
+            valid = options.numThreads > 0;
+        }
+        else if (argument == "--chunk")
+        {
+            options.chunkSize = std::atoi(value.c_str());
+            valid = options.chunkSize > 0;
+        }
+        else if (argument == "--bit-volts")
+        {
+            options.bitVolts = std::atof(value.c_str());
+            valid = options.bitVolts > 0;
+        }
+        else if (argument == "--channels")
+        {
+            valid = parseIndexList(value, options.channels);
+        }
+        else if (argument == "--streams")
+        {
+            valid = parseIndexList(value, options.streams);
+        }
+        else
+        {
+            std::fprintf(stderr, "Unknown option %s\n", argument.c_str());
+            return false;
+        }
+
+        if (! valid)
+        {
+            std::fprintf(stderr, "Invalid value for %s: %s\n", argument.c_str(), value.c_str());
+            return false;
+        }
+    }
+
+    if (positional.size() != 2)
+        return false;
+
+    options.recordingDirectory = positional[0];
+    options.outputDirectory = positional[1];
+
+    if (options.bands.empty())
+        parseBandTable(defaultBandTable, options.bands);
+
+    if (options.numThreads == 0)
+        options.numThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+
+    return true;
+}
+
+/** Channels of one stream handled by one worker thread */
+struct ChannelGroup
+{
+    /** Positions in the list of selected channels */
+    int firstOutput;
+    int numChannels;
+};
+
+/** Everything a worker needs to process its share of one stream */
+struct StreamJob
+{
+    ContinuousStream* stream;
+
+    int16_t* output;
+    int numOutputChannels;
+
+    std::vector<ChannelView> channels;
+    std::vector<double> outputBitVolts;
+
+    /** options.engine, unless the FFT engine's kernel would cut off the bands' response */
+    FilterEngine engine;
+};
+
+/** Sets the rate, bands and filter engine of a core */
+static void setUpFilters(IntegratorCore& core, const BatchOptions& options, double sampleRate, FilterEngine engine)
+{
+    // same choice of rate as MultiBandIntegratorSettings::publish
+    if (options.multirate)
+    {
+        double highestFrequency = 0.0;
+
+        for (const BandSpec& band : options.bands)
+            highestFrequency = std::max(highestFrequency, band.highCut);
+
+        core.setDecimation(IntegratorCore::chooseDecimation(sampleRate, highestFrequency));
+    }
+
+    core.setBands(sampleRate, options.bands);
+    core.setEngine(engine, options.fftHopSize);
+}
+
+static void integrateGroup(const StreamJob& job,
+                           const BatchOptions& options,
+                           ChannelGroup group,
+                           std::atomic<int64_t>& numClipped)
+{
+    const int numChannels = group.numChannels;
+    const int chunkSize = options.chunkSize;
+    const double sampleRate = job.stream->getSampleRate();
+
+    IntegratorCore core;
+
+    core.prepare(numChannels);
+
+    setUpFilters(core, options, sampleRate, job.engine);
+
+    // same rounding as MultiBandIntegratorSettings::setRollingWindowParameters
+    core.setWindowSamples(int(float(sampleRate) * float(options.windowMs) / 1000.0f));
+    core.setWindowProfile(options.windowProfile);
+    core.setWindowStorage(options.windowStorage);
+
+    SavitzkyGolayShape shape;
+    shape.order = options.sgOrder;
+    shape.derivative = options.sgDerivative;
+    shape.lookahead = int(float(sampleRate) * float(options.sgLookaheadMs) / 1000.0f);
+    core.setSavitzkyGolayShape(shape);
+
+    core.setNumChannels(numChannels);
+
+    std::vector<float> block(size_t(numChannels) * chunkSize);
+    std::vector<float*> pointers(numChannels);
+
+    for (int ch = 0; ch < numChannels; ch++)
+        pointers[ch] = block.data() + size_t(ch) * chunkSize;
+
+    int64_t clipped = 0;
+
+    // every worker reads the same frames, so consumed chunks are left to the operating system
+    ChunkReader reader(*job.stream, chunkSize);
+    ChunkReader::Chunk chunk;
+
+    while (reader.next(chunk))
+    {
+        const int numSamples = chunk.numFrames;
+
+        for (int ch = 0; ch < numChannels; ch++)
+            job.channels[group.firstOutput + ch].read(chunk.startFrame, numSamples, pointers[ch]);
+
+        core.process(pointers.data(), pointers.data(), numSamples);
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            const int outputChannel = group.firstOutput + ch;
+            const double scale = 1.0 / job.outputBitVolts[outputChannel];
+            const float* source = pointers[ch];
+
+            int16_t* destination = job.output + chunk.startFrame * job.numOutputChannels + outputChannel;
+
+            for (int i = 0; i < numSamples; i++)
+            {
+                double value = std::round(source[i] * scale);
+
+                if (value > 32767.0 || value < -32768.0)
+                {
+                    value = std::min(std::max(value, -32768.0), 32767.0);
+                    clipped++;
+                }
+
+                destination[int64_t(i) * job.numOutputChannels] = int16_t(value);
+            }
+        }
+    }
+
+    numClipped += clipped;
+}
+
+/** Splits the channels into one group per thread, keeping whole SIMD lane groups together */
+static std::vector<ChannelGroup> makeChannelGroups(int numChannels, int numThreads)
+{
+    const std::vector<int> firstChannels = IntegratorCore::splitChannels(numChannels, numThreads);
+
+    std::vector<ChannelGroup> groups;
+
+    for (size_t g = 0; g + 1 < firstChannels.size(); g++)
+    {
+        if (firstChannels[g + 1] > firstChannels[g])
+            groups.push_back({ firstChannels[g], firstChannels[g + 1] - firstChannels[g] });
+    }
+
+    return groups;
+}
+
+static bool copyIfPresent(const fs::path& from, const fs::path& to)
+{
+    if (! fs::exists(from))
+        return true;
+
+    std::error_code error;
+    fs::copy_file(from, to, fs::copy_options::overwrite_existing, error);
+
+    if (error)
+    {
+        std::fprintf(stderr, "Could not copy %s: %s\n", from.string().c_str(), error.message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool integrateStream(ContinuousStream& stream, const BatchOptions& options, JsonValue& outputStream)
+{
+    const std::string& name = stream.getName();
+
+    const fs::path outputFolder = fs::path(options.outputDirectory) / "continuous" / name;
+
+    for (const BandSpec& band : options.bands)
+    {
+        if (band.highCut >= stream.getSampleRate() / 2)
+        {
+            std::fprintf(stderr, "Band %g-%g Hz is above the Nyquist frequency of stream %s\n",
+                         band.lowCut, band.highCut, name.c_str());
+            return false;
+        }
+    }
+
+    std::vector<int> selectedChannels = options.channels;
+
+    if (selectedChannels.empty())
+    {
+        for (int ch = 0; ch < stream.getNumChannels(); ch++)
+            selectedChannels.push_back(ch);
+    }
+
+    const JsonValue& channelInfo = stream.getInfo()["channels"];
+    JsonValue outputChannels = JsonValue::array();
+
+    StreamJob job;
+    job.stream = &stream;
+    job.numOutputChannels = int(selectedChannels.size());
+    job.engine = options.engine;
+
+    // as in the plugin, the FFT engine is only used where its kernel holds the bands' response
+    if (options.engine == FilterEngine::FFT)
+    {
+        IntegratorCore probe;
+        setUpFilters(probe, options, stream.getSampleRate(), FilterEngine::FFT);
+
+        if (probe.getFftTruncationError() > IntegratorCore::maxFftTruncationError)
+        {
+            std::fprintf(stderr, "Warning: the FFT engine's kernel would miss %.3g of the energy of the bands' "
+                                 "response at %g Hz; using the IIR engine for stream %s instead\n",
+                         probe.getFftTruncationError(), stream.getSampleRate(), name.c_str());
+            job.engine = FilterEngine::IIR;
+        }
+    }
+
+    for (int ch : selectedChannels)
+    {
+        if (ch >= stream.getNumChannels())
+        {
+            std::fprintf(stderr, "Stream %s has no channel %d\n", name.c_str(), ch);
+            return false;
+        }
+
+        const double outputBitVolts = options.bitVolts > 0 ? options.bitVolts : stream.getBitVolts(ch);
+
+        job.channels.push_back(stream.getChannel(ch));
+        job.outputBitVolts.push_back(outputBitVolts);
+
+        JsonValue channel = channelInfo[ch];
+        channel.setMember("description", "Multi-band integrator envelope of " + channelInfo[ch]["channel_name"].getString());
+        channel.setMember("history", channelInfo[ch]["history"].getString() + " -> Multi-Band Integrator");
+        channel.setMember("bit_volts", outputBitVolts);
+        outputChannels.append(channel);
+    }
+
+    if (stream.getDataFile().getSize() % (sizeof(int16_t) * stream.getNumChannels()) != 0)
+        std::fprintf(stderr, "Warning: %s ends with a partial frame, which is ignored\n", name.c_str());
+
+    const fs::path inputFolder = stream.getDirectory();
+
+    // the input is still mapped for reading, so writing over it would destroy the recording
+    std::error_code error;
+
+    if (fs::equivalent(outputFolder, inputFolder, error) || fs::exists(outputFolder / "continuous.dat", error))
+    {
+        std::fprintf(stderr, "%s already holds a recording; choose another output directory\n",
+                     outputFolder.string().c_str());
+        return false;
+    }
+
+    fs::create_directories(outputFolder, error);
+
+    if (error)
+    {
+        std::fprintf(stderr, "Could not create %s: %s\n", outputFolder.string().c_str(), error.message().c_str());
+        return false;
+    }
+
+    MappedFile output;
+
+    if (! output.create((outputFolder / "continuous.dat").string(),
+                        size_t(stream.getNumFrames()) * sizeof(int16_t) * job.numOutputChannels))
+    {
+        std::fprintf(stderr, "%s\n", output.getError().c_str());
+        return false;
+    }
+
+    job.output = reinterpret_cast<int16_t*>(output.getWritableData());
+
+    stream.getDataFile().adviseSequential();
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::atomic<int64_t> numClipped(0);
+
+    if (stream.getNumFrames() > 0)
+    {
+        std::vector<std::thread> workers;
+
+        for (const ChannelGroup& group : makeChannelGroups(job.numOutputChannels, options.numThreads))
+            workers.emplace_back(integrateGroup, std::cref(job), std::cref(options), group, std::ref(numClipped));
+
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::printf("%s: %lld samples x %d channels in %.2f s (%.1fx real time)\n",
+                name.c_str(),
+                (long long) stream.getNumFrames(),
+                job.numOutputChannels,
+                seconds,
+                seconds > 0 ? stream.getNumFrames() / stream.getSampleRate() / seconds : 0.0);
+
+    if (numClipped > 0)
+        std::fprintf(stderr, "Warning: %lld output samples of %s were clipped; consider a larger --bit-volts\n",
+                     (long long) numClipped.load(), name.c_str());
+
+    if (! copyIfPresent(inputFolder / "timestamps.npy", outputFolder / "timestamps.npy")
+        || ! copyIfPresent(inputFolder / "sample_numbers.npy", outputFolder / "sample_numbers.npy"))
+        return false;
+
+    outputStream = stream.getInfo();
+    outputStream.setMember("recorded_processor", "Multi-Band Integrator");
+    outputStream.setMember("num_channels", job.numOutputChannels);
+    outputStream.setMember("channels", outputChannels);
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BatchOptions options;
+
+    if (! parseArguments(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    OpenEphysBinaryReader reader;
+
+    if (! reader.open(options.recordingDirectory))
+    {
+        std::fprintf(stderr, "%s\n", reader.getError().c_str());
+        return 1;
+    }
+
+    std::error_code error;
+
+    if (fs::equivalent(options.outputDirectory, options.recordingDirectory, error))
+    {
+        std::fprintf(stderr, "The output directory must not be the recording directory\n");
+        return 1;
+    }
+
+    JsonValue structure = reader.getStructure();
+
+    std::vector<int> streamIndices = options.streams;
+
+    if (streamIndices.empty())
+    {
+        for (int i = 0; i < reader.getNumStreams(); i++)
+            streamIndices.push_back(i);
+    }
+
+    JsonValue outputStreams = JsonValue::array();
+
+    for (int index : streamIndices)
+    {
+        if (index >= reader.getNumStreams())
+        {
+            std::fprintf(stderr, "The recording has no continuous stream %d\n", index);
+            return 1;
+        }
+
+        JsonValue outputStream;
+
+        if (! integrateStream(reader.getStream(index), options, outputStream))
+            return 1;
+
+        outputStreams.append(outputStream);
+    }
+
+    // only the integrated continuous streams are written
+    structure.setMember("continuous", outputStreams);
+    structure.setMember("events", JsonValue::array());
+    structure.setMember("spikes", JsonValue::array());
+
+    std::ofstream structureFile(fs::path(options.outputDirectory) / "structure.oebin", std::ios::binary);
+    structureFile << structure.toString();
+
+    if (! structureFile)
+    {
+        std::fprintf(stderr, "Could not write structure.oebin\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,836 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+Benchmarks for the integrator's hot path.
+
+Each case feeds a fixed, seeded test signal through one stage (the rolling
+window, the band filters) or the whole pipeline that
+MultiBandIntegrator::process() runs, with either filter engine and at the
+full or a reduced rate, in blocks of the size the GUI would
+deliver, and times every block. Cases sweep one parameter at a time around
+a default configuration. Results are printed as a table and can also be
+written as JSON for comparison between releases.
+*/
+
+#include "BandTable.h"
+#include "IntegratorCore.h"
+#include "JsonValue.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BenchmarkCase
+{
+    std::string stage;
+    double sampleRate;
+    double windowMs;
+    int blockSize;
+    int numChannels;
+    int numThreads;
+};
+
+struct BenchmarkResult
+{
+    BenchmarkCase config;
+
+    int64_t numSamples;         // per channel
+    double nsPerSample;         // per channel sample
+    double samplesPerSecond;    // channel samples per second
+    double realtimeFactor;      // signal duration / processing time
+
+    // channels times sample rate in kHz that one core keeps up with, on average and when every
+    // block takes as long as the 99th percentile
+    double channelKhzPerCore;
+    double p99ChannelKhzPerCore;
+
+    double medianBlockUs;
+    double p99BlockUs;
+    double maxBlockUs;
+};
+
+struct BenchmarkOptions
+{
+    /** Seconds of signal processed by each case */
+    double signalSeconds = 5.0;
+
+    SimdLevel simdLevel = getSupportedSimdLevel();
+
+    /** Hop size of the FFT engine */
+    int fftHopSize = 256;
+
+    /** Weighting of the rolling window */
+    WindowProfile windowProfile = WindowProfile::QUADRATIC;
+
+    /** Precision of the rolling window's stored samples */
+    WindowStorage windowStorage = WindowStorage::DOUBLE;
+
+    /** Fit of the savitzky-golay smoother; its cost grows with the square of the order */
+    SavitzkyGolayShape savitzkyGolayShape;
+
+    /** Bands of every case (the plugin's defaults unless --bands is given) */
+    std::vector<BandSpec> bands;
+
+    bool quick = false;
+
+    std::string jsonPath;
+};
+
+/** Sine bursts in the default bands plus noise, from a fixed seed so that every run sees the same input */
+static void fillTestSignal(std::vector<float>& signal, int numSamples, double sampleRate, int channel)
+{
+    signal.resize(numSamples);
+
+    uint32_t state = 0x12345678u + 0x9e3779b9u * uint32_t(channel);
+    const double pi = 3.1415926535897932384626433832795;
+
+    for (int i = 0; i < numSamples; i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        const double noise = (double(state >> 8) / double(1 << 24) - 0.5) * 20.0;
+
+        const double t = i / sampleRate;
+        const double burst = std::fmod(t, 2.0) < 1.0 ? 1.0 : 0.0;
+
+        signal[i] = float(noise
+                          + burst * 80.0 * std::sin(2 * pi * 7.5 * t)
+                          + 40.0 * std::sin(2 * pi * 15.0 * t + channel)
+                          + 60.0 * std::sin(2 * pi * 2.5 * t));
+    }
+}
+
+static double percentile(std::vector<double>& values, double fraction)
+{
+    if (values.empty())
+        return 0.0;
+
+    const size_t index = std::min(values.size() - 1, size_t(fraction * (values.size() - 1) + 0.5));
+
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+
+    return values[index];
+}
+
+/** Keeps the optimizer from removing work whose result is otherwise unused */
+static volatile float sink;
+
+/** Cost of retuning a band: designing it, and looking up a design that another core holds */
+struct BandDesignResult
+{
+    int numDesigns;
+    double designUs;    // per band, designed from scratch
+    double lookupUs;    // per band, from BandPassDesignCache
+};
+
+/** Times a sweep of the low and high edges of an order-4 band at 30 kHz */
+static BandDesignResult measureBandDesign()
+{
+    const int order = 4;
+    const double sampleRate = 30000.0;
+
+    std::vector<double> lowCuts;
+    std::vector<double> highCuts;
+
+    for (double f = 1.0; f <= 40.0; f += 0.5)
+        lowCuts.push_back(f);
+
+    for (double f = 4.0; f <= 200.0; f += 2.0)
+        highCuts.push_back(f);
+
+    auto sweep = [&] (auto design)
+    {
+        int numDesigns = 0;
+
+        for (double lowCut : lowCuts)
+        {
+            for (double highCut : highCuts)
+            {
+                if (lowCut < highCut)
+                {
+                    sink = sink + float(design(lowCut, highCut));
+                    numDesigns++;
+                }
+            }
+        }
+
+        return numDesigns;
+    };
+
+    BandDesignResult result;
+
+    auto start = std::chrono::steady_clock::now();
+
+    result.numDesigns = sweep([&] (double lowCut, double highCut)
+    {
+        return designButterworthBandPass(order, sampleRate, lowCut, highCut)[0].b0;
+    });
+
+    result.designUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count()
+                    / result.numDesigns;
+
+    // the designs stay cached while they are held, as by the cores of the previous settings
+    std::vector<std::shared_ptr<const BandPassDesignCache::Sections>> held;
+
+    sweep([&] (double lowCut, double highCut)
+    {
+        held.push_back(BandPassDesignCache::get(order, sampleRate, lowCut, highCut));
+        return 0.0;
+    });
+
+    start = std::chrono::steady_clock::now();
+
+    sweep([&] (double lowCut, double highCut)
+    {
+        return (*BandPassDesignCache::get(order, sampleRate, lowCut, highCut))[0].b0;
+    });
+
+    result.lookupUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count()
+                    / result.numDesigns;
+
+    return result;
+}
+
+static BenchmarkResult runCase(const BenchmarkCase& config, const BenchmarkOptions& options)
+{
+    const int numChannels = config.numChannels;
+    const int blockSize = config.blockSize;
+    const int windowSamples = std::max(int(float(config.sampleRate) * float(config.windowMs) / 1000.0f), 1);
+
+    // one second of test signal per channel, replayed for the whole run
+    const int signalLength = std::max(int(config.sampleRate), blockSize);
+
+    std::vector<std::vector<float>> signals(numChannels);
+
+    for (int ch = 0; ch < numChannels; ch++)
+        fillTestSignal(signals[ch], signalLength, config.sampleRate, ch);
+
+    std::vector<float> buffer(size_t(numChannels) * blockSize);
+    std::vector<float*> pointers(numChannels);
+
+    for (int ch = 0; ch < numChannels; ch++)
+        pointers[ch] = buffer.data() + size_t(ch) * blockSize;
+
+    IntegratorCore core(options.simdLevel);
+    BandFilterBank filterBank(options.simdLevel);
+    std::vector<RollingAverage> rollingAverages(numChannels);
+
+    const int numBands = int(options.bands.size());
+
+    auto configureCore = [&](IntegratorCore& c, int numCoreChannels)
+    {
+        c.prepare(numCoreChannels);
+
+        if (config.stage == "pipeline_multirate")
+        {
+            double highestFrequency = 0.0;
+
+            for (const BandSpec& spec : options.bands)
+                highestFrequency = std::max(highestFrequency, spec.highCut);
+
+            c.setDecimation(IntegratorCore::chooseDecimation(config.sampleRate, highestFrequency));
+        }
+
+        c.setBands(config.sampleRate, options.bands);
+
+        if (config.stage == "pipeline_fft")
+            c.setEngine(FilterEngine::FFT, options.fftHopSize);
+
+        c.setWindowSamples(windowSamples);
+        c.setWindowProfile(options.windowProfile);
+        c.setWindowStorage(options.windowStorage);
+        c.setSavitzkyGolayShape(options.savitzkyGolayShape);
+        c.setNumChannels(numCoreChannels);
+    };
+
+    configureCore(core, numChannels);
+
+    filterBank.setNumBands(numBands);
+
+    for (int band = 0; band < numBands; band++)
+    {
+        const BandSpec& spec = options.bands[band];
+
+        filterBank.setBandSections(band, designButterworthBandPass(spec.order, config.sampleRate, spec.lowCut, spec.highCut));
+        filterBank.setBandGain(band, spec.gain);
+    }
+
+    filterBank.setNumChannels(numChannels);
+
+    for (auto& rollingAverage : rollingAverages)
+        rollingAverage.setSize(windowSamples, options.windowProfile, options.windowStorage, options.savitzkyGolayShape);
+
+    // the plugin's split of a block across threads: twice as many channel groups as threads
+    std::unique_ptr<WorkerPool> workerPool;
+    std::vector<int> firstChannels;
+    std::vector<IntegratorCore> groupCores;
+
+    if (config.stage == "pipeline_parallel")
+    {
+        workerPool = std::make_unique<WorkerPool>(config.numThreads);
+        firstChannels = IntegratorCore::splitChannels(numChannels, config.numThreads > 1 ? 2 * config.numThreads : 1);
+
+        groupCores.reserve(firstChannels.size() - 1);
+
+        for (size_t g = 0; g + 1 < firstChannels.size(); g++)
+        {
+            groupCores.emplace_back(options.simdLevel);
+            configureCore(groupCores.back(), firstChannels[g + 1] - firstChannels[g]);
+        }
+    }
+
+    std::function<void(int)> processBlock;
+
+    if (config.stage == "rolling_average")
+    {
+        processBlock = [&](int numSamples)
+        {
+            for (int ch = 0; ch < numChannels; ch++)
+                rollingAverages[ch].process(pointers[ch], pointers[ch], numSamples, 1.0, 1.0f);
+        };
+    }
+    else if (config.stage == "filter_bank")
+    {
+        processBlock = [&](int numSamples)
+        {
+            filterBank.process(pointers.data(), pointers.data(), numSamples);
+        };
+    }
+    else if (config.stage == "pipeline_tiled")
+    {
+        // the pipeline's stages interleaved in 64-sample tiles, so that the band sums stay in L1,
+        // for comparison with "pipeline", which runs each stage over the whole block
+        const int tileSize = 64;
+        std::vector<float> previousSums(numChannels, 0.0f);
+        std::vector<float*> tilePointers(numChannels);
+
+        // with the core's staggered resynchronisation, so that only the tiling differs
+        for (int ch = 0; ch < numChannels; ch++)
+            rollingAverages[ch].setResyncPhase(int(int64_t(windowSamples) * ch / numChannels));
+
+        processBlock = [&, tileSize, previousSums, tilePointers](int numSamples) mutable
+        {
+            for (int start = 0; start < numSamples; start += tileSize)
+            {
+                const int tileSamples = std::min(tileSize, numSamples - start);
+
+                for (int ch = 0; ch < numChannels; ch++)
+                    tilePointers[ch] = pointers[ch] + start;
+
+                filterBank.process(tilePointers.data(), tilePointers.data(), tileSamples);
+
+                for (int ch = 0; ch < numChannels; ch++)
+                {
+                    float* sums = tilePointers[ch];
+                    const float lastSum = sums[tileSamples - 1];
+
+                    for (int i = tileSamples - 1; i > 0; i--)
+                        sums[i] = std::fabs(sums[i] - sums[i - 1]);
+
+                    sums[0] = std::fabs(sums[0] - previousSums[ch]);
+                    previousSums[ch] = lastSum;
+
+                    rollingAverages[ch].process(sums, sums, tileSamples, 1.0, 1.0f);
+                }
+            }
+        };
+    }
+    else if (config.stage == "pipeline_parallel")
+    {
+        processBlock = [&](int numSamples)
+        {
+            auto runGroup = [&](int g)
+            {
+                float* const* channels = pointers.data() + firstChannels[g];
+
+                groupCores[g].process(channels, channels, numSamples);
+            };
+
+            workerPool->run(int(groupCores.size()), runGroup);
+        };
+    }
+    else
+    {
+        processBlock = [&](int numSamples)
+        {
+            core.process(pointers.data(), pointers.data(), numSamples);
+        };
+    }
+
+    const int64_t totalSamples = std::max(int64_t(options.signalSeconds * config.sampleRate), int64_t(blockSize));
+    const int64_t numBlocks = (totalSamples + blockSize - 1) / blockSize;
+
+    // warm up caches, branch predictors and the window's first pass before timing
+    const int64_t numWarmupBlocks = std::min<int64_t>(numBlocks / 10 + 1, 64);
+
+    std::vector<double> blockTimes;
+    blockTimes.reserve(size_t(numBlocks));
+
+    double totalSeconds = 0.0;
+    int position = 0;
+
+    for (int64_t block = 0; block < numWarmupBlocks + numBlocks; block++)
+    {
+        // the host copies fresh input into the buffer before each block
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            for (int i = 0; i < blockSize; i++)
+                pointers[ch][i] = signals[ch][(position + i) % signalLength];
+        }
+
+        position = (position + blockSize) % signalLength;
+
+        const auto start = std::chrono::steady_clock::now();
+        processBlock(blockSize);
+        const auto end = std::chrono::steady_clock::now();
+
+        sink = pointers[0][blockSize - 1];
+
+        if (block >= numWarmupBlocks)
+        {
+            const double seconds = std::chrono::duration<double>(end - start).count();
+
+            blockTimes.push_back(seconds * 1e6);
+            totalSeconds += seconds;
+        }
+    }
+
+    BenchmarkResult result;
+
+    result.config = config;
+    result.numSamples = numBlocks * blockSize;
+
+    const double channelSamples = double(result.numSamples) * numChannels;
+
+    result.nsPerSample = totalSeconds * 1e9 / channelSamples;
+    result.samplesPerSecond = totalSeconds > 0 ? channelSamples / totalSeconds : 0.0;
+    result.realtimeFactor = totalSeconds > 0 ? result.numSamples / config.sampleRate / totalSeconds : 0.0;
+
+    result.maxBlockUs = *std::max_element(blockTimes.begin(), blockTimes.end());
+    result.p99BlockUs = percentile(blockTimes, 0.99);
+    result.medianBlockUs = percentile(blockTimes, 0.5);
+
+    result.channelKhzPerCore = result.samplesPerSecond / 1000.0 / config.numThreads;
+    result.p99ChannelKhzPerCore = result.p99BlockUs > 0
+                                ? double(numChannels) * blockSize / result.p99BlockUs * 1000.0 / config.numThreads
+                                : 0.0;
+
+    return result;
+}
+
+/** The configuration every sweep varies one parameter of */
+static BenchmarkCase getDefaultCase()
+{
+    return { "pipeline", 30000.0, 1000.0, 1024, 16, 1 };
+}
+
+/** One sweep per parameter, each around the default configuration */
+static std::vector<BenchmarkCase> makeCases(bool quick)
+{
+    const BenchmarkCase defaults = getDefaultCase();
+
+    std::vector<double> sampleRates = { 1000.0, 2000.0, 5000.0, 10000.0, 20000.0, 30000.0 };
+    std::vector<double> windows = { 10.0, 100.0, 1000.0, 5000.0 };
+    std::vector<int> blockSizes = { 64, 256, 1024, 4096 };
+    std::vector<int> channelCounts = { 1, 4, 16, 64 };
+
+    // 1, 2, 4, ... up to the number of cores, which is included even if it is not a power of two
+    const int numCores = std::max(int(std::thread::hardware_concurrency()), 1);
+    std::vector<int> threadCounts;
+
+    for (int numThreads = 1; numThreads < numCores; numThreads *= 2)
+        threadCounts.push_back(numThreads);
+
+    threadCounts.push_back(numCores);
+
+    if (quick)
+    {
+        sampleRates = { 1000.0, 30000.0 };
+        windows = { 10.0, 5000.0 };
+        blockSizes = { 64, 4096 };
+        channelCounts = { 1, 64 };
+        threadCounts = { 1 };
+
+        if (numCores > 1)
+            threadCounts.push_back(numCores);
+    }
+
+    std::vector<BenchmarkCase> cases;
+
+    for (const char* stage : { "rolling_average", "filter_bank", "pipeline", "pipeline_tiled", "pipeline_fft",
+                               "pipeline_multirate" })
+    {
+        BenchmarkCase config = defaults;
+        config.stage = stage;
+
+        for (double sampleRate : sampleRates)
+        {
+            BenchmarkCase c = config;
+            c.sampleRate = sampleRate;
+            cases.push_back(c);
+        }
+
+        // the filters do not depend on the window length
+        if (config.stage != "filter_bank")
+        {
+            for (double windowMs : windows)
+            {
+                BenchmarkCase c = config;
+                c.windowMs = windowMs;
+                cases.push_back(c);
+            }
+        }
+
+        for (int blockSize : blockSizes)
+        {
+            BenchmarkCase c = config;
+            c.blockSize = blockSize;
+            cases.push_back(c);
+        }
+
+        for (int numChannels : channelCounts)
+        {
+            BenchmarkCase c = config;
+            c.numChannels = numChannels;
+            cases.push_back(c);
+        }
+    }
+
+    // scaling with the number of threads, on enough channels to give every thread several groups
+    for (int numThreads : threadCounts)
+    {
+        BenchmarkCase c = defaults;
+        c.stage = "pipeline_parallel";
+        c.numChannels = 64;
+        c.numThreads = numThreads;
+        cases.push_back(c);
+    }
+
+    return cases;
+}
+
+static JsonValue toJson(const BenchmarkResult& result)
+{
+    JsonValue json = JsonValue::object();
+
+    json.setMember("stage", result.config.stage);
+    json.setMember("sample_rate", result.config.sampleRate);
+    json.setMember("window_ms", result.config.windowMs);
+    json.setMember("block_size", result.config.blockSize);
+    json.setMember("channels", result.config.numChannels);
+    json.setMember("threads", result.config.numThreads);
+    json.setMember("samples", double(result.numSamples));
+    json.setMember("ns_per_sample", result.nsPerSample);
+    json.setMember("samples_per_second", result.samplesPerSecond);
+    json.setMember("realtime_factor", result.realtimeFactor);
+    json.setMember("channel_khz_per_core", result.channelKhzPerCore);
+    json.setMember("channel_khz_per_core_p99", result.p99ChannelKhzPerCore);
+    json.setMember("block_us_p50", result.medianBlockUs);
+    json.setMember("block_us_p99", result.p99BlockUs);
+    json.setMember("block_us_max", result.maxBlockUs);
+
+    return json;
+}
+
+static std::string getCompilerName()
+{
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+static void printUsage()
+{
+    std::printf("Usage: mbi-benchmark [options]\n"
+                "\n"
+                "Options:\n"
+                "  --seconds s     seconds of signal per case (default 5)\n"
+                "  --simd level    scalar, sse2 or avx (default: best supported)\n"
+                "  --fft-hop n     hop size of the FFT engine (default 256)\n"
+                "  --bands table   bands as low:high:gain[:order], comma-separated\n"
+                "                  (default \"%s\")\n"
+                "  --smoother name rectangular, quadratic, exponential, savitzky-golay or\n"
+                "                  cascaded (default quadratic)\n"
+                "  --window-precision p\n"
+                "                  double, float, int32 or int16 (default double)\n"
+                "  --sg-order n    polynomial order of the savitzky-golay fit, 0-4\n"
+                "                  (default 2)\n"
+                "  --quick         only the ends of each sweep\n"
+                "  --json path     also write the results as JSON\n",
+                defaultBandTable);
+}
+
+static bool parseArguments(int argc, char** argv, BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+
+        if (argument == "--quick")
+        {
+            options.quick = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        const std::string value = argv[++i];
+
+        if (argument == "--seconds")
+        {
+            options.signalSeconds = std::atof(value.c_str());
+
+            if (options.signalSeconds <= 0)
+                return false;
+        }
+        else if (argument == "--simd")
+        {
+            const SimdLevel supported = getSupportedSimdLevel();
+
+            if (value == "scalar")
+                options.simdLevel = SimdLevel::SCALAR;
+            else if (value == "sse2")
+                options.simdLevel = SimdLevel::SSE2;
+            else if (value == "avx")
+                options.simdLevel = SimdLevel::AVX;
+            else
+                return false;
+
+            if (int(options.simdLevel) > int(supported))
+            {
+                std::fprintf(stderr, "This CPU only supports %s\n", getSimdLevelName(supported));
+                return false;
+            }
+        }
+        else if (argument == "--fft-hop")
+        {
+            options.fftHopSize = std::atoi(value.c_str());
+
+            if (options.fftHopSize <= 0)
+                return false;
+        }
+        else if (argument == "--bands")
+        {
+            if (! parseBandTable(value, options.bands))
+                return false;
+        }
+        else if (argument == "--smoother")
+        {
+            if (! parseWindowProfile(value, options.windowProfile))
+                return false;
+        }
+        else if (argument == "--window-precision")
+        {
+            if (! parseWindowStorage(value, options.windowStorage))
+                return false;
+        }
+        else if (argument == "--sg-order")
+        {
+            options.savitzkyGolayShape.order = std::atoi(value.c_str());
+
+            if (options.savitzkyGolayShape.order < 0 || options.savitzkyGolayShape.order > SavitzkyGolayShape::maxOrder)
+                return false;
+        }
+        else if (argument == "--json")
+        {
+            options.jsonPath = value;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    parseBandTable(defaultBandTable, options.bands);
+
+    if (! parseArguments(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::printf("SIMD: %s, %g s of signal per case, bands %s, %s window of %s samples\n\n",
+                getSimdLevelName(options.simdLevel), options.signalSeconds, formatBandTable(options.bands).c_str(),
+                getWindowProfileName(options.windowProfile), getWindowStorageName(options.windowStorage));
+    std::printf("%-18s %8s %8s %6s %4s %4s %10s %12s %10s %10s %10s %10s\n",
+                "stage", "fs", "window", "block", "ch", "thr", "ns/sample", "samples/s", "x realtime",
+                "p50 us", "p99 us", "max us");
+
+    JsonValue results = JsonValue::array();
+    std::vector<BenchmarkResult> summaryResults;
+    std::vector<BenchmarkResult> tilingResults;
+
+    const BenchmarkCase defaults = getDefaultCase();
+
+    for (const BenchmarkCase& config : makeCases(options.quick))
+    {
+        const BenchmarkResult result = runCase(config, options);
+
+        // the block size sweeps of the whole-block and tiled pipelines
+        if ((config.stage == "pipeline" || config.stage == "pipeline_tiled")
+            && config.sampleRate == defaults.sampleRate && config.windowMs == defaults.windowMs
+            && config.numChannels == defaults.numChannels)
+        {
+            tilingResults.push_back(result);
+        }
+
+        // every stage at the default configuration, and every thread count
+        if (config.stage == "pipeline_parallel"
+            || (config.sampleRate == defaults.sampleRate && config.windowMs == defaults.windowMs
+                && config.blockSize == defaults.blockSize && config.numChannels == defaults.numChannels
+                && config.numThreads == defaults.numThreads))
+        {
+            if (summaryResults.empty() || summaryResults.back().config.stage != config.stage
+                || config.stage == "pipeline_parallel")
+                summaryResults.push_back(result);
+        }
+
+        std::printf("%-18s %8g %8g %6d %4d %4d %10.2f %12.4g %10.1f %10.1f %10.1f %10.1f\n",
+                    config.stage.c_str(),
+                    config.sampleRate,
+                    config.windowMs,
+                    config.blockSize,
+                    config.numChannels,
+                    config.numThreads,
+                    result.nsPerSample,
+                    result.samplesPerSecond,
+                    result.realtimeFactor,
+                    result.medianBlockUs,
+                    result.p99BlockUs,
+                    result.maxBlockUs);
+
+        std::fflush(stdout);
+
+        results.append(toJson(result));
+    }
+
+    // the work grows with the number of channels times the sample rate, so this tells how many
+    // channels of a given rate one core keeps up with
+    std::printf("\nsustained throughput per core, in channels x kHz (%g kHz, %g ms window, %d-sample blocks):\n",
+                defaults.sampleRate / 1000.0, defaults.windowMs, defaults.blockSize);
+
+    for (const BenchmarkResult& result : summaryResults)
+    {
+        std::printf("  %-18s %4d ch %2d thr %10.0f (%5.0f channels at %g kHz), %10.0f at the p99 block time\n",
+                    result.config.stage.c_str(),
+                    result.config.numChannels,
+                    result.config.numThreads,
+                    result.channelKhzPerCore,
+                    result.channelKhzPerCore * 1000.0 / defaults.sampleRate,
+                    defaults.sampleRate / 1000.0,
+                    result.p99ChannelKhzPerCore);
+    }
+
+    std::printf("\nwhole-block vs tiled pipeline, block time in us (%d channels):\n", defaults.numChannels);
+    std::printf("  %6s %10s %10s %10s %10s\n", "block", "blocks", "tiles", "blocks p99", "tiles p99");
+
+    std::vector<int> comparedBlockSizes;
+
+    std::stable_sort(tilingResults.begin(), tilingResults.end(),
+                     [](const BenchmarkResult& a, const BenchmarkResult& b) { return a.config.blockSize < b.config.blockSize; });
+
+    for (const BenchmarkResult& whole : tilingResults)
+    {
+        const int blockSize = whole.config.blockSize;
+
+        if (whole.config.stage != "pipeline"
+            || std::find(comparedBlockSizes.begin(), comparedBlockSizes.end(), blockSize) != comparedBlockSizes.end())
+            continue;
+
+        for (const BenchmarkResult& tiled : tilingResults)
+        {
+            if (tiled.config.stage == "pipeline_tiled" && tiled.config.blockSize == blockSize)
+            {
+                // mean block time, from the mean time per sample
+                auto getMeanBlockUs = [&](const BenchmarkResult& result)
+                {
+                    return result.nsPerSample * blockSize * result.config.numChannels / 1000.0;
+                };
+
+                std::printf("  %6d %10.1f %10.1f %10.1f %10.1f\n",
+                            blockSize, getMeanBlockUs(whole), getMeanBlockUs(tiled),
+                            whole.p99BlockUs, tiled.p99BlockUs);
+
+                comparedBlockSizes.push_back(blockSize);
+                break;
+            }
+        }
+    }
+
+    const BandDesignResult bandDesign = measureBandDesign();
+
+    std::printf("\nband retuning (%d order-4 bands): %.2f us per design, %.3f us per cached lookup\n",
+                bandDesign.numDesigns, bandDesign.designUs, bandDesign.lookupUs);
+
+    if (! options.jsonPath.empty())
+    {
+        JsonValue report = JsonValue::object();
+
+        report.setMember("simd", getSimdLevelName(options.simdLevel));
+        report.setMember("compiler", getCompilerName());
+        report.setMember("signal_seconds", options.signalSeconds);
+        report.setMember("fft_hop", options.fftHopSize);
+        report.setMember("bands", formatBandTable(options.bands));
+        report.setMember("smoother", getWindowProfileName(options.windowProfile));
+        report.setMember("window_precision", getWindowStorageName(options.windowStorage));
+        report.setMember("sg_order", options.savitzkyGolayShape.order);
+        report.setMember("results", results);
+        report.setMember("band_design_us", bandDesign.designUs);
+        report.setMember("band_lookup_us", bandDesign.lookupUs);
+
+        std::ofstream file(options.jsonPath, std::ios::binary);
+        file << report.toString();
+
+        if (! file)
+        {
+            std::fprintf(stderr, "Could not write %s\n", options.jsonPath.c_str());
+            return 1;
+        }
+    }
+
+    return 0;
+}
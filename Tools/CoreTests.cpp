@@ -0,0 +1,1565 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+/*
+Regression tests for the integrator's DSP core, run by ctest.
+
+Each test checks one property of the core against an independent reference
+and prints what went wrong if it does not hold. Tests that need a signal
+read it from an Open Ephys binary recording, which is only ever mapped for
+reading.
+
+    mbi-tests <test name> [recording directory]
+*/
+
+#include "AllocationTracker.h"
+#include "BandTable.h"
+#include "IntegratorCore.h"
+#include "OpenEphysBinaryReader.h"
+#include "RcuPointer.h"
+#include "SimdSupport.h"
+#include "ThresholdDetector.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <clocale>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <locale>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if MBI_SIMD_X86
+#include <xmmintrin.h>
+#endif
+
+/** Reads every channel of the first stream of a recording, one vector per channel */
+static bool readRecording(const std::string& recordingDirectory, std::vector<std::vector<float>>& channels,
+                          double& sampleRate)
+{
+    OpenEphysBinaryReader reader;
+
+    if (! reader.open(recordingDirectory) || reader.getNumStreams() == 0)
+    {
+        std::fprintf(stderr, "Could not read a recording from %s: %s\n", recordingDirectory.c_str(),
+                     reader.getError().c_str());
+        return false;
+    }
+
+    const ContinuousStream& stream = reader.getStream(0);
+    const int numFrames = int(stream.getNumFrames());
+
+    sampleRate = stream.getSampleRate();
+    channels.assign(stream.getNumChannels(), std::vector<float>(numFrames));
+
+    for (int ch = 0; ch < stream.getNumChannels(); ch++)
+        stream.getChannel(ch).read(0, numFrames, channels[ch].data());
+
+    return numFrames > 0;
+}
+
+/**
+    The recursive rolling average against the weighted sum of every sample in
+    the window, for the rectangular and quadratic profiles, on the absolute
+    first difference of each channel of the recording.
+ */
+static bool testRollingAverageBruteForce(const std::string& recordingDirectory)
+{
+    std::vector<std::vector<float>> channels;
+    double sampleRate;
+
+    if (! readRecording(recordingDirectory, channels, sampleRate))
+        return false;
+
+    const int numSamples = int(channels[0].size());
+    const int chunkSize = 1024;
+
+    // relative to the weighted mean magnitude of the window, so that the float output's rounding passes
+    const double tolerance = 1e-5;
+
+    bool passed = true;
+
+    for (const auto& channel : channels)
+    {
+        std::vector<float> input(numSamples, 0.0f);
+
+        for (int i = 1; i < numSamples; i++)
+            input[i] = std::fabs(channel[i] - channel[i - 1]);
+
+        for (WindowProfile profile : { WindowProfile::RECTANGULAR, WindowProfile::QUADRATIC })
+        {
+            for (int windowSize : { 1, 2, 100, 2000, 30000, numSamples - 1 })
+            {
+                RollingAverage average;
+                average.setSize(windowSize, profile);
+
+                std::vector<float> output(numSamples);
+
+                for (int start = 0; start < numSamples; start += chunkSize)
+                {
+                    const int n = std::min(chunkSize, numSamples - start);
+                    average.process(input.data() + start, output.data() + start, n, 1.0, 1.0f);
+                }
+
+                // the window starts out filled with zeros; long windows are checked at a stride
+                const int stride = std::max(1, windowSize / 64);
+                double worstError = 0;
+
+                for (int i = 0; i < numSamples; i += stride)
+                {
+                    double sum = 0, magnitude = 0, weightSum = 0;
+
+                    for (int w = 0; w < windowSize; w++)
+                    {
+                        const int j = i - windowSize + 1 + w;
+                        const double x = j >= 0 ? input[j] : 0.0;
+                        const double weight = profile == WindowProfile::QUADRATIC ? 2.0 + double(w) * w : 1.0;
+
+                        sum += weight * x;
+                        magnitude += weight * std::fabs(x);
+                        weightSum += weight;
+                    }
+
+                    const double error = std::fabs(output[i] - sum / weightSum);
+                    const double scale = magnitude / weightSum;
+
+                    if (scale > 0)
+                        worstError = std::max(worstError, error / scale);
+                    else if (error > 0)
+                        worstError = HUGE_VAL;
+                }
+
+                if (worstError > tolerance)
+                {
+                    std::fprintf(stderr, "%s window of %d samples: relative error %g exceeds %g\n",
+                                 getWindowProfileName(profile), windowSize, worstError, tolerance);
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    return passed;
+}
+
+/**
+    Weights of a least-squares polynomial fit of the given order to a window of numSamples,
+    differentiated and evaluated lookahead samples before the newest, found directly rather than
+    through the normal equations: the fit of x is a = R^-1 Q^T x for the QR factorisation of the
+    Vandermonde matrix A (positions centred on the window and scaled to [-1, 1]), so its derivative
+    d . a is w . x with R^T z = d and w = Q z.
+ */
+static std::vector<double> getLeastSquaresWeights(int numSamples, int order, int derivative, int lookahead)
+{
+    const int size = order + 1;
+    const double centre = 0.5 * (numSamples - 1);
+    const double halfWidth = std::max(centre, 1.0);
+
+    // columns of A, orthonormalised in place by modified Gram-Schmidt, twice for accuracy
+    std::vector<std::vector<double>> q(size, std::vector<double>(numSamples));
+    std::vector<std::vector<double>> r(size, std::vector<double>(size, 0.0));
+
+    for (int k = 0; k < size; k++)
+        for (int i = 0; i < numSamples; i++)
+            q[k][i] = std::pow((i - centre) / halfWidth, k);
+
+    for (int k = 0; k < size; k++)
+    {
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (int j = 0; j < k; j++)
+            {
+                double dot = 0.0;
+
+                for (int i = 0; i < numSamples; i++)
+                    dot += q[j][i] * q[k][i];
+
+                for (int i = 0; i < numSamples; i++)
+                    q[k][i] -= dot * q[j][i];
+
+                r[j][k] += dot;
+            }
+        }
+
+        double norm = 0.0;
+
+        for (int i = 0; i < numSamples; i++)
+            norm += q[k][i] * q[k][i];
+
+        norm = std::sqrt(norm);
+        r[k][k] = norm;
+
+        for (int i = 0; i < numSamples; i++)
+            q[k][i] /= norm;
+    }
+
+    // d: the derivative of each power of the scaled position at the evaluation point, per sample
+    const double at = (numSamples - 1 - lookahead - centre) / halfWidth;
+    std::vector<double> z(size, 0.0);
+
+    for (int k = derivative; k < size; k++)
+    {
+        double factor = 1.0;
+
+        for (int m = 0; m < derivative; m++)
+            factor *= k - m;
+
+        z[k] = factor * std::pow(at, k - derivative) / std::pow(halfWidth, derivative);
+    }
+
+    // forward substitution, as R^T is lower triangular
+    for (int k = 0; k < size; k++)
+    {
+        for (int j = 0; j < k; j++)
+            z[k] -= r[j][k] * z[j];
+
+        z[k] /= r[k][k];
+    }
+
+    std::vector<double> weights(numSamples, 0.0);
+
+    for (int k = 0; k < size; k++)
+        for (int i = 0; i < numSamples; i++)
+            weights[i] += z[k] * q[k][i];
+
+    return weights;
+}
+
+/**
+    The recursive Savitzky-Golay smoother against a direct least-squares polynomial fit to the
+    window, on the first channel of the recording, for every order, every derivative up to one
+    past the order (which must be zero) and the fit evaluated at the newest sample, the middle
+    of the window and the oldest sample. Windows shorter than the order are fitted exactly.
+ */
+static bool testSavitzkyGolayFit(const std::string& recordingDirectory)
+{
+    std::vector<std::vector<float>> channels;
+    double sampleRate;
+
+    if (! readRecording(recordingDirectory, channels, sampleRate))
+        return false;
+
+    const std::vector<float>& input = channels[0];
+    const int numSamples = int(input.size());
+    const int chunkSize = 1024;
+
+    // relative to the sum of the magnitudes of the weighted samples, so that the float
+    // output's rounding and the cancellation of the derivatives' weights pass; no less than
+    // 10^-6 of the largest sample in the window (times the weights' total magnitude), as a fit
+    // that is near zero where the window is not is only exact to the rounding of the moments
+    const double tolerance = 1e-5;
+
+    bool passed = true;
+
+    for (int windowSize : { 1, 2, 5, 31, 500, 4000 })
+    {
+        for (int order = 0; order <= SavitzkyGolayShape::maxOrder; order++)
+        {
+            for (int derivative = 0; derivative <= order + 1; derivative++)
+            {
+                for (int lookahead : { 0, windowSize / 2, windowSize - 1 })
+                {
+                    SavitzkyGolayShape shape;
+                    shape.order = order;
+                    shape.derivative = derivative;
+                    shape.lookahead = lookahead;
+
+                    RollingAverage average;
+                    average.setSize(windowSize, WindowProfile::SAVITZKY_GOLAY, WindowStorage::DOUBLE, shape);
+
+                    std::vector<float> output(numSamples);
+
+                    for (int start = 0; start < numSamples; start += chunkSize)
+                    {
+                        const int n = std::min(chunkSize, numSamples - start);
+                        average.process(input.data() + start, output.data() + start, n, 1.0, 1.0f);
+                    }
+
+                    const std::vector<double> weights = getLeastSquaresWeights(windowSize, std::min(order, windowSize - 1),
+                                                                               derivative, lookahead);
+
+                    // the window starts out filled with zeros; long windows are checked at a stride
+                    const int stride = std::max(1, windowSize / 16);
+                    double worstError = 0;
+
+                    for (int i = 0; i < numSamples; i += stride)
+                    {
+                        double fit = 0, magnitude = 0, largest = 0, weightMagnitude = 0;
+
+                        for (int w = 0; w < windowSize; w++)
+                        {
+                            const int j = i - windowSize + 1 + w;
+                            const double x = j >= 0 ? input[j] : 0.0;
+
+                            fit += weights[w] * x;
+                            magnitude += std::fabs(weights[w] * x);
+                            largest = std::max(largest, std::fabs(x));
+                            weightMagnitude += std::fabs(weights[w]);
+                        }
+
+                        magnitude = std::max(magnitude, 1e-6 * largest * weightMagnitude);
+
+                        const double error = std::fabs(output[i] - fit);
+
+                        if (magnitude > 0)
+                            worstError = std::max(worstError, error / magnitude);
+                        else if (error > 0)
+                            worstError = HUGE_VAL;
+                    }
+
+                    if (worstError > tolerance)
+                    {
+                        std::fprintf(stderr, "order %d fit of %d samples, derivative %d, %d samples ahead: relative "
+                                             "error %g exceeds %g\n",
+                                     order, windowSize, derivative, lookahead, worstError, tolerance);
+                        passed = false;
+                    }
+                }
+            }
+        }
+    }
+
+    return passed;
+}
+
+typedef std::complex<double> Complex;
+
+static const double pi = 3.1415926535897932384626433832795028841971;
+
+/**
+    Poles of a digital Butterworth band-pass filter, found the textbook way rather
+    than through DSPFilters' band-pass transform: the band edges are prewarped,
+    each pole p of the analog low-pass prototype becomes the two roots of
+    s^2 - p (Wh - Wl) s + Wl Wh, and those are mapped to z by the bilinear transform.
+ */
+static std::vector<Complex> getReferencePoles(int order, double sampleRate, double lowCut, double highCut)
+{
+    const double lowWarped = std::tan(pi * lowCut / sampleRate);
+    const double highWarped = std::tan(pi * highCut / sampleRate);
+
+    std::vector<Complex> poles;
+
+    for (int i = 0; i < order; i++)
+    {
+        const Complex prototype = std::polar(1.0, pi / 2 + (2 * i + 1) * pi / (2 * order));
+        const Complex b = -prototype * (highWarped - lowWarped);
+        const Complex root = std::sqrt(b * b - 4.0 * lowWarped * highWarped);
+
+        for (const Complex s : { (-b + root) / 2.0, (-b - root) / 2.0 })
+            poles.push_back((1.0 + s) / (1.0 - s));
+    }
+
+    return poles;
+}
+
+/** Response of the reference design, which has order zeros at z = 1 and order at z = -1 */
+static Complex getReferenceResponse(const std::vector<Complex>& poles, int order, double w)
+{
+    const Complex z = std::polar(1.0, w);
+
+    Complex response = std::pow(z - 1.0, order) * std::pow(z + 1.0, order);
+
+    for (const Complex& pole : poles)
+        response /= z - pole;
+
+    return response;
+}
+
+static Complex getSectionsResponse(const std::vector<BiquadCoefficients>& sections, double w)
+{
+    const Complex z1 = std::polar(1.0, -w);
+
+    Complex response = 1.0;
+
+    for (const BiquadCoefficients& s : sections)
+        response *= (s.b0 + z1 * (s.b1 + z1 * s.b2)) / (1.0 + z1 * (s.a1 + z1 * s.a2));
+
+    return response;
+}
+
+/**
+    The Butterworth band-pass design against an independent derivation of the
+    same filter: the poles of its sections, its magnitude response across the
+    whole band with unity gain at the geometric centre, and -3 dB at both edges.
+ */
+static bool testBandPassDesign(const std::string&)
+{
+    const double tolerance = 1e-9;
+
+    // a narrow band far below the sample rate puts the poles next to the unit circle, where
+    // evaluating the sections loses a few more digits
+    const double gainTolerance = 1e-7;
+
+    bool passed = true;
+
+    for (double sampleRate : { 2000.0, 30000.0 })
+    {
+        for (int order = 1; order <= maxBandOrder; order++)
+        {
+            for (const auto& band : { std::make_pair(1.0, 4.0), std::make_pair(6.0, 9.0),
+                                      std::make_pair(13.0, 18.0), std::make_pair(100.0, 300.0) })
+            {
+                const std::vector<BiquadCoefficients> sections =
+                    designButterworthBandPass(order, sampleRate, band.first, band.second);
+
+                std::vector<Complex> poles;
+
+                for (const BiquadCoefficients& s : sections)
+                {
+                    const Complex root = std::sqrt(Complex(s.a1 * s.a1 - 4 * s.a2));
+
+                    poles.push_back((-s.a1 + root) / 2.0);
+                    poles.push_back((-s.a1 - root) / 2.0);
+                }
+
+                std::vector<Complex> referencePoles = getReferencePoles(order, sampleRate, band.first, band.second);
+
+                // every reference pole must be matched by a distinct pole of the design
+                double poleError = poles.size() == referencePoles.size() ? 0.0 : HUGE_VAL;
+
+                for (const Complex& pole : poles)
+                {
+                    auto nearest = std::min_element(referencePoles.begin(), referencePoles.end(),
+                                                    [&] (const Complex& x, const Complex& y)
+                                                    { return std::abs(x - pole) < std::abs(y - pole); });
+
+                    if (nearest == referencePoles.end())
+                        break;
+
+                    poleError = std::max(poleError, std::abs(*nearest - pole));
+                    referencePoles.erase(nearest);
+                }
+
+                referencePoles = getReferencePoles(order, sampleRate, band.first, band.second);
+
+                const double low = 2 * pi * band.first / sampleRate;
+                const double high = 2 * pi * band.second / sampleRate;
+                const double centre = 2 * std::atan(std::sqrt(std::tan(low / 2) * std::tan(high / 2)));
+                const double referenceGain = 1 / std::abs(getReferenceResponse(referencePoles, order, centre));
+
+                double responseError = 0;
+
+                for (int i = 1; i < 1024; i++)
+                {
+                    const double w = pi * i / 1024;
+
+                    responseError = std::max(responseError,
+                                             std::abs(std::abs(getSectionsResponse(sections, w))
+                                                      - referenceGain * std::abs(getReferenceResponse(referencePoles, order, w))));
+                }
+
+                const double centreError = std::abs(std::abs(getSectionsResponse(sections, centre)) - 1);
+                const double edgeError = std::max(std::abs(std::abs(getSectionsResponse(sections, low)) - std::sqrt(0.5)),
+                                                  std::abs(std::abs(getSectionsResponse(sections, high)) - std::sqrt(0.5)));
+
+                if (poleError > tolerance || responseError > tolerance || centreError > gainTolerance || edgeError > gainTolerance)
+                {
+                    std::fprintf(stderr, "order %d band %g-%g Hz at %g Hz: pole error %g, response error %g, "
+                                         "centre gain error %g, edge gain error %g\n",
+                                 order, band.first, band.second, sampleRate,
+                                 poleError, responseError, centreError, edgeError);
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    // the cache shares a design while it is held, and keeps nothing that is not
+    {
+        const int numDesigns = BandPassDesignCache::getNumDesigns();
+
+        std::shared_ptr<const BandPassDesignCache::Sections> first = BandPassDesignCache::get(4, 30000.0, 6.0, 9.0);
+        std::shared_ptr<const BandPassDesignCache::Sections> second = BandPassDesignCache::get(4, 30000.0, 6.0, 9.0);
+
+        const bool shared = first == second && BandPassDesignCache::getNumDesigns() == numDesigns + 1;
+
+        first.reset();
+        second.reset();
+
+        for (double highCut = 10.0; highCut < 1000.0; highCut += 1.0)
+            BandPassDesignCache::get(4, 30000.0, 6.0, highCut);
+
+        // the last design of the sweep is released, but only dropped when the next one is designed
+        if (! shared || BandPassDesignCache::getNumDesigns() > numDesigns + 1)
+        {
+            std::fprintf(stderr, "the design cache holds %d designs after the sweep, %d before it%s\n",
+                         BandPassDesignCache::getNumDesigns(), numDesigns,
+                         shared ? "" : ", and does not share a design that is held");
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+/** A locale that writes and reads a decimal comma, for locales the machine has not installed */
+struct DecimalCommaPunctuation : std::numpunct<char>
+{
+    char do_decimal_point() const override { return ','; }
+};
+
+/**
+    Band tables written by formatBandTable() and read back by parseBandTable(),
+    under the C library and C++ locales of a country with a decimal comma, and
+    tables that must be refused: orders that are not whole numbers in
+    1..maxBandOrder, including ones too large for an int, and malformed entries.
+ */
+static bool testBandTable(const std::string&)
+{
+    std::setlocale(LC_NUMERIC, "de_DE.UTF-8");
+    std::locale::global(std::locale(std::locale::classic(), new DecimalCommaPunctuation));
+
+    bool passed = true;
+
+    for (const char* text : { "6:9:4, 13:18:7, 1:4:-1", "0.5:4.25:1.5:3", "300:3000:-0.125:1, 1:2:1:8" })
+    {
+        std::vector<BandSpec> bands;
+
+        if (! parseBandTable(text, bands) || formatBandTable(bands) != text)
+        {
+            std::fprintf(stderr, "\"%s\" does not read back as itself\n", text);
+            passed = false;
+        }
+    }
+
+    std::vector<BandSpec> bands;
+
+    if (! parseBandTable(" 0.5 : 4.25 : 1.5 : 3 ", bands) || bands.size() != 1
+        || bands[0].lowCut != 0.5 || bands[0].highCut != 4.25 || bands[0].gain != 1.5 || bands[0].order != 3)
+    {
+        std::fprintf(stderr, "\"0.5:4.25:1.5:3\" is not read as 0.5-4.25 Hz, gain 1.5, order 3\n");
+        passed = false;
+    }
+
+    for (const char* text : { "6:9:4:0", "6:9:4:9", "6:9:4:2.5", "6:9:4:-1", "6:9:4:1e300", "6:9:4:-1e19",
+                              "6:9:4:inf", "6:9:4:2:1", "6:9", "6:9:", "6,5:9:4", "6:9:x", "6:9:4x", "9:6:4", "" })
+    {
+        if (parseBandTable(text, bands))
+        {
+            std::fprintf(stderr, "\"%s\" is not refused\n", text);
+            passed = false;
+        }
+    }
+
+    std::locale::global(std::locale::classic());
+    std::setlocale(LC_NUMERIC, "C");
+
+    return passed;
+}
+
+/**
+    The vectorized filter bank, at every instruction set the machine supports,
+    against the bands run one at a time through biquads in direct form II (the
+    form of the DSPFilters filters the bank replaced) and summed with their gains,
+    on every channel of the recording.
+ */
+static bool testBandFilterBank(const std::string& recordingDirectory)
+{
+    std::vector<std::vector<float>> channels;
+    double sampleRate;
+
+    if (! readRecording(recordingDirectory, channels, sampleRate))
+        return false;
+
+    std::vector<BandSpec> bands;
+    parseBandTable(defaultBandTable, bands);
+
+    const int numChannels = int(channels.size());
+    const int numSamples = int(channels[0].size());
+
+    std::vector<std::vector<double>> expected(numChannels, std::vector<double>(numSamples, 0.0));
+
+    for (const BandSpec& band : bands)
+    {
+        const std::vector<BiquadCoefficients> sections =
+            designButterworthBandPass(band.order, sampleRate, band.lowCut, band.highCut);
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            std::vector<double> states(2 * sections.size(), 0.0);
+
+            for (int i = 0; i < numSamples; i++)
+            {
+                double x = channels[ch][i];
+
+                for (size_t j = 0; j < sections.size(); j++)
+                {
+                    const BiquadCoefficients& s = sections[j];
+                    double& v1 = states[2 * j];
+                    double& v2 = states[2 * j + 1];
+
+                    const double w = x - s.a1 * v1 - s.a2 * v2;
+
+                    x = s.b0 * w + s.b1 * v1 + s.b2 * v2;
+                    v2 = v1;
+                    v1 = w;
+                }
+
+                expected[ch][i] += band.gain * x;
+            }
+        }
+    }
+
+    double rms = 0;
+
+    for (const auto& channel : expected)
+    {
+        for (double x : channel)
+            rms += x * x;
+    }
+
+    rms = std::sqrt(rms / (double(numChannels) * numSamples));
+
+    // the bank writes floats, so it matches to the output's rounding
+    const double tolerance = 1e-5;
+    const int chunkSize = 1000;
+
+    bool passed = true;
+
+    for (int level = 0; level <= int(getSupportedSimdLevel()); level++)
+    {
+        const SimdLevel simdLevel = SimdLevel(level);
+
+        BandFilterBank bank(simdLevel);
+        bank.setNumChannels(numChannels);
+        bank.setNumBands(int(bands.size()));
+
+        for (int b = 0; b < int(bands.size()); b++)
+        {
+            bank.setBandSections(b, designButterworthBandPass(bands[b].order, sampleRate, bands[b].lowCut, bands[b].highCut));
+            bank.setBandGain(b, bands[b].gain);
+        }
+
+        std::vector<std::vector<float>> output(numChannels, std::vector<float>(numSamples));
+        std::vector<const float*> inputs(numChannels);
+        std::vector<float*> outputs(numChannels);
+
+        for (int start = 0; start < numSamples; start += chunkSize)
+        {
+            for (int ch = 0; ch < numChannels; ch++)
+            {
+                inputs[ch] = channels[ch].data() + start;
+                outputs[ch] = output[ch].data() + start;
+            }
+
+            bank.process(inputs.data(), outputs.data(), std::min(chunkSize, numSamples - start));
+        }
+
+        double worstError = 0;
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            for (int i = 0; i < numSamples; i++)
+                worstError = std::max(worstError, std::fabs(output[ch][i] - expected[ch][i]));
+        }
+
+        if (worstError > tolerance * rms)
+        {
+            std::fprintf(stderr, "%s filter bank: error %g exceeds %g (output RMS %g)\n",
+                         getSimdLevelName(simdLevel), worstError, tolerance * rms, rms);
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+/** One configuration of the whole pipeline */
+struct PipelineSetup
+{
+    const char* name;
+    FilterEngine engine;
+    bool decimate;
+    WindowProfile profile;
+    WindowStorage storage;
+};
+
+/** Runs every channel through one core, chunkSize samples at a time, returning the envelopes
+    followed by the band sums. With inPlace the envelopes overwrite the input, as the plugin does. */
+static std::vector<std::vector<float>> runPipeline(const PipelineSetup& setup,
+                                                   const std::vector<std::vector<float>>& channels,
+                                                   double sampleRate, int chunkSize, bool inPlace = false)
+{
+    std::vector<BandSpec> bands;
+    parseBandTable(defaultBandTable, bands);
+
+    const int numChannels = int(channels.size());
+    const int numSamples = int(channels[0].size());
+
+    IntegratorCore core;
+    core.prepare(numChannels);
+    core.setBands(sampleRate, bands);
+
+    double highestFrequency = 0;
+
+    for (const BandSpec& band : bands)
+        highestFrequency = std::max(highestFrequency, band.highCut);
+
+    core.setEngine(setup.engine, 256);
+    core.setDecimation(setup.decimate ? IntegratorCore::chooseDecimation(sampleRate, highestFrequency) : 1);
+
+    // a window that no chunk size divides
+    core.setWindowSamples(int(sampleRate * 0.7) + 3);
+    core.setWindowProfile(setup.profile);
+    core.setWindowStorage(setup.storage);
+    core.setNumChannels(numChannels);
+
+    std::vector<std::vector<float>> results(2 * numChannels, std::vector<float>(numSamples));
+
+    if (inPlace)
+        std::copy(channels.begin(), channels.end(), results.begin());
+
+    std::vector<const float*> inputs(numChannels);
+    std::vector<float*> outputs(numChannels);
+    std::vector<float*> sums(numChannels);
+
+    for (int start = 0; start < numSamples; start += chunkSize)
+    {
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            inputs[ch] = (inPlace ? results[ch] : channels[ch]).data() + start;
+            outputs[ch] = results[ch].data() + start;
+            sums[ch] = results[numChannels + ch].data() + start;
+        }
+
+        core.process(inputs.data(), outputs.data(), std::min(chunkSize, numSamples - start), sums.data());
+    }
+
+    return results;
+}
+
+/**
+    The whole pipeline with the recording fed 1, 64, 1024 and 10000 samples at a
+    time, for each filter engine, with and without decimation and for several
+    windows: the envelopes and band sums must be identical to the bit.
+ */
+static bool testBlockSizeInvariance(const std::string& recordingDirectory)
+{
+    std::vector<std::vector<float>> channels;
+    double sampleRate;
+
+    if (! readRecording(recordingDirectory, channels, sampleRate))
+        return false;
+
+    const PipelineSetup setups[] =
+    {
+        { "iir", FilterEngine::IIR, false, WindowProfile::QUADRATIC, WindowStorage::DOUBLE },
+        { "iir, decimated", FilterEngine::IIR, true, WindowProfile::QUADRATIC, WindowStorage::DOUBLE },
+        { "fft", FilterEngine::FFT, false, WindowProfile::QUADRATIC, WindowStorage::DOUBLE },
+        { "iir, exponential window", FilterEngine::IIR, false, WindowProfile::EXPONENTIAL, WindowStorage::DOUBLE },
+        { "iir, savitzky-golay window", FilterEngine::IIR, false, WindowProfile::SAVITZKY_GOLAY, WindowStorage::DOUBLE },
+        { "iir, int16 window", FilterEngine::IIR, false, WindowProfile::QUADRATIC, WindowStorage::INT16 },
+    };
+
+    bool passed = true;
+
+    for (const PipelineSetup& setup : setups)
+    {
+        const std::vector<std::vector<float>> reference = runPipeline(setup, channels, sampleRate, 1);
+
+        const struct { int chunkSize; bool inPlace; } runs[] =
+        {
+            { 64, false }, { 1024, false }, { 10000, false }, { 1024, true }
+        };
+
+        for (const auto& run : runs)
+        {
+            const int chunkSize = run.chunkSize;
+            const bool inPlace = run.inPlace;
+            const std::vector<std::vector<float>> results = runPipeline(setup, channels, sampleRate, chunkSize, inPlace);
+
+            for (size_t row = 0; row < results.size(); row++)
+            {
+                const auto mismatch = std::mismatch(results[row].begin(), results[row].end(), reference[row].begin());
+
+                if (mismatch.first != results[row].end())
+                {
+                    const int channel = int(row % channels.size());
+                    const int sample = int(mismatch.first - results[row].begin());
+
+                    std::fprintf(stderr, "%s: the %s of channel %d in chunks of %d%s first differs from chunks of 1 "
+                                         "at sample %d (%.9g instead of %.9g)\n",
+                                 setup.name, row < channels.size() ? "envelope" : "band sum", channel, chunkSize,
+                                 inPlace ? " in place" : "", sample, *mismatch.first, *mismatch.second);
+                    passed = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    return passed;
+}
+
+/**
+    The reduced-precision window storages against the double one, fed the
+    absolute derivative of the band sum of each channel of the recording, as
+    the pipeline feeds the window. As the weights are positive and sum to one,
+    the error of each average is at most the rounding of one stored sample,
+    whose step follows the largest sample in the window now or when it last
+    wrapped; on top of that comes the rounding of the float output.
+ */
+static bool testWindowStorageError(const std::string& recordingDirectory)
+{
+    std::vector<std::vector<float>> channels;
+    double sampleRate;
+
+    if (! readRecording(recordingDirectory, channels, sampleRate))
+        return false;
+
+    struct StorageBound
+    {
+        WindowStorage storage;
+        int bits;               // resolution relative to the largest recent sample
+        double relativeRms;     // RMS error relative to the RMS of the double envelope
+    };
+
+    const StorageBound bounds[] =
+    {
+        { WindowStorage::FLOAT, 23, 1e-6 },
+        { WindowStorage::INT32, 23, 1e-6 },
+        { WindowStorage::INT16, 12, 5e-5 },
+    };
+
+    // not a power of two, so that float storage has to round
+    const double inputScale = 0.1;
+
+    const int numChannels = int(channels.size());
+    const int numSamples = int(channels[0].size());
+
+    const PipelineSetup setup = { "iir", FilterEngine::IIR, false, WindowProfile::QUADRATIC, WindowStorage::DOUBLE };
+    const std::vector<std::vector<float>> pipeline = runPipeline(setup, channels, sampleRate, 1024);
+
+    bool passed = true;
+
+    for (int ch = 0; ch < numChannels; ch++)
+    {
+        const std::vector<float>& sums = pipeline[numChannels + ch];
+        std::vector<float> input(numSamples, 0.0f);
+
+        for (int i = 1; i < numSamples; i++)
+            input[i] = std::fabs(sums[i] - sums[i - 1]);
+
+        for (WindowProfile profile : { WindowProfile::RECTANGULAR, WindowProfile::QUADRATIC, WindowProfile::EXPONENTIAL })
+        {
+            for (int windowSize : { 1, 100, 2000, 20000 })
+            {
+                RollingAverage reference;
+                reference.setSize(windowSize, profile, WindowStorage::DOUBLE);
+
+                std::vector<float> expected(numSamples);
+                reference.process(input.data(), expected.data(), numSamples, inputScale, 1.0f);
+
+                for (const StorageBound& bound : bounds)
+                {
+                    RollingAverage average;
+                    average.setSize(windowSize, profile, bound.storage);
+
+                    std::vector<float> output(numSamples);
+                    average.process(input.data(), output.data(), numSamples, inputScale, 1.0f);
+
+                    // indices of the largest input over the last two windows, largest first
+                    std::deque<int> peaks;
+                    double worstExcess = 0, sumErrorSquared = 0, sumSquared = 0;
+
+                    for (int i = 0; i < numSamples; i++)
+                    {
+                        while (! peaks.empty() && input[peaks.back()] <= input[i])
+                            peaks.pop_back();
+
+                        peaks.push_back(i);
+
+                        while (peaks.front() < i - 2 * windowSize)
+                            peaks.pop_front();
+
+                        const double error = std::fabs(double(output[i]) - expected[i]);
+                        const double limit = std::ldexp(inputScale * input[peaks.front()], -bound.bits)
+                                           + std::ldexp(std::fabs(double(expected[i])), -23);
+
+                        worstExcess = std::max(worstExcess, error - limit);
+                        sumErrorSquared += error * error;
+                        sumSquared += double(expected[i]) * expected[i];
+                    }
+
+                    const double relativeRms = sumSquared > 0 ? std::sqrt(sumErrorSquared / sumSquared) : 0.0;
+
+                    if (worstExcess > 0 || relativeRms > bound.relativeRms)
+                    {
+                        std::fprintf(stderr, "channel %d, %s window of %d samples, %s storage: %s (RMS error %g, limit %g)\n",
+                                     ch, getWindowProfileName(profile), windowSize, getWindowStorageName(bound.storage),
+                                     worstExcess > 0 ? "a sample exceeds the rounding bound" : "RMS error too large",
+                                     relativeRms, bound.relativeRms);
+                        passed = false;
+                    }
+                }
+            }
+        }
+    }
+
+    return passed;
+}
+
+/** A crossing at an absolute sample position, for comparing detections made block by block */
+struct DetectedCrossing
+{
+    int64_t sample;
+    bool rising;
+
+    bool operator== (const DetectedCrossing& other) const { return sample == other.sample && rising == other.rising; }
+};
+
+/** Runs one channel's envelope through a detector chunkSize samples at a time */
+static std::vector<DetectedCrossing> runDetector(const DetectorSettings& settings, const std::vector<float>& envelope,
+                                                 int chunkSize)
+{
+    ThresholdDetector detector;
+    detector.setNumChannels(1);
+    detector.setSettings(settings);
+
+    std::vector<DetectedCrossing> detected;
+
+    for (size_t start = 0; start < envelope.size(); start += size_t(chunkSize))
+    {
+        const int numSamples = int(std::min(envelope.size() - start, size_t(chunkSize)));
+
+        detector.beginBlock();
+        detector.process(0, envelope.data() + start, numSamples, 0);
+
+        for (int i = 0; i < detector.getNumCrossings(0); i++)
+            detected.push_back({ int64_t(start) + detector.getCrossings(0)[i].sample, detector.getCrossings(0)[i].rising });
+    }
+
+    return detected;
+}
+
+/** The detector's rules applied one sample at a time */
+static std::vector<DetectedCrossing> detectReference(const DetectorSettings& settings, const std::vector<float>& envelope)
+{
+    std::vector<DetectedCrossing> detected;
+
+    bool active = false;
+    int64_t nextStart = 0;
+
+    for (int64_t i = 0; i < int64_t(envelope.size()); i++)
+    {
+        if (active && envelope[size_t(i)] < settings.threshold - settings.hysteresis)
+        {
+            active = false;
+            detected.push_back({ i, false });
+        }
+        else if (! active && i >= nextStart && envelope[size_t(i)] >= settings.threshold)
+        {
+            active = true;
+            nextStart = i + settings.refractorySamples;
+            detected.push_back({ i, true });
+        }
+    }
+
+    return detected;
+}
+
+/**
+    The threshold detector: hysteresis and the refractory period on short
+    envelopes worked out by hand, the crossings of a long noisy envelope against
+    the rules applied one sample at a time with every block size, and the
+    ending of events in progress when detection stops or the caller asks for it.
+ */
+static bool testThresholdDetector(const std::string&)
+{
+    bool passed = true;
+
+    auto check = [&] (const char* name, const std::vector<DetectedCrossing>& detected,
+                      const std::vector<DetectedCrossing>& expected)
+    {
+        if (detected == expected)
+            return;
+
+        size_t i = 0;
+
+        while (i < detected.size() && i < expected.size() && detected[i] == expected[i])
+            i++;
+
+        std::fprintf(stderr, "%s: %d crossings instead of %d, first difference at crossing %d",
+                     name, int(detected.size()), int(expected.size()), int(i));
+
+        if (i < expected.size())
+            std::fprintf(stderr, " (expected %s%lld)", expected[i].rising ? "+" : "-", (long long) expected[i].sample);
+
+        std::fprintf(stderr, "\n");
+        passed = false;
+    };
+
+    const std::vector<float> bumpy = { 0.0f, 1.2f, 0.95f, 1.1f, 0.85f, 0.0f, 1.0f, 0.0f };
+
+    DetectorSettings settings;
+    settings.enabled = true;
+    settings.threshold = 1.0f;
+
+    check("no hysteresis", runDetector(settings, bumpy, 8),
+          { { 1, true }, { 2, false }, { 3, true }, { 4, false }, { 6, true }, { 7, false } });
+
+    // the dip to 0.95 stays above 1 - 0.1, and a sample at the threshold starts an event
+    settings.hysteresis = 0.1f;
+
+    check("hysteresis", runDetector(settings, bumpy, 8),
+          { { 1, true }, { 4, false }, { 6, true }, { 7, false } });
+
+    // the event at 3 would start 2 samples after the one at 1; the one at 6 is 5 samples after
+    settings.hysteresis = 0.0f;
+    settings.refractorySamples = 3;
+
+    check("refractory period", runDetector(settings, bumpy, 8),
+          { { 1, true }, { 2, false }, { 6, true }, { 7, false } });
+
+    // a refractory period that runs over into the next blocks
+    check("refractory period in 1-sample blocks", runDetector(settings, bumpy, 1),
+          { { 1, true }, { 2, false }, { 6, true }, { 7, false } });
+
+    // a slow oscillation with noise, which crosses both levels a few times around each peak (but
+    // less than maxCrossingsPerChannel times in the longest block)
+    std::vector<float> envelope(50000);
+    uint32_t seed = 12345;
+
+    for (size_t i = 0; i < envelope.size(); i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        const float noise = float(seed >> 8) / float(1 << 24) - 0.5f;
+
+        envelope[i] = 1.0f + 0.5f * float(std::sin(2 * pi * double(i) / 700)) + 0.1f * noise;
+    }
+
+    for (const DetectorSettings& noisy : { DetectorSettings { true, 1.2f, 0.0f, 0 },
+                                           DetectorSettings { true, 1.2f, 0.2f, 0 },
+                                           DetectorSettings { true, 1.2f, 0.2f, 300 },
+                                           DetectorSettings { true, 1.2f, 0.0f, 1000 } })
+    {
+        const std::vector<DetectedCrossing> expected = detectReference(noisy, envelope);
+
+        // at most maxCrossingsPerChannel crossings fit in a block, so the largest block is kept short
+        for (int chunkSize : { 1, 7, 64, 256, 1000 })
+        {
+            char name[128];
+            std::snprintf(name, sizeof(name), "threshold %g, hysteresis %g, refractory %d, %d-sample blocks",
+                          noisy.threshold, noisy.hysteresis, noisy.refractorySamples, chunkSize);
+
+            check(name, runDetector(noisy, envelope, chunkSize), expected);
+        }
+    }
+
+    // events in progress are ended once, at the start of the next block
+    ThresholdDetector detector;
+    detector.setNumChannels(2);
+    settings = DetectorSettings { true, 1.0f, 0.0f, 0 };
+    detector.setSettings(settings);
+
+    const float high[] = { 2.0f, 2.0f };
+    const float low[] = { 0.0f, 0.0f };
+
+    detector.beginBlock();
+    detector.process(0, high, 2, 0);
+    detector.process(1, low, 2, 0);
+
+    ThresholdDetector wider;
+    wider.setNumChannels(3);
+
+    if (wider.takeStateFrom(detector) || ! detector.isEventActive(0))
+    {
+        std::fprintf(stderr, "a detector with another channel count took over the events in progress\n");
+        passed = false;
+    }
+
+    detector.beginBlock(true);
+
+    if (detector.getNumCrossings(0) != 1 || detector.getCrossings(0)[0].sample != 0 || detector.getCrossings(0)[0].rising
+        || detector.getNumCrossings(1) != 0 || detector.isEventActive(0))
+    {
+        std::fprintf(stderr, "the events in progress were not ended at the start of the block\n");
+        passed = false;
+    }
+
+    detector.beginBlock(true);
+
+    if (detector.getNumCrossings(0) != 0)
+    {
+        std::fprintf(stderr, "an event was ended twice\n");
+        passed = false;
+    }
+
+    // turning detection off ends the events in progress in the same way
+    detector.beginBlock();
+    detector.process(1, high, 2, 0);
+
+    settings.enabled = false;
+    detector.setSettings(settings);
+    detector.beginBlock();
+
+    if (detector.getNumCrossings(1) != 1 || detector.getCrossings(1)[0].rising || detector.isEventActive(1))
+    {
+        std::fprintf(stderr, "disabling detection did not end the event in progress\n");
+        passed = false;
+    }
+
+    return passed;
+}
+
+/**
+    A change of settings hands the state of the running core to its replacement: a
+    core that defers its windows and FFT history and takes over a running core's
+    must continue its output exactly, with either filter engine. RcuPointer must hand a snapshot that is replaced before it is
+    picked up over to its replacement, and free retired snapshots on reclaim().
+ */
+static bool testStateHandover(const std::string&)
+{
+    bool passed = true;
+
+    const int numChannels = 3;
+    const double sampleRate = 2000.0;
+    const int numSamples = 20000;
+    const int handover = 7001;
+    const int chunkSize = 1000;
+
+    std::vector<std::vector<float>> channels(numChannels, std::vector<float>(numSamples));
+    uint32_t seed = 12345;
+
+    for (int ch = 0; ch < numChannels; ch++)
+    {
+        for (int i = 0; i < numSamples; i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            const float noise = float(seed >> 8) / float(1 << 24) - 0.5f;
+
+            channels[ch][i] = float(std::sin(2 * pi * 7.5 * i / sampleRate) * (1 + std::sin(2 * pi * 0.3 * i / sampleRate)))
+                            + 0.5f * float(std::sin(2 * pi * (2.0 + ch) * i / sampleRate)) + 0.2f * noise;
+        }
+    }
+
+    std::vector<BandSpec> bands;
+    parseBandTable(defaultBandTable, bands);
+
+    // the replacement differs in its threshold, which leaves the window and the filters as they are
+    auto configure = [&](IntegratorCore& core, FilterEngine engine, float threshold, bool deferState)
+    {
+        core.prepare(numChannels);
+        core.setBands(sampleRate, bands);
+        core.setEngine(engine, 256);
+        core.setWindowSamples(int(sampleRate * 0.7) + 3);
+        core.setDetectorSettings(DetectorSettings { true, threshold, 0.0f, 0 });
+
+        if (deferState)
+        {
+            core.deferWindows();
+
+            if (engine == FilterEngine::FFT)
+                core.deferFftState();
+        }
+
+        core.setNumChannels(numChannels);
+    };
+
+    auto run = [&](IntegratorCore& core, std::vector<std::vector<float>>& results, int start, int end)
+    {
+        std::vector<const float*> inputs(numChannels);
+        std::vector<float*> outputs(numChannels);
+
+        for (int first = start; first < end; first += chunkSize)
+        {
+            for (int ch = 0; ch < numChannels; ch++)
+            {
+                inputs[ch] = channels[ch].data() + first;
+                outputs[ch] = results[ch].data() + first;
+            }
+
+            core.process(inputs.data(), outputs.data(), std::min(chunkSize, end - first), nullptr);
+        }
+    };
+
+    for (FilterEngine engine : { FilterEngine::IIR, FilterEngine::FFT })
+    {
+        const char* engineName = engine == FilterEngine::FFT ? "fft" : "iir";
+
+        std::vector<std::vector<float>> reference(numChannels, std::vector<float>(numSamples));
+        std::vector<std::vector<float>> handedOver(numChannels, std::vector<float>(numSamples));
+
+        IntegratorCore uninterrupted;
+        configure(uninterrupted, engine, 1.0f, false);
+        run(uninterrupted, reference, 0, numSamples);
+
+        IntegratorCore running;
+        configure(running, engine, 1.0f, false);
+        run(running, handedOver, 0, handover);
+
+        IntegratorCore replacement;
+        configure(replacement, engine, 2.0f, true);
+
+        if (! replacement.hasSameWindow(running)
+            || replacement.hasSameFftLayout(running) != (engine == FilterEngine::FFT))
+        {
+            std::fprintf(stderr, "%s: a core that only differs in its threshold does not have the same window "
+                                 "or FFT layout\n", engineName);
+            passed = false;
+        }
+
+        replacement.takeStateFrom(running);
+        run(replacement, handedOver, handover, numSamples);
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            const auto mismatch = std::mismatch(handedOver[ch].begin(), handedOver[ch].end(), reference[ch].begin());
+
+            if (mismatch.first != handedOver[ch].end())
+            {
+                std::fprintf(stderr, "%s: channel %d of a core with deferred state first differs from an "
+                                     "uninterrupted core at sample %d (%.9g instead of %.9g)\n",
+                             engineName, ch, int(mismatch.first - handedOver[ch].begin()),
+                             *mismatch.first, *mismatch.second);
+                passed = false;
+            }
+        }
+    }
+
+    // snapshots that record what they were handed and when they are deleted
+    struct Snapshot
+    {
+        int id;
+        std::vector<int>* deleted;
+
+        ~Snapshot() { deleted->push_back(id); }
+    };
+
+    std::vector<int> deleted;
+    std::vector<std::pair<int, int>> adopted;
+
+    {
+        RcuPointer<Snapshot> pointer;
+
+        auto adopt = [&](Snapshot& next, Snapshot& previous) { adopted.push_back(std::make_pair(next.id, previous.id)); };
+        auto publish = [&](int id) { pointer.publish(std::unique_ptr<Snapshot>(new Snapshot { id, &deleted }), adopt); };
+
+        publish(1);
+        const int first = pointer.acquire(adopt)->id;
+
+        // 2 is replaced before the processing thread picks it up, so it hands over to 3 at once
+        publish(2);
+        publish(3);
+
+        const std::vector<std::pair<int, int>> droppedHandover = adopted;
+        const std::vector<int> droppedDeleted = deleted;
+
+        const int second = pointer.acquire(adopt)->id;
+        const std::vector<int> retiredDeleted = deleted;
+
+        pointer.reclaim();
+
+        const std::vector<std::pair<int, int>> expectedAdopted = { { 3, 2 }, { 3, 1 } };
+
+        if (first != 1 || second != 3 || pointer.getPublished()->id != 3
+            || droppedHandover != std::vector<std::pair<int, int>> { { 3, 2 } } || droppedDeleted != std::vector<int> { 2 }
+            || adopted != expectedAdopted || retiredDeleted != std::vector<int> { 2 } || deleted != std::vector<int> { 2, 1 })
+        {
+            std::fprintf(stderr, "RcuPointer picked up %d then %d, handed over", first, second);
+
+            for (const auto& handover : adopted)
+                std::fprintf(stderr, " %d to %d", handover.second, handover.first);
+
+            std::fprintf(stderr, ", and deleted");
+
+            for (int id : deleted)
+                std::fprintf(stderr, " %d", id);
+
+            std::fprintf(stderr, "; expected 1 then 3, 2 to 3 and 1 to 3, and 2 then 1 after reclaim()\n");
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+/**
+    The FFT engine against the IIR engine it is built from: on the recording, with the default
+    bands, their band sums and envelopes must agree once the FFT engine's delay of one hop is
+    allowed for. For bands that ring for longer than the longest kernel, the disagreement on
+    white noise must be what getFftTruncationError() reports, and exceed the tolerance at which
+    the plugin declines the FFT engine.
+ */
+static bool testFftEngine(const std::string& recordingDirectory)
+{
+    std::vector<std::vector<float>> channels;
+    double sampleRate;
+
+    if (! readRecording(recordingDirectory, channels, sampleRate))
+        return false;
+
+    const int hopSize = 256;
+
+    // runs one channel through a core, returning its envelope followed by its band sum
+    auto run = [&](const std::vector<float>& input, double rate, const char* bandTable, FilterEngine engine)
+    {
+        std::vector<BandSpec> bands;
+        parseBandTable(bandTable, bands);
+
+        IntegratorCore core;
+        core.prepare(1);
+        core.setBands(rate, bands);
+        core.setEngine(engine, hopSize);
+        core.setWindowSamples(int(rate * 0.5));
+        core.setNumChannels(1);
+
+        std::vector<std::vector<float>> results(2, std::vector<float>(input.size()));
+        const float* in = input.data();
+        float* out = results[0].data();
+        float* sums = results[1].data();
+
+        core.process(&in, &out, int(input.size()), &sums);
+
+        return std::make_pair(results, core.getFftTruncationError());
+    };
+
+    // the energy of the difference over the energy of the IIR engine's output, from a given sample
+    auto getError = [&](const std::vector<float>& fft, const std::vector<float>& iir, size_t start)
+    {
+        double energy = 0.0;
+        double errorEnergy = 0.0;
+
+        for (size_t i = start; i + hopSize < iir.size(); i++)
+        {
+            const double error = double(fft[i + hopSize]) - iir[i];
+
+            energy += double(iir[i]) * iir[i];
+            errorEnergy += error * error;
+        }
+
+        return errorEnergy / energy;
+    };
+
+    bool passed = true;
+
+    for (size_t ch = 0; ch < channels.size(); ch++)
+    {
+        const auto iir = run(channels[ch], sampleRate, defaultBandTable, FilterEngine::IIR);
+        const auto fft = run(channels[ch], sampleRate, defaultBandTable, FilterEngine::FFT);
+
+        const double sumError = getError(fft.first[1], iir.first[1], 0);
+        const double envelopeError = getError(fft.first[0], iir.first[0], 0);
+
+        if (fft.second > IntegratorCore::maxFftTruncationError
+            || sumError > IntegratorCore::maxFftTruncationError || envelopeError > IntegratorCore::maxFftTruncationError)
+        {
+            std::fprintf(stderr, "channel %d: the FFT engine's band sum differs from the IIR engine's by %.3g and "
+                                 "its envelope by %.3g of their energy, with a truncation error of %.3g\n",
+                         int(ch), sumError, envelopeError, fft.second);
+            passed = false;
+        }
+    }
+
+    // white noise at 30 kHz, so that the error energy of the output is that of the kernel once
+    // the part of the response it is measured over has passed; the tails ring at the lowest
+    // band's frequency, so only a few of their cycles are compared and the two agree loosely
+    const double highRate = 30000.0;
+    const size_t settled = 2 * IntegratorCore::maxKernelLength;
+    std::vector<float> noise(4 * settled);
+    uint32_t seed = 12345;
+
+    for (float& sample : noise)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        sample = float(seed >> 8) / float(1 << 24) - 0.5f;
+    }
+
+    for (const char* bandTable : { "0.5:4:1", "1:2:1:8" })
+    {
+        const auto iir = run(noise, highRate, bandTable, FilterEngine::IIR);
+        const auto fft = run(noise, highRate, bandTable, FilterEngine::FFT);
+
+        const double sumError = getError(fft.first[1], iir.first[1], settled);
+
+        if (fft.second <= IntegratorCore::maxFftTruncationError || sumError < 0.25 * fft.second || sumError > 4 * fft.second)
+        {
+            std::fprintf(stderr, "bands %s at %g Hz: the FFT engine's band sum differs from the IIR engine's by %.3g "
+                                 "of its energy, but the truncation error is reported as %.3g\n",
+                         bandTable, highRate, sumError, fft.second);
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+/**
+    Batches of 1 to 64 tasks on a pool of four threads: every task must run
+    exactly once per batch, with the caller's floating-point mode, and heap
+    activity of a task on a worker must show in the caller's real-time scope
+    (when allocation tracking is compiled in).
+ */
+static bool testWorkerPool(const std::string&)
+{
+    WorkerPool pool(4);
+
+    std::vector<std::atomic<int>> runs(64);
+    std::atomic<int> wrongMode { 0 };
+
+#if MBI_SIMD_X86
+    // flush-to-zero, as the GUI sets it on the processing thread
+    const unsigned int callerMode = _mm_getcsr();
+    _mm_setcsr(callerMode | 0x8040);
+    const unsigned int batchMode = _mm_getcsr();
+#endif
+
+    bool passed = true;
+
+    for (int batch = 0; batch < 20000 && passed; batch++)
+    {
+        const int numTasks = 1 + batch % 64;
+
+        auto task = [&] (int index)
+        {
+            runs[size_t(index)].fetch_add(1, std::memory_order_relaxed);
+#if MBI_SIMD_X86
+            if (_mm_getcsr() != batchMode)
+                wrongMode.fetch_add(1, std::memory_order_relaxed);
+#endif
+        };
+
+        pool.run(numTasks, task);
+
+        for (int i = 0; i < 64; i++)
+        {
+            const int expected = i < numTasks ? 1 : 0;
+
+            if (runs[size_t(i)].exchange(0, std::memory_order_relaxed) != expected)
+            {
+                std::fprintf(stderr, "batch %d of %d tasks: task %d did not run exactly once\n", batch, numTasks, i);
+                passed = false;
+            }
+        }
+    }
+
+#if MBI_SIMD_X86
+    _mm_setcsr(callerMode);
+#endif
+
+    if (wrongMode.load() != 0)
+    {
+        std::fprintf(stderr, "%d tasks ran without the caller's floating-point mode\n", wrongMode.load());
+        passed = false;
+    }
+
+    // sanitizers replace operator new themselves, and then nothing is tracked on any thread
+    bool tracking = false;
+
+    if (AllocationTracker::isEnabled())
+    {
+        AllocationTracker::RealtimeScope realtimeScope;
+        delete new int(0);
+        tracking = realtimeScope.hasTouchedHeap();
+    }
+
+    if (tracking)
+    {
+        const std::thread::id caller = std::this_thread::get_id();
+        std::atomic<bool> allocatedOnWorker { false };
+
+        bool touchedHeap = false;
+
+        for (int attempt = 0; attempt < 1000 && ! allocatedOnWorker.load(); attempt++)
+        {
+            AllocationTracker::RealtimeScope realtimeScope;
+
+            auto task = [&] (int)
+            {
+                if (std::this_thread::get_id() != caller)
+                {
+                    delete new int(0);
+                    allocatedOnWorker.store(true);
+                }
+            };
+
+            pool.run(64, task);
+
+            touchedHeap = realtimeScope.hasTouchedHeap();
+        }
+
+        if (allocatedOnWorker.load() && ! touchedHeap)
+        {
+            std::fprintf(stderr, "an allocation on a worker was not seen by the caller's real-time scope\n");
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+struct TestCase
+{
+    const char* name;
+    bool (*run)(const std::string& recordingDirectory);
+};
+
+static const TestCase testCases[] =
+{
+    { "rolling-average-brute-force", testRollingAverageBruteForce },
+    { "savitzky-golay-fit", testSavitzkyGolayFit },
+    { "band-pass-design", testBandPassDesign },
+    { "band-table", testBandTable },
+    { "band-filter-bank", testBandFilterBank },
+    { "block-size-invariance", testBlockSizeInvariance },
+    { "window-storage-error", testWindowStorageError },
+    { "threshold-detector", testThresholdDetector },
+    { "worker-pool", testWorkerPool },
+    { "state-handover", testStateHandover },
+    { "fft-engine", testFftEngine },
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::printf("Usage: mbi-tests <test name> [recording directory]\n\nTests:\n");
+
+        for (const TestCase& test : testCases)
+            std::printf("  %s\n", test.name);
+
+        return 1;
+    }
+
+    const std::string recordingDirectory = argc > 2 ? argv[2] : "";
+
+    for (const TestCase& test : testCases)
+    {
+        if (std::strcmp(test.name, argv[1]) == 0)
+        {
+            const bool passed = test.run(recordingDirectory);
+            std::printf("%s: %s\n", test.name, passed ? "passed" : "FAILED");
+            return passed ? 0 : 1;
+        }
+    }
+
+    std::fprintf(stderr, "Unknown test %s\n", argv[1]);
+    return 1;
+}
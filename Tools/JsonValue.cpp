@@ -0,0 +1,585 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "JsonValue.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+JsonValue::JsonValue() : type(NUL), boolValue(false), numberValue(0) { }
+JsonValue::JsonValue(bool value) : type(BOOLEAN), boolValue(value), numberValue(0) { }
+JsonValue::JsonValue(int value) : type(NUMBER), boolValue(false), numberValue(value) { }
+JsonValue::JsonValue(double value) : type(NUMBER), boolValue(false), numberValue(value) { }
+JsonValue::JsonValue(const char* value) : type(STRING), boolValue(false), numberValue(0), stringValue(value) { }
+JsonValue::JsonValue(const std::string& value) : type(STRING), boolValue(false), numberValue(0), stringValue(value) { }
+
+JsonValue JsonValue::array()
+{
+    JsonValue value;
+    value.type = ARRAY;
+    return value;
+}
+
+JsonValue JsonValue::object()
+{
+    JsonValue value;
+    value.type = OBJECT;
+    return value;
+}
+
+bool JsonValue::getBool(bool fallback) const
+{
+    return type == BOOLEAN ? boolValue : fallback;
+}
+
+double JsonValue::getNumber(double fallback) const
+{
+    return type == NUMBER ? numberValue : fallback;
+}
+
+std::string JsonValue::getString(const std::string& fallback) const
+{
+    return type == STRING ? stringValue : fallback;
+}
+
+void JsonValue::append(const JsonValue& value)
+{
+    elements.push_back(value);
+}
+
+const JsonValue& JsonValue::operator[](const std::string& key) const
+{
+    static const JsonValue null;
+
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] == key)
+            return elements[i];
+    }
+
+    return null;
+}
+
+bool JsonValue::hasMember(const std::string& key) const
+{
+    for (const std::string& name : keys)
+    {
+        if (name == key)
+            return true;
+    }
+
+    return false;
+}
+
+void JsonValue::setMember(const std::string& key, const JsonValue& value)
+{
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] == key)
+        {
+            elements[i] = value;
+            return;
+        }
+    }
+
+    keys.push_back(key);
+    elements.push_back(value);
+}
+
+/** Recursive-descent parser over the whole document */
+class JsonValue::Parser
+{
+public:
+
+    Parser(const std::string& text_) : text(text_), position(0) { }
+
+    bool parseDocument(JsonValue& result)
+    {
+        if (! parseValue(result, 0))
+            return false;
+
+        skipWhitespace();
+
+        if (position != text.size())
+            return fail("unexpected text after the document");
+
+        return true;
+    }
+
+    std::string error;
+
+private:
+
+    static const int maxDepth = 256;
+
+    bool fail(const std::string& message)
+    {
+        error = message + " at offset " + std::to_string(position);
+        return false;
+    }
+
+    void skipWhitespace()
+    {
+        while (position < text.size()
+               && (text[position] == ' ' || text[position] == '\t'
+                   || text[position] == '\n' || text[position] == '\r'))
+            position++;
+    }
+
+    bool expect(const char* word)
+    {
+        for (const char* c = word; *c != 0; c++, position++)
+        {
+            if (position >= text.size() || text[position] != *c)
+                return fail(std::string("expected ") + word);
+        }
+
+        return true;
+    }
+
+    bool parseValue(JsonValue& value, int depth)
+    {
+        if (depth > maxDepth)
+            return fail("document nested too deeply");
+
+        skipWhitespace();
+
+        if (position >= text.size())
+            return fail("unexpected end of document");
+
+        const char c = text[position];
+
+        if (c == '{')
+            return parseObject(value, depth);
+
+        if (c == '[')
+            return parseArray(value, depth);
+
+        if (c == '"')
+        {
+            value = JsonValue();
+            value.type = STRING;
+            return parseString(value.stringValue);
+        }
+
+        if (c == 't')
+        {
+            value = JsonValue(true);
+            return expect("true");
+        }
+
+        if (c == 'f')
+        {
+            value = JsonValue(false);
+            return expect("false");
+        }
+
+        if (c == 'n')
+        {
+            value = JsonValue();
+            return expect("null");
+        }
+
+        return parseNumber(value);
+    }
+
+    bool parseObject(JsonValue& value, int depth)
+    {
+        value = JsonValue::object();
+        position++;
+
+        skipWhitespace();
+
+        if (position < text.size() && text[position] == '}')
+        {
+            position++;
+            return true;
+        }
+
+        while (true)
+        {
+            skipWhitespace();
+
+            if (position >= text.size() || text[position] != '"')
+                return fail("expected a member name");
+
+            std::string key;
+
+            if (! parseString(key))
+                return false;
+
+            skipWhitespace();
+
+            if (position >= text.size() || text[position] != ':')
+                return fail("expected ':'");
+
+            position++;
+
+            JsonValue member;
+
+            if (! parseValue(member, depth + 1))
+                return false;
+
+            value.keys.push_back(key);
+            value.elements.push_back(member);
+
+            skipWhitespace();
+
+            if (position < text.size() && text[position] == ',')
+            {
+                position++;
+                continue;
+            }
+
+            if (position < text.size() && text[position] == '}')
+            {
+                position++;
+                return true;
+            }
+
+            return fail("expected ',' or '}'");
+        }
+    }
+
+    bool parseArray(JsonValue& value, int depth)
+    {
+        value = JsonValue::array();
+        position++;
+
+        skipWhitespace();
+
+        if (position < text.size() && text[position] == ']')
+        {
+            position++;
+            return true;
+        }
+
+        while (true)
+        {
+            JsonValue element;
+
+            if (! parseValue(element, depth + 1))
+                return false;
+
+            value.elements.push_back(element);
+
+            skipWhitespace();
+
+            if (position < text.size() && text[position] == ',')
+            {
+                position++;
+                continue;
+            }
+
+            if (position < text.size() && text[position] == ']')
+            {
+                position++;
+                return true;
+            }
+
+            return fail("expected ',' or ']'");
+        }
+    }
+
+    bool parseHex(unsigned& codePoint)
+    {
+        if (position + 4 > text.size())
+            return fail("truncated escape");
+
+        codePoint = 0;
+
+        for (int i = 0; i < 4; i++)
+        {
+            const char c = text[position++];
+            codePoint <<= 4;
+
+            if (c >= '0' && c <= '9')
+                codePoint |= unsigned(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                codePoint |= unsigned(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                codePoint |= unsigned(c - 'A' + 10);
+            else
+                return fail("invalid escape");
+        }
+
+        return true;
+    }
+
+    static void appendUtf8(std::string& s, unsigned codePoint)
+    {
+        if (codePoint < 0x80)
+        {
+            s += char(codePoint);
+        }
+        else if (codePoint < 0x800)
+        {
+            s += char(0xc0 | (codePoint >> 6));
+            s += char(0x80 | (codePoint & 0x3f));
+        }
+        else if (codePoint < 0x10000)
+        {
+            s += char(0xe0 | (codePoint >> 12));
+            s += char(0x80 | ((codePoint >> 6) & 0x3f));
+            s += char(0x80 | (codePoint & 0x3f));
+        }
+        else
+        {
+            s += char(0xf0 | (codePoint >> 18));
+            s += char(0x80 | ((codePoint >> 12) & 0x3f));
+            s += char(0x80 | ((codePoint >> 6) & 0x3f));
+            s += char(0x80 | (codePoint & 0x3f));
+        }
+    }
+
+    bool parseString(std::string& s)
+    {
+        position++; // opening quote
+
+        while (position < text.size())
+        {
+            const char c = text[position++];
+
+            if (c == '"')
+                return true;
+
+            if (c != '\\')
+            {
+                s += c;
+                continue;
+            }
+
+            if (position >= text.size())
+                break;
+
+            const char escape = text[position++];
+
+            switch (escape)
+            {
+                case '"': s += '"'; break;
+                case '\\': s += '\\'; break;
+                case '/': s += '/'; break;
+                case 'b': s += '\b'; break;
+                case 'f': s += '\f'; break;
+                case 'n': s += '\n'; break;
+                case 'r': s += '\r'; break;
+                case 't': s += '\t'; break;
+                case 'u':
+                {
+                    unsigned codePoint = 0;
+
+                    if (! parseHex(codePoint))
+                        return false;
+
+                    // surrogate pair
+                    if (codePoint >= 0xd800 && codePoint < 0xdc00
+                        && position + 1 < text.size() && text[position] == '\\' && text[position + 1] == 'u')
+                    {
+                        position += 2;
+
+                        unsigned low = 0;
+
+                        if (! parseHex(low))
+                            return false;
+
+                        codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                    }
+
+                    appendUtf8(s, codePoint);
+                    break;
+                }
+                default:
+                    return fail("invalid escape");
+            }
+        }
+
+        return fail("unterminated string");
+    }
+
+    bool parseNumber(JsonValue& value)
+    {
+        const char* start = text.c_str() + position;
+        char* end = nullptr;
+
+        const double number = std::strtod(start, &end);
+
+        if (end == start)
+            return fail("unexpected character");
+
+        position += size_t(end - start);
+        value = JsonValue(number);
+
+        return true;
+    }
+
+    const std::string& text;
+    size_t position;
+};
+
+bool JsonValue::parse(const std::string& text, JsonValue& result, std::string& error)
+{
+    Parser parser(text);
+
+    if (parser.parseDocument(result))
+        return true;
+
+    error = parser.error;
+    return false;
+}
+
+static void writeString(std::string& text, const std::string& s)
+{
+    text += '"';
+
+    for (const char c : s)
+    {
+        switch (c)
+        {
+            case '"': text += "\\\""; break;
+            case '\\': text += "\\\\"; break;
+            case '\b': text += "\\b"; break;
+            case '\f': text += "\\f"; break;
+            case '\n': text += "\\n"; break;
+            case '\r': text += "\\r"; break;
+            case '\t': text += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20)
+                {
+                    char escape[8];
+                    std::snprintf(escape, sizeof(escape), "\\u%04x", unsigned(c));
+                    text += escape;
+                }
+                else
+                {
+                    text += c;
+                }
+        }
+    }
+
+    text += '"';
+}
+
+static void writeNumber(std::string& text, double number)
+{
+    char buffer[32];
+
+    if (! std::isfinite(number))
+    {
+        text += "null";
+        return;
+    }
+
+    if (number == std::floor(number) && std::fabs(number) < 1e15)
+    {
+        std::snprintf(buffer, sizeof(buffer), "%lld", (long long) number);
+        text += buffer;
+        return;
+    }
+
+    // shortest representation that reads back as the same value
+    for (int precision = 15; precision <= 17; precision++)
+    {
+        std::snprintf(buffer, sizeof(buffer), "%.*g", precision, number);
+
+        if (std::strtod(buffer, nullptr) == number)
+            break;
+    }
+
+    text += buffer;
+}
+
+void JsonValue::write(std::string& text, int indentSize, int depth) const
+{
+    const std::string indent(size_t(indentSize) * (depth + 1), ' ');
+    const std::string closingIndent(size_t(indentSize) * depth, ' ');
+
+    switch (type)
+    {
+        case NUL:
+            text += "null";
+            break;
+
+        case BOOLEAN:
+            text += boolValue ? "true" : "false";
+            break;
+
+        case NUMBER:
+            writeNumber(text, numberValue);
+            break;
+
+        case STRING:
+            writeString(text, stringValue);
+            break;
+
+        case ARRAY:
+            if (elements.empty())
+            {
+                text += "[]";
+                break;
+            }
+
+            text += "[\n";
+
+            for (size_t i = 0; i < elements.size(); i++)
+            {
+                text += indent;
+                elements[i].write(text, indentSize, depth + 1);
+                text += i + 1 < elements.size() ? ",\n" : "\n";
+            }
+
+            text += closingIndent + "]";
+            break;
+
+        case OBJECT:
+            if (elements.empty())
+            {
+                text += "{}";
+                break;
+            }
+
+            text += "{\n";
+
+            for (size_t i = 0; i < elements.size(); i++)
+            {
+                text += indent;
+                writeString(text, keys[i]);
+                text += ": ";
+                elements[i].write(text, indentSize, depth + 1);
+                text += i + 1 < elements.size() ? ",\n" : "\n";
+            }
+
+            text += closingIndent + "}";
+            break;
+    }
+}
+
+std::string JsonValue::toString(int indentSize) const
+{
+    std::string text;
+
+    write(text, indentSize, 0);
+    text += "\n";
+
+    return text;
+}
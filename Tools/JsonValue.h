@@ -0,0 +1,121 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef JSON_VALUE_H_INCLUDED
+#define JSON_VALUE_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+/**
+    A minimal JSON document model, enough to read and write structure.oebin
+    files without depending on JUCE. Object members keep their original order.
+ */
+class JsonValue
+{
+public:
+
+    enum Type
+    {
+        NUL,
+        BOOLEAN,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    /** Constructors */
+    JsonValue();
+    JsonValue(bool value);
+    JsonValue(int value);
+    JsonValue(double value);
+    JsonValue(const char* value);
+    JsonValue(const std::string& value);
+
+    /** Returns an empty array */
+    static JsonValue array();
+
+    /** Returns an empty object */
+    static JsonValue object();
+
+    /** Parses a document. Returns false and sets the error message on failure. */
+    static bool parse(const std::string& text, JsonValue& result, std::string& error);
+
+    /** Writes the value as indented text */
+    std::string toString(int indentSize = 3) const;
+
+    Type getType() const { return type; }
+
+    bool isNull() const { return type == NUL; }
+    bool isNumber() const { return type == NUMBER; }
+    bool isString() const { return type == STRING; }
+    bool isArray() const { return type == ARRAY; }
+    bool isObject() const { return type == OBJECT; }
+
+    /** Returns the value, or the fallback if the value has a different type */
+    bool getBool(bool fallback = false) const;
+    double getNumber(double fallback = 0.0) const;
+    std::string getString(const std::string& fallback = std::string()) const;
+
+    /** Returns the number of elements of an array or members of an object */
+    int size() const { return int(elements.size()); }
+
+    /** Returns an element of an array */
+    const JsonValue& operator[](int index) const { return elements[index]; }
+    JsonValue& operator[](int index) { return elements[index]; }
+
+    /** Appends an element to an array */
+    void append(const JsonValue& value);
+
+    /** Returns a member of an object, or a null value if there is no such member */
+    const JsonValue& operator[](const std::string& key) const;
+
+    /** Returns true if an object has a member with this name */
+    bool hasMember(const std::string& key) const;
+
+    /** Adds or replaces a member of an object */
+    void setMember(const std::string& key, const JsonValue& value);
+
+    /** Returns the member names of an object, in order */
+    const std::vector<std::string>& getMemberNames() const { return keys; }
+
+private:
+
+    class Parser;
+
+    void write(std::string& text, int indentSize, int depth) const;
+
+    Type type;
+    bool boolValue;
+    double numberValue;
+    std::string stringValue;
+
+    /** Elements of an array, or member values of an object */
+    std::vector<JsonValue> elements;
+
+    /** Member names of an object, parallel to elements */
+    std::vector<std::string> keys;
+};
+
+#endif
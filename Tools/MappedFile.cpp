@@ -0,0 +1,332 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "MappedFile.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#if ! defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0602
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0602 // PrefetchVirtualMemory needs Windows 8
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+    data(nullptr),
+    size(0),
+    mode(READ_ONLY),
+#ifdef _WIN32
+    file(INVALID_HANDLE_VALUE),
+    mapping(nullptr)
+#else
+    file(-1)
+#endif
+{
+
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::openForReading(const std::string& path)
+{
+    return map(path, READ_ONLY, 0);
+}
+
+bool MappedFile::create(const std::string& path, size_t newSize)
+{
+    return map(path, READ_WRITE, newSize);
+}
+
+/** Clamps a byte range to the mapping */
+static bool clampRange(size_t size, size_t& offset, size_t& length)
+{
+    if (offset >= size)
+        return false;
+
+    length = std::min(length, size - offset);
+
+    return length > 0;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::isOpen() const
+{
+    return file != INVALID_HANDLE_VALUE;
+}
+
+void MappedFile::setError(const std::string& message, const std::string& path)
+{
+    error = message + " " + path + " (error " + std::to_string(GetLastError()) + ")";
+}
+
+bool MappedFile::map(const std::string& path, Mode newMode, size_t newSize)
+{
+    close();
+
+    mode = newMode;
+
+    const bool writable = mode == READ_WRITE;
+
+    file = CreateFileA(path.c_str(),
+                       writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                       FILE_SHARE_READ,
+                       nullptr,
+                       writable ? CREATE_ALWAYS : OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL,
+                       nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        setError("Could not open", path);
+        return false;
+    }
+
+    if (writable)
+    {
+        size = newSize;
+    }
+    else
+    {
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        size = size_t(fileSize.QuadPart);
+    }
+
+    // an empty file cannot be mapped, but is still a valid (empty) file
+    if (size == 0)
+        return true;
+
+    const unsigned long long mappingSize = size;
+
+    mapping = CreateFileMappingA(file,
+                                 nullptr,
+                                 writable ? PAGE_READWRITE : PAGE_READONLY,
+                                 DWORD(mappingSize >> 32),
+                                 DWORD(mappingSize & 0xffffffff),
+                                 nullptr);
+
+    if (mapping == nullptr)
+    {
+        setError("Could not map", path);
+        close();
+        return false;
+    }
+
+    data = static_cast<char*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+
+    if (data == nullptr)
+    {
+        setError("Could not map", path);
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    data = nullptr;
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+    size = 0;
+}
+
+void MappedFile::adviseSequential()
+{
+    // Windows has no per-mapping read-ahead hint; prefetch() covers it
+}
+
+void MappedFile::prefetch(size_t offset, size_t length)
+{
+    if (data == nullptr || ! clampRange(size, offset, length))
+        return;
+
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = data + offset;
+    range.NumberOfBytes = length;
+
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::release(size_t offset, size_t length)
+{
+    // clean pages of a file mapping are simply trimmed from the working set
+    // under memory pressure, so there is nothing to do here
+    (void) offset;
+    (void) length;
+}
+
+#else
+
+bool MappedFile::isOpen() const
+{
+    return file >= 0;
+}
+
+void MappedFile::setError(const std::string& message, const std::string& path)
+{
+    error = message + " " + path + " (" + std::strerror(errno) + ")";
+}
+
+bool MappedFile::map(const std::string& path, Mode newMode, size_t newSize)
+{
+    close();
+
+    mode = newMode;
+
+    const bool writable = mode == READ_WRITE;
+
+    file = ::open(path.c_str(), writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+
+    if (file < 0)
+    {
+        setError("Could not open", path);
+        return false;
+    }
+
+    if (writable)
+    {
+        if (::ftruncate(file, off_t(newSize)) != 0)
+        {
+            setError("Could not resize", path);
+            close();
+            return false;
+        }
+
+        size = newSize;
+    }
+    else
+    {
+        struct stat status;
+
+        if (::fstat(file, &status) != 0)
+        {
+            setError("Could not read the size of", path);
+            close();
+            return false;
+        }
+
+        size = size_t(status.st_size);
+    }
+
+    // an empty file cannot be mapped, but is still a valid (empty) file
+    if (size == 0)
+        return true;
+
+    void* address = ::mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+
+    if (address == MAP_FAILED)
+    {
+        setError("Could not map", path);
+        close();
+        return false;
+    }
+
+    data = static_cast<char*>(address);
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data != nullptr)
+        ::munmap(data, size);
+
+    if (file >= 0)
+        ::close(file);
+
+    data = nullptr;
+    file = -1;
+    size = 0;
+}
+
+/** Rounds a range inside the mapping out to whole pages, as madvise() requires */
+static void* alignToPages(char* data, size_t& offset, size_t& length)
+{
+    static const size_t pageSize = size_t(::sysconf(_SC_PAGESIZE));
+
+    const size_t alignedOffset = offset - offset % pageSize;
+
+    length += offset - alignedOffset;
+    offset = alignedOffset;
+
+    return data + offset;
+}
+
+void MappedFile::adviseSequential()
+{
+    if (data != nullptr)
+        ::madvise(data, size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::prefetch(size_t offset, size_t length)
+{
+    if (data == nullptr || ! clampRange(size, offset, length))
+        return;
+
+    ::madvise(alignToPages(data, offset, length), length, MADV_WILLNEED);
+}
+
+void MappedFile::release(size_t offset, size_t length)
+{
+    // dropping pages of a writable mapping could discard data that has not been written back
+    if (data == nullptr || mode != READ_ONLY || ! clampRange(size, offset, length))
+        return;
+
+    void* start = alignToPages(data, offset, length);
+
+    // a partial last page may still be in use, so it is kept
+    static const size_t pageSize = size_t(::sysconf(_SC_PAGESIZE));
+
+    if (offset + length < size)
+        length -= length % pageSize;
+
+    if (length > 0)
+        ::madvise(start, length, MADV_DONTNEED);
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef MAPPED_FILE_H_INCLUDED
+#define MAPPED_FILE_H_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+/**
+    A file mapped into memory.
+
+    Read-only mappings let the operating system page a recording in on demand,
+    so even recordings much larger than RAM can be processed. Read-write
+    mappings create (or truncate) the file at a fixed size first.
+ */
+class MappedFile
+{
+public:
+
+    enum Mode
+    {
+        READ_ONLY,
+        READ_WRITE
+    };
+
+    /** Constructor */
+    MappedFile();
+
+    /** Destructor -- unmaps and closes the file */
+    ~MappedFile();
+
+    /** Maps an existing file for reading. Returns false and sets the error message on failure. */
+    bool openForReading(const std::string& path);
+
+    /** Creates a file of the given size and maps it for writing. Returns false and sets the error message on failure. */
+    bool create(const std::string& path, size_t size);
+
+    /** Unmaps and closes the file, flushing any changes */
+    void close();
+
+    /** Returns the start of the mapping, or nullptr if nothing is mapped */
+    const char* getData() const { return data; }
+
+    /** Returns the start of a writable mapping, or nullptr if the file is not mapped for writing */
+    char* getWritableData() { return mode == READ_WRITE ? data : nullptr; }
+
+    /** Returns the size of the file in bytes */
+    size_t getSize() const { return size; }
+
+    /** Returns true if a file is mapped */
+    bool isOpen() const;
+
+    /** Tells the operating system that the mapping will be read from start to end */
+    void adviseSequential();
+
+    /** Asks the operating system to start reading a byte range into memory */
+    void prefetch(size_t offset, size_t length);
+
+    /** Tells the operating system that a byte range of a read-only mapping will not be needed again */
+    void release(size_t offset, size_t length);
+
+    /** Returns a description of the last error */
+    const std::string& getError() const { return error; }
+
+private:
+
+    bool map(const std::string& path, Mode mode, size_t size);
+
+    void setError(const std::string& message, const std::string& path);
+
+    char* data;
+    size_t size;
+    Mode mode;
+
+    std::string error;
+
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#else
+    int file;
+#endif
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+#endif
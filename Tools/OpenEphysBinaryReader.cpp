@@ -0,0 +1,382 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "OpenEphysBinaryReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+NpyArray::NpyArray() :
+    elements(nullptr),
+    numElements(0),
+    kind('i'),
+    itemSize(8)
+{
+
+}
+
+bool NpyArray::fail(const std::string& message)
+{
+    error = message;
+    numElements = 0;
+    elements = nullptr;
+    file.close();
+
+    return false;
+}
+
+/** Returns the text of a field of the header dictionary, e.g. '<i8' for 'descr' */
+static std::string getHeaderField(const std::string& header, const std::string& key)
+{
+    const size_t keyPosition = header.find("'" + key + "'");
+
+    if (keyPosition == std::string::npos)
+        return std::string();
+
+    size_t start = header.find(':', keyPosition);
+
+    if (start == std::string::npos)
+        return std::string();
+
+    start = header.find_first_not_of(' ', start + 1);
+
+    if (start == std::string::npos)
+        return std::string();
+
+    size_t end;
+
+    if (header[start] == '\'')
+        end = header.find('\'', ++start);
+    else if (header[start] == '(')
+        end = header.find(')', ++start);
+    else
+        end = header.find_first_of(",}", start);
+
+    return end == std::string::npos ? std::string() : header.substr(start, end - start);
+}
+
+bool NpyArray::open(const std::string& path)
+{
+    if (! file.openForReading(path))
+        return fail(file.getError());
+
+    const char* data = file.getData();
+    const size_t size = file.getSize();
+
+    if (size < 10 || std::memcmp(data, "\x93NUMPY", 6) != 0)
+        return fail(path + " is not a .npy file");
+
+    const int majorVersion = (unsigned char) data[6];
+
+    size_t headerStart;
+    size_t headerLength;
+
+    if (majorVersion == 1)
+    {
+        headerStart = 10;
+        headerLength = size_t((unsigned char) data[8]) | size_t((unsigned char) data[9]) << 8;
+    }
+    else
+    {
+        headerStart = 12;
+
+        if (size < headerStart)
+            return fail(path + " is truncated");
+
+        headerLength = 0;
+
+        for (int i = 0; i < 4; i++)
+            headerLength |= size_t((unsigned char) data[8 + i]) << (8 * i);
+    }
+
+    if (headerStart + headerLength > size)
+        return fail(path + " is truncated");
+
+    const std::string header(data + headerStart, headerLength);
+
+    const std::string descr = getHeaderField(header, "descr");
+    const std::string shape = getHeaderField(header, "shape");
+
+    // only little-endian (or byte-sized) numbers, as written by NumPy on every platform we record on
+    if (descr.size() < 3 || (descr[0] != '<' && descr[0] != '|'))
+        return fail(path + " has an unsupported type " + descr);
+
+    kind = descr[1];
+    itemSize = std::atoi(descr.c_str() + 2);
+
+    const bool supported = (kind == 'f' && (itemSize == 4 || itemSize == 8))
+                        || ((kind == 'i' || kind == 'u') && (itemSize == 1 || itemSize == 2 || itemSize == 4 || itemSize == 8));
+
+    if (! supported)
+        return fail(path + " has an unsupported type " + descr);
+
+    // one dimension, or a column of a two-dimensional array with one column
+    int64_t count = 1;
+    int numDimensions = 0;
+
+    std::stringstream dimensions(shape);
+    std::string dimension;
+
+    while (std::getline(dimensions, dimension, ','))
+    {
+        if (dimension.find_first_not_of(' ') == std::string::npos)
+            continue;
+
+        const long long length = std::atoll(dimension.c_str());
+
+        if (numDimensions > 0 && length != 1)
+            return fail(path + " is not one-dimensional");
+
+        if (numDimensions == 0)
+            count = length;
+
+        numDimensions++;
+    }
+
+    const size_t dataStart = headerStart + headerLength;
+
+    elements = data + dataStart;
+    numElements = std::min<int64_t>(count, int64_t((size - dataStart) / itemSize));
+
+    return true;
+}
+
+/** Reads one little-endian element without assuming any alignment */
+template <typename T>
+static T readElement(const char* elements, int64_t index)
+{
+    T value;
+    std::memcpy(&value, elements + index * sizeof(T), sizeof(T));
+    return value;
+}
+
+double NpyArray::getAsDouble(int64_t index) const
+{
+    if (kind == 'f')
+        return itemSize == 4 ? double(readElement<float>(elements, index)) : readElement<double>(elements, index);
+
+    return double(getAsInt64(index));
+}
+
+int64_t NpyArray::getAsInt64(int64_t index) const
+{
+    if (kind == 'f')
+        return int64_t(getAsDouble(index));
+
+    if (kind == 'u')
+    {
+        switch (itemSize)
+        {
+            case 1: return readElement<uint8_t>(elements, index);
+            case 2: return readElement<uint16_t>(elements, index);
+            case 4: return readElement<uint32_t>(elements, index);
+            default: return int64_t(readElement<uint64_t>(elements, index));
+        }
+    }
+
+    switch (itemSize)
+    {
+        case 1: return readElement<int8_t>(elements, index);
+        case 2: return readElement<int16_t>(elements, index);
+        case 4: return readElement<int32_t>(elements, index);
+        default: return readElement<int64_t>(elements, index);
+    }
+}
+
+ChannelView::ChannelView(const int16_t* data_, int numChannels, int64_t numFrames_, double bitVolts_) :
+    data(data_),
+    stride(numChannels),
+    numFrames(numFrames_),
+    bitVolts(bitVolts_),
+    scale(float(bitVolts_))
+{
+
+}
+
+void ChannelView::read(int64_t startFrame, int numSamples, float* destination) const
+{
+    const int16_t* source = data + startFrame * stride;
+
+    for (int i = 0; i < numSamples; i++)
+        destination[i] = float(source[int64_t(i) * stride]) * scale;
+}
+
+ContinuousStream::ContinuousStream() :
+    sampleRate(0),
+    numChannels(0),
+    numFrames(0),
+    frames(nullptr)
+{
+
+}
+
+bool ContinuousStream::open(const std::string& recordingDirectory, const JsonValue& info_)
+{
+    info = info_;
+
+    name = info["folder_name"].getString();
+
+    while (! name.empty() && (name.back() == '/' || name.back() == '\\'))
+        name.pop_back();
+
+    directory = (fs::path(recordingDirectory) / "continuous" / name).string();
+
+    const JsonValue& channels = info["channels"];
+
+    sampleRate = info["sample_rate"].getNumber();
+    numChannels = int(info["num_channels"].getNumber(channels.size()));
+
+    if (name.empty() || sampleRate <= 0 || numChannels <= 0 || channels.size() < numChannels)
+    {
+        error = "Stream " + name + " has an invalid description";
+        return false;
+    }
+
+    bitVolts.clear();
+
+    for (int ch = 0; ch < numChannels; ch++)
+        bitVolts.push_back(channels[ch]["bit_volts"].getNumber(1.0));
+
+    if (! dataFile.openForReading((fs::path(directory) / "continuous.dat").string()))
+    {
+        error = dataFile.getError();
+        return false;
+    }
+
+    frames = reinterpret_cast<const int16_t*>(dataFile.getData());
+    numFrames = int64_t(dataFile.getSize() / (sizeof(int16_t) * numChannels));
+
+    const fs::path timestampPath = fs::path(directory) / "timestamps.npy";
+
+    if (fs::exists(timestampPath) && ! timestamps.open(timestampPath.string()))
+    {
+        error = timestamps.getError();
+        return false;
+    }
+
+    return true;
+}
+
+ChannelView ContinuousStream::getChannel(int channel) const
+{
+    return ChannelView(frames + channel, numChannels, numFrames, bitVolts[channel]);
+}
+
+ChunkReader::ChunkReader(ContinuousStream& stream_,
+                         int chunkSize_,
+                         int64_t startFrame,
+                         int64_t endFrame_,
+                         int prefetchDepth_,
+                         bool releaseConsumed_) :
+    stream(stream_),
+    chunkSize(std::max(chunkSize_, 1)),
+    endFrame(endFrame_ < 0 ? stream_.getNumFrames() : std::min(endFrame_, stream_.getNumFrames())),
+    prefetchDepth(std::max(prefetchDepth_, 0)),
+    releaseConsumed(releaseConsumed_),
+    position(std::max<int64_t>(startFrame, 0)),
+    prefetched(std::max<int64_t>(startFrame, 0)),
+    released(std::max<int64_t>(startFrame, 0))
+{
+
+}
+
+size_t ChunkReader::getOffset(int64_t frame) const
+{
+    return size_t(frame) * sizeof(int16_t) * stream.getNumChannels();
+}
+
+bool ChunkReader::next(Chunk& chunk)
+{
+    if (position >= endFrame)
+        return false;
+
+    // keep prefetchDepth chunks ahead of the one being returned
+    const int64_t prefetchEnd = std::min(position + int64_t(chunkSize) * (prefetchDepth + 1), endFrame);
+
+    if (prefetchEnd > prefetched)
+    {
+        stream.getDataFile().prefetch(getOffset(prefetched), getOffset(prefetchEnd) - getOffset(prefetched));
+        prefetched = prefetchEnd;
+    }
+
+    // the previous chunk has been consumed once the caller asks for the next one
+    if (releaseConsumed && position > released)
+    {
+        stream.getDataFile().release(getOffset(released), getOffset(position) - getOffset(released));
+        released = position;
+    }
+
+    chunk.startFrame = position;
+    chunk.numFrames = int(std::min<int64_t>(chunkSize, endFrame - position));
+    chunk.frames = stream.getFrames() + position * stream.getNumChannels();
+
+    position += chunk.numFrames;
+
+    return true;
+}
+
+bool OpenEphysBinaryReader::open(const std::string& recordingDirectory)
+{
+    const fs::path structurePath = fs::path(recordingDirectory) / "structure.oebin";
+
+    std::ifstream file(structurePath, std::ios::binary);
+
+    if (! file)
+    {
+        error = "Could not read " + structurePath.string();
+        return false;
+    }
+
+    std::stringstream text;
+    text << file.rdbuf();
+
+    std::string parseError;
+
+    if (! JsonValue::parse(text.str(), structure, parseError))
+    {
+        error = "Could not parse " + structurePath.string() + ": " + parseError;
+        return false;
+    }
+
+    streams.clear();
+
+    const JsonValue& continuous = structure["continuous"];
+
+    for (int i = 0; i < continuous.size(); i++)
+    {
+        streams.push_back(std::unique_ptr<ContinuousStream>(new ContinuousStream()));
+
+        if (! streams.back()->open(recordingDirectory, continuous[i]))
+        {
+            error = streams.back()->getError();
+            return false;
+        }
+    }
+
+    return true;
+}
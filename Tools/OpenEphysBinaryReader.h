@@ -0,0 +1,270 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef OPEN_EPHYS_BINARY_READER_H_INCLUDED
+#define OPEN_EPHYS_BINARY_READER_H_INCLUDED
+
+#include "JsonValue.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+    A memory-mapped one-dimensional NumPy array (.npy), such as timestamps.npy
+    or sample_numbers.npy.
+ */
+class NpyArray
+{
+public:
+
+    /** Constructor */
+    NpyArray();
+
+    /** Maps a .npy file. Returns false and sets the error message on failure. */
+    bool open(const std::string& path);
+
+    /** Returns the number of elements */
+    int64_t getNumElements() const { return numElements; }
+
+    /** Returns the NumPy type character: 'i', 'u' or 'f' */
+    char getKind() const { return kind; }
+
+    /** Returns the size of one element in bytes */
+    int getItemSize() const { return itemSize; }
+
+    /** Returns an element converted to double */
+    double getAsDouble(int64_t index) const;
+
+    /** Returns an element converted to a 64-bit integer */
+    int64_t getAsInt64(int64_t index) const;
+
+    /** Returns the mapped file, header included */
+    const MappedFile& getFile() const { return file; }
+
+    /** Returns a description of the last error */
+    const std::string& getError() const { return error; }
+
+private:
+
+    bool fail(const std::string& message);
+
+    MappedFile file;
+
+    const char* elements;
+    int64_t numElements;
+    char kind;
+    int itemSize;
+
+    std::string error;
+};
+
+/**
+    One channel of a continuous.dat file, seen through the interleaved frames
+    without copying them.
+ */
+class ChannelView
+{
+public:
+
+    /** Constructor */
+    ChannelView(const int16_t* data, int numChannels, int64_t numFrames, double bitVolts);
+
+    /** Returns the raw sample of a frame */
+    int16_t getRaw(int64_t frame) const { return data[frame * stride]; }
+
+    /** Returns the sample of a frame in the channel's units */
+    float getValue(int64_t frame) const { return float(data[frame * stride]) * scale; }
+
+    /** Copies numSamples scaled samples, starting at startFrame, into destination */
+    void read(int64_t startFrame, int numSamples, float* destination) const;
+
+    int64_t getNumFrames() const { return numFrames; }
+
+    double getBitVolts() const { return bitVolts; }
+
+private:
+
+    const int16_t* data;
+    int64_t stride;
+    int64_t numFrames;
+    double bitVolts;
+    float scale;
+};
+
+/**
+    One continuous stream of an Open Ephys binary recording: its description
+    from structure.oebin, its memory-mapped continuous.dat and its timestamps.
+ */
+class ContinuousStream
+{
+public:
+
+    /** Constructor */
+    ContinuousStream();
+
+    /** Maps the stream's files. Returns false and sets the error message on failure. */
+    bool open(const std::string& recordingDirectory, const JsonValue& info);
+
+    /** Returns the stream's entry in structure.oebin */
+    const JsonValue& getInfo() const { return info; }
+
+    /** Returns the stream's folder name, without a trailing separator */
+    const std::string& getName() const { return name; }
+
+    /** Returns the directory containing continuous.dat */
+    const std::string& getDirectory() const { return directory; }
+
+    double getSampleRate() const { return sampleRate; }
+
+    int getNumChannels() const { return numChannels; }
+
+    /** Returns the number of complete frames (one sample of every channel) */
+    int64_t getNumFrames() const { return numFrames; }
+
+    /** Returns the conversion factor from raw samples to the channel's units */
+    double getBitVolts(int channel) const { return bitVolts[channel]; }
+
+    /** Returns a view of one channel */
+    ChannelView getChannel(int channel) const;
+
+    /** Returns the interleaved frames */
+    const int16_t* getFrames() const { return frames; }
+
+    /** Returns the mapped continuous.dat */
+    const MappedFile& getDataFile() const { return dataFile; }
+    MappedFile& getDataFile() { return dataFile; }
+
+    /** Returns true if timestamps.npy was found */
+    bool hasTimestamps() const { return timestamps.getNumElements() > 0; }
+
+    /** Returns the timestamp of each frame */
+    const NpyArray& getTimestamps() const { return timestamps; }
+
+    /** Returns a description of the last error */
+    const std::string& getError() const { return error; }
+
+private:
+
+    JsonValue info;
+
+    std::string name;
+    std::string directory;
+
+    double sampleRate;
+    int numChannels;
+    int64_t numFrames;
+
+    std::vector<double> bitVolts;
+
+    MappedFile dataFile;
+    const int16_t* frames;
+
+    NpyArray timestamps;
+
+    std::string error;
+};
+
+/**
+    Walks a range of frames of a stream in fixed-size chunks.
+
+    While a chunk is being processed, the operating system is asked to read
+    the following chunks in the background. Optionally, chunks that have been
+    consumed are dropped from memory, which keeps the resident size of a long
+    sequential pass small; only do this when no other thread is still reading them.
+ */
+class ChunkReader
+{
+public:
+
+    struct Chunk
+    {
+        int64_t startFrame;
+        int numFrames;
+
+        /** Interleaved frames of the chunk */
+        const int16_t* frames;
+    };
+
+    /** Constructor */
+    ChunkReader(ContinuousStream& stream,
+                int chunkSize,
+                int64_t startFrame = 0,
+                int64_t endFrame = -1,
+                int prefetchDepth = 4,
+                bool releaseConsumed = false);
+
+    /** Returns the next chunk, or false when the range is exhausted */
+    bool next(Chunk& chunk);
+
+private:
+
+    size_t getOffset(int64_t frame) const;
+
+    ContinuousStream& stream;
+
+    const int chunkSize;
+    const int64_t endFrame;
+    const int prefetchDepth;
+    const bool releaseConsumed;
+
+    int64_t position;
+    int64_t prefetched;
+    int64_t released;
+};
+
+/**
+    Reads a recording in the Open Ephys binary format, without loading it into memory.
+ */
+class OpenEphysBinaryReader
+{
+public:
+
+    /** Constructor */
+    OpenEphysBinaryReader() { }
+
+    /** Reads structure.oebin and maps every continuous stream. Returns false and sets the error message on failure. */
+    bool open(const std::string& recordingDirectory);
+
+    /** Returns the parsed structure.oebin */
+    const JsonValue& getStructure() const { return structure; }
+
+    int getNumStreams() const { return int(streams.size()); }
+
+    ContinuousStream& getStream(int index) { return *streams[index]; }
+
+    /** Returns a description of the last error */
+    const std::string& getError() const { return error; }
+
+private:
+
+    JsonValue structure;
+
+    std::vector<std::unique_ptr<ContinuousStream>> streams;
+
+    std::string error;
+};
+
+#endif
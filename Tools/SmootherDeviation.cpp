@@ -0,0 +1,498 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2017 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+Measures how far one rolling window weighting deviates from another on a
+recording.
+
+Runs the selected channels of an Open Ephys binary recording through two
+IntegratorCores that differ only in their window profile or the precision of
+the window's stored samples (by default the exact quadratic window and the
+memory-free cascaded approximation of it),
+and reports per channel and window length the RMS and maximum difference of
+the envelopes and their correlation, once the first window has filled.
+*/
+
+#include "BandTable.h"
+#include "IntegratorCore.h"
+#include "JsonValue.h"
+#include "OpenEphysBinaryReader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct DeviationOptions
+{
+    std::string recordingDirectory;
+
+    /** Bands to integrate; the plugin's defaults (defaultBandTable) if none are given */
+    std::vector<BandSpec> bands;
+
+    /** Window lengths to compare at; 100, 1000 and 5000 ms if none are given */
+    std::vector<double> windowsMs;
+
+    WindowProfile reference = WindowProfile::QUADRATIC;
+    WindowProfile smoother = WindowProfile::CASCADED;
+
+    WindowStorage referencePrecision = WindowStorage::DOUBLE;
+    WindowStorage precision = WindowStorage::DOUBLE;
+
+    /** Fit of either window if it is savitzky-golay, with the lookahead in ms */
+    int sgOrder = 2;
+    double sgLookaheadMs = 0.0;
+
+    int chunkSize = 1024;
+
+    /** Stream indices (into the "continuous" array) and channels to compare; empty means all */
+    std::vector<int> streams;
+    std::vector<int> channels;
+
+    std::string jsonPath;
+};
+
+/** Running sums for the difference between a reference envelope and another one */
+struct Deviation
+{
+    int64_t numSamples = 0;
+
+    double sumReference = 0, sumOther = 0;
+    double sumReferenceSquared = 0, sumOtherSquared = 0, sumProduct = 0;
+    double sumErrorSquared = 0;
+    double maxError = 0;
+
+    void add(double reference, double other)
+    {
+        const double error = other - reference;
+
+        numSamples++;
+        sumReference += reference;
+        sumOther += other;
+        sumReferenceSquared += reference * reference;
+        sumOtherSquared += other * other;
+        sumProduct += reference * other;
+        sumErrorSquared += error * error;
+        maxError = std::max(maxError, std::fabs(error));
+    }
+
+    double getReferenceRms() const { return numSamples > 0 ? std::sqrt(sumReferenceSquared / numSamples) : 0.0; }
+
+    double getErrorRms() const { return numSamples > 0 ? std::sqrt(sumErrorSquared / numSamples) : 0.0; }
+
+    /** RMS error as a percentage of the reference's RMS */
+    double getRelativeError() const
+    {
+        const double referenceRms = getReferenceRms();
+
+        return referenceRms > 0 ? 100.0 * getErrorRms() / referenceRms : 0.0;
+    }
+
+    double getCorrelation() const
+    {
+        if (numSamples == 0)
+            return 0.0;
+
+        const double n = double(numSamples);
+        const double covariance = sumProduct - sumReference * sumOther / n;
+        const double referenceVariance = sumReferenceSquared - sumReference * sumReference / n;
+        const double otherVariance = sumOtherSquared - sumOther * sumOther / n;
+
+        return referenceVariance > 0 && otherVariance > 0 ? covariance / std::sqrt(referenceVariance * otherVariance) : 0.0;
+    }
+};
+
+static void printUsage()
+{
+    std::printf("Usage: mbi-deviation <recording directory> [options]\n"
+                "\n"
+                "The recording directory must contain structure.oebin.\n"
+                "\n"
+                "Options:\n"
+                "  --window-ms ms         window length to compare at; may be repeated\n"
+                "                         (default 100, 1000 and 5000)\n"
+                "  --reference name       weighting to compare against (default quadratic)\n"
+                "  --smoother name        weighting to measure (default cascaded)\n"
+                "  --reference-precision p\n"
+                "                         window storage of the reference: double, float,\n"
+                "                         int32 or int16 (default double)\n"
+                "  --precision p          window storage to measure (default double)\n"
+                "  --sg-order n           polynomial order of a savitzky-golay window, 0-4\n"
+                "                         (default 2)\n"
+                "  --sg-lookahead-ms ms   lookahead of a savitzky-golay window (default 0)\n"
+                "  --bands table          bands as low:high:gain[:order], comma-separated\n"
+                "                         (default \"%s\")\n"
+                "  --channels list        comma-separated channel indices (default: all)\n"
+                "  --streams list         comma-separated continuous stream indices (default: all)\n"
+                "  --chunk n              samples per processing block (default 1024)\n"
+                "  --json path            also write the results as JSON\n",
+                defaultBandTable);
+}
+
+static bool parseIndexList(const std::string& text, std::vector<int>& indices)
+{
+    std::stringstream stream(text);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+    {
+        char* end = nullptr;
+        const long value = std::strtol(item.c_str(), &end, 10);
+
+        if (item.empty() || *end != 0 || value < 0)
+            return false;
+
+        indices.push_back(int(value));
+    }
+
+    return ! indices.empty();
+}
+
+static bool parseArguments(int argc, char** argv, DeviationOptions& options)
+{
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+
+        if (argument == "--help" || argument == "-h")
+            return false;
+
+        if (argument.compare(0, 2, "--") != 0)
+        {
+            positional.push_back(argument);
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::fprintf(stderr, "Missing value for %s\n", argument.c_str());
+            return false;
+        }
+
+        const std::string value = argv[++i];
+        bool valid = true;
+
+        if (argument == "--window-ms")
+        {
+            const double windowMs = std::atof(value.c_str());
+            valid = windowMs > 0;
+            options.windowsMs.push_back(windowMs);
+        }
+        else if (argument == "--reference")
+        {
+            valid = parseWindowProfile(value, options.reference);
+        }
+        else if (argument == "--smoother")
+        {
+            valid = parseWindowProfile(value, options.smoother);
+        }
+        else if (argument == "--reference-precision")
+        {
+            valid = parseWindowStorage(value, options.referencePrecision);
+        }
+        else if (argument == "--precision")
+        {
+            valid = parseWindowStorage(value, options.precision);
+        }
+        else if (argument == "--sg-order")
+        {
+            options.sgOrder = std::atoi(value.c_str());
+            valid = options.sgOrder >= 0 && options.sgOrder <= SavitzkyGolayShape::maxOrder;
+        }
+        else if (argument == "--sg-lookahead-ms")
+        {
+            options.sgLookaheadMs = std::atof(value.c_str());
+            valid = options.sgLookaheadMs >= 0;
+        }
+        else if (argument == "--bands")
+        {
+            valid = parseBandTable(value, options.bands);
+        }
+        else if (argument == "--channels")
+        {
+            valid = parseIndexList(value, options.channels);
+        }
+        else if (argument == "--streams")
+        {
+            valid = parseIndexList(value, options.streams);
+        }
+        else if (argument == "--chunk")
+        {
+            options.chunkSize = std::atoi(value.c_str());
+            valid = options.chunkSize > 0;
+        }
+        else if (argument == "--json")
+        {
+            options.jsonPath = value;
+        }
+        else
+        {
+            std::fprintf(stderr, "Unknown option %s\n", argument.c_str());
+            return false;
+        }
+
+        if (! valid)
+        {
+            std::fprintf(stderr, "Invalid value for %s: %s\n", argument.c_str(), value.c_str());
+            return false;
+        }
+    }
+
+    if (positional.size() != 1)
+        return false;
+
+    options.recordingDirectory = positional[0];
+
+    if (options.bands.empty())
+        parseBandTable(defaultBandTable, options.bands);
+
+    if (options.windowsMs.empty())
+        options.windowsMs = { 100.0, 1000.0, 5000.0 };
+
+    return true;
+}
+
+/** Configures a core as MultiBandIntegratorSettings::publish would */
+static void configureCore(IntegratorCore& core, const DeviationOptions& options, double sampleRate,
+                          int windowSamples, WindowProfile profile, WindowStorage storage, int numChannels)
+{
+    core.prepare(numChannels);
+    core.setBands(sampleRate, options.bands);
+
+    core.setWindowSamples(windowSamples);
+    core.setWindowProfile(profile);
+    core.setWindowStorage(storage);
+
+    SavitzkyGolayShape shape;
+    shape.order = options.sgOrder;
+    shape.lookahead = int(float(sampleRate) * float(options.sgLookaheadMs) / 1000.0f);
+    core.setSavitzkyGolayShape(shape);
+
+    core.setNumChannels(numChannels);
+}
+
+/** Compares the two windows on the selected channels of one stream at one window length */
+static std::vector<Deviation> measureStream(ContinuousStream& stream,
+                                            const std::vector<int>& channels,
+                                            const DeviationOptions& options,
+                                            double windowMs)
+{
+    const int numChannels = int(channels.size());
+    const int chunkSize = options.chunkSize;
+    const double sampleRate = stream.getSampleRate();
+
+    // same rounding as MultiBandIntegratorSettings::setRollingWindowParameters
+    const int windowSamples = std::max(int(float(sampleRate) * float(windowMs) / 1000.0f), 1);
+
+    IntegratorCore reference;
+    IntegratorCore other;
+
+    configureCore(reference, options, sampleRate, windowSamples, options.reference, options.referencePrecision, numChannels);
+    configureCore(other, options, sampleRate, windowSamples, options.smoother, options.precision, numChannels);
+
+    std::vector<ChannelView> views;
+
+    for (int ch : channels)
+        views.push_back(stream.getChannel(ch));
+
+    std::vector<float> referenceBlock(size_t(numChannels) * chunkSize);
+    std::vector<float> otherBlock(referenceBlock.size());
+    std::vector<float*> referencePointers(numChannels);
+    std::vector<float*> otherPointers(numChannels);
+
+    for (int ch = 0; ch < numChannels; ch++)
+    {
+        referencePointers[ch] = referenceBlock.data() + size_t(ch) * chunkSize;
+        otherPointers[ch] = otherBlock.data() + size_t(ch) * chunkSize;
+    }
+
+    std::vector<Deviation> deviations(numChannels);
+
+    ChunkReader reader(stream, chunkSize);
+    ChunkReader::Chunk chunk;
+
+    while (reader.next(chunk))
+    {
+        const int numSamples = chunk.numFrames;
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            views[ch].read(chunk.startFrame, numSamples, referencePointers[ch]);
+            std::copy(referencePointers[ch], referencePointers[ch] + numSamples, otherPointers[ch]);
+        }
+
+        reference.process(referencePointers.data(), referencePointers.data(), numSamples);
+        other.process(otherPointers.data(), otherPointers.data(), numSamples);
+
+        // both start from silence, so the first window is left out
+        const int firstCounted = int(std::min<int64_t>(std::max<int64_t>(windowSamples - chunk.startFrame, 0), numSamples));
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            for (int i = firstCounted; i < numSamples; i++)
+                deviations[ch].add(referencePointers[ch][i], otherPointers[ch][i]);
+        }
+    }
+
+    return deviations;
+}
+
+int main(int argc, char** argv)
+{
+    DeviationOptions options;
+
+    if (! parseArguments(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    OpenEphysBinaryReader reader;
+
+    if (! reader.open(options.recordingDirectory))
+    {
+        std::fprintf(stderr, "%s\n", reader.getError().c_str());
+        return 1;
+    }
+
+    std::vector<int> streamIndices = options.streams;
+
+    if (streamIndices.empty())
+    {
+        for (int i = 0; i < reader.getNumStreams(); i++)
+            streamIndices.push_back(i);
+    }
+
+    std::printf("%s (%s) compared with %s (%s), bands %s\n\n",
+                getWindowProfileName(options.smoother), getWindowStorageName(options.precision),
+                getWindowProfileName(options.reference), getWindowStorageName(options.referencePrecision),
+                formatBandTable(options.bands).c_str());
+    std::printf("%-24s %4s %8s %12s %12s %8s %12s %8s\n",
+                "stream", "ch", "window", "ref rms", "error rms", "error %", "max error", "corr");
+
+    JsonValue results = JsonValue::array();
+
+    for (int streamIndex : streamIndices)
+    {
+        if (streamIndex >= reader.getNumStreams())
+        {
+            std::fprintf(stderr, "There is no stream %d\n", streamIndex);
+            return 1;
+        }
+
+        ContinuousStream& stream = reader.getStream(streamIndex);
+
+        std::vector<int> channels = options.channels;
+
+        if (channels.empty())
+        {
+            for (int ch = 0; ch < stream.getNumChannels(); ch++)
+                channels.push_back(ch);
+        }
+
+        for (int ch : channels)
+        {
+            if (ch >= stream.getNumChannels())
+            {
+                std::fprintf(stderr, "Stream %s has no channel %d\n", stream.getName().c_str(), ch);
+                return 1;
+            }
+        }
+
+        for (const BandSpec& band : options.bands)
+        {
+            if (band.highCut >= stream.getSampleRate() / 2)
+            {
+                std::fprintf(stderr, "Band %g-%g Hz is above the Nyquist frequency of stream %s\n",
+                             band.lowCut, band.highCut, stream.getName().c_str());
+                return 1;
+            }
+        }
+
+        for (double windowMs : options.windowsMs)
+        {
+            const std::vector<Deviation> deviations = measureStream(stream, channels, options, windowMs);
+
+            for (size_t i = 0; i < channels.size(); i++)
+            {
+                const Deviation& deviation = deviations[i];
+
+                std::printf("%-24s %4d %8g %12.4g %12.4g %8.2f %12.4g %8.4f\n",
+                            stream.getName().c_str(),
+                            channels[i],
+                            windowMs,
+                            deviation.getReferenceRms(),
+                            deviation.getErrorRms(),
+                            deviation.getRelativeError(),
+                            deviation.maxError,
+                            deviation.getCorrelation());
+
+                JsonValue result = JsonValue::object();
+
+                result.setMember("stream", stream.getName());
+                result.setMember("channel", channels[i]);
+                result.setMember("window_ms", windowMs);
+                result.setMember("samples", double(deviation.numSamples));
+                result.setMember("reference_rms", deviation.getReferenceRms());
+                result.setMember("error_rms", deviation.getErrorRms());
+                result.setMember("error_percent", deviation.getRelativeError());
+                result.setMember("max_error", deviation.maxError);
+                result.setMember("correlation", deviation.getCorrelation());
+
+                results.append(result);
+            }
+        }
+    }
+
+    if (! options.jsonPath.empty())
+    {
+        JsonValue report = JsonValue::object();
+
+        report.setMember("reference", getWindowProfileName(options.reference));
+        report.setMember("smoother", getWindowProfileName(options.smoother));
+        report.setMember("reference_precision", getWindowStorageName(options.referencePrecision));
+        report.setMember("precision", getWindowStorageName(options.precision));
+        report.setMember("sg_order", options.sgOrder);
+        report.setMember("sg_lookahead_ms", options.sgLookaheadMs);
+        report.setMember("bands", formatBandTable(options.bands));
+        report.setMember("results", results);
+
+        std::ofstream file(options.jsonPath, std::ios::binary);
+        file << report.toString();
+
+        if (! file)
+        {
+            std::fprintf(stderr, "Could not write %s\n", options.jsonPath.c_str());
+            return 1;
+        }
+    }
+
+    return 0;
+}